@@ -0,0 +1,148 @@
+#pragma once
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define ACPI_RSDP_SIGNATURE "RSD PTR "
+#define ACPI_MADT_SIGNATURE "APIC"
+
+// MADT entry types
+#define MADT_LAPIC           0
+#define MADT_IOAPIC          1
+#define MADT_ISO             2
+#define MADT_LAPIC_OVERRIDE  5
+
+#define MADT_LAPIC_ENABLED 0x1
+#define MADT_LAPIC_ONLINE_CAPABLE 0x2
+
+// MP configuration table entry types
+#define MP_ENTRY_PROCESSOR 0
+#define MP_ENTRY_BUS       1
+#define MP_ENTRY_IOAPIC    2
+#define MP_ENTRY_IO_INT    3
+#define MP_ENTRY_LOCAL_INT 4
+
+#define MP_PROCESSOR_ENABLED 0x1
+#define MP_IOAPIC_ENABLED    0x1
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_header_t;
+
+typedef struct {
+    madt_entry_header_t header;
+    uint8_t processor_id;
+    uint8_t lapic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_lapic_t;
+
+typedef struct {
+    madt_entry_header_t header;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t ioapic_addr;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct {
+    madt_entry_header_t header;
+    uint8_t bus;
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_iso_t;
+
+typedef struct {
+    madt_entry_header_t header;
+    uint16_t reserved;
+    uint64_t lapic_addr;
+} __attribute__((packed)) madt_lapic_override_t;
+
+typedef struct {
+    char signature[4]; // _MP_
+    uint32_t config_addr;
+    uint8_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_floating_pointer_t;
+
+typedef struct {
+    char signature[4]; // PCMP
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table_addr;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t extended_length;
+    uint8_t extended_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t lapic_id;
+    uint8_t lapic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t feature_flags;
+    uint32_t reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t ioapic_id;
+    uint8_t ioapic_version;
+    uint8_t flags;
+    uint32_t ioapic_addr;
+} __attribute__((packed)) mp_ioapic_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t bus_id;
+    char bus_type[6];
+} __attribute__((packed)) mp_bus_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t interrupt_type;
+    uint16_t flags;
+    uint8_t src_bus_id;
+    uint8_t src_bus_irq;
+    uint8_t dst_ioapic_id;
+    uint8_t dst_ioapic_pin;
+} __attribute__((packed)) mp_io_int_t;
+
+// acpi.c
+bool acpi_init();
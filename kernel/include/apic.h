@@ -0,0 +1,75 @@
+#pragma once
+
+#include "stdint.h"
+#include "stdbool.h"
+
+// local APIC registers, offset from the LAPIC base
+#define LAPIC_REG_ID            0x20
+#define LAPIC_REG_VERSION       0x30
+#define LAPIC_REG_TPR           0x80
+#define LAPIC_REG_EOI           0xb0
+#define LAPIC_REG_SVR           0xf0
+#define LAPIC_REG_ESR           0x280
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_LVT_LINT0     0x350
+#define LAPIC_REG_LVT_LINT1     0x360
+#define LAPIC_REG_LVT_ERROR     0x370
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3e0
+
+#define LAPIC_SVR_ENABLE 0x100
+
+#define LAPIC_LVT_MASKED   0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+#define LAPIC_ICR_INIT         0x500
+#define LAPIC_ICR_STARTUP      0x600
+#define LAPIC_ICR_PENDING      0x1000
+#define LAPIC_ICR_ASSERT       0x4000
+#define LAPIC_ICR_LEVEL        0x8000
+#define LAPIC_ICR_ALL_BUT_SELF 0xc0000
+
+// IO APIC registers, accessed through IOREGSEL/IOWIN
+#define IOAPIC_REG_SELECT 0x00
+#define IOAPIC_REG_WINDOW 0x10
+
+#define IOAPIC_ID      0x00
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION_TABLE(n) (0x10 + (n) * 2)
+
+#define IOAPIC_MASKED        0x10000
+#define IOAPIC_LEVEL_TRIGGER 0x8000
+#define IOAPIC_ACTIVE_LOW    0x2000
+
+// MADT interrupt source override flags
+#define APIC_POLARITY_MASK 0x3
+#define APIC_POLARITY_LOW  0x3
+#define APIC_TRIGGER_MASK  0xc
+#define APIC_TRIGGER_LEVEL 0xc
+
+// vectors used by the local APIC
+// vector 32 to 47 are still used by ISA IRQs, now routed through the IO APIC
+#define LAPIC_TIMER_VECTOR    48
+#define LAPIC_IPI_VECTOR      49
+#define LAPIC_SPURIOUS_VECTOR 0xff
+
+#define IOAPIC_ISA_IRQS 16
+
+// apic.c
+bool apic_available();
+bool apic_enabled();
+void lapic_set_base(uint32_t phys);
+void lapic_init();
+uint8_t lapic_get_id();
+void lapic_send_eoi();
+void lapic_send_ipi(uint8_t lapic_id, uint32_t flags);
+void lapic_timer_calibrate();
+void lapic_timer_start(unsigned hz);
+void ioapic_set_base(uint32_t phys, uint32_t gsi_base);
+void ioapic_add_override(uint8_t irq, uint32_t gsi, uint16_t flags);
+void ioapic_set_irq(uint8_t irq, uint8_t vector, uint8_t lapic_id, bool masked);
+bool apic_init();
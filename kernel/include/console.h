@@ -0,0 +1,12 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+
+// outputs that get a copy of everything printed to the screen, like the serial port
+#define CONSOLE_MAX_SINKS 4
+
+bool console_add_sink(void (*write)(const char* data, size_t len), void (*flush)());
+void console_write(const char* data, size_t len);
+void console_write_sinks(const char* data, size_t len);
+void console_flush();
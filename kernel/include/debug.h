@@ -1,6 +1,12 @@
 #pragma once
 
 #include "stdarg.h"
+#include "stdbool.h"
+
+// how many records the kernel log keeps
+#define KLOG_RECORD_COUNT 256
+// longer messages are cut
+#define KLOG_TEXT_SIZE 120
 
 enum LOG_TAG{
     LT_IF,
@@ -10,4 +16,10 @@ enum LOG_TAG{
     LT_CR
 };
 
+struct process;
+
 void print_debug(int log_tag, const char* restrict format, ...);
+void klog_flush();
+void klog_panic_flush();
+bool klog_init_thread(struct process* kernel_proc);
+void klog_dump();
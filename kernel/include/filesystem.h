@@ -146,6 +146,7 @@ FS_ERR fs_copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copi
 FILE file_open(fs_node_t* node, int mode);
 FS_ERR file_write(FILE* file, uint8_t* data, size_t size);
 FS_ERR file_read(FILE* file, uint8_t* buffer, size_t size);
+FS_ERR file_read_at(fs_node_t* node, uint32_t offset, uint8_t* buffer, size_t size);
 FS_ERR file_close(FILE* file);
 
 // fat32.c
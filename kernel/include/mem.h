@@ -7,7 +7,8 @@
 typedef enum {
     ERR_MEM_SUCCESS,
     ERR_MEM_OOM,
-    ERR_MEM_UNMAPPED
+    ERR_MEM_UNMAPPED,
+    ERR_MEM_LARGE_PAGE
 } MEM_ERR;
 
 typedef uint32_t pde_t;
@@ -16,6 +17,8 @@ typedef uint32_t physical_addr_t;
 typedef uint32_t virtual_addr_t;
 
 #define MMNGR_PAGE_SIZE 4096
+// a page directory entry with PDE_4MB maps this much by itself
+#define MMNGR_LARGE_PAGE_SIZE 0x400000
 
 #define PTE_PRESENT       1
 #define PTE_WRITABLE      2
@@ -27,6 +30,10 @@ typedef uint32_t virtual_addr_t;
 #define PTE_PAT           0x80
 #define PTE_CPU_GLOBAL    0x100
 #define PTE_LV4_GLOBAL    0x200
+// available to the OS, set on read-only pages that are shared after fork
+#define PTE_COPY_ON_WRITE 0x400
+// PAT entry 4, programmed as write-combining by vmmngr_init
+#define PTE_WRITE_COMBINING PTE_PAT
 
 #define PDE_PRESENT    1
 #define PDE_WRITABLE   2
@@ -38,14 +45,23 @@ typedef uint32_t virtual_addr_t;
 #define PDE_4MB        0x80
 #define PDE_CPU_GLOBAL 0x100
 #define PDE_LV4_GLOBAL 0x200
+// PAT bit of a 4MiB page
+#define PDE_4MB_PAT    0x1000
 
 #define PAGE_DIRECTORY_INDEX(addr) (((addr) >> 22) & 0x3ff)
 #define PAGE_TABLE_INDEX(addr) (((addr) >> 12) & 0x3ff)
 #define PAGE_TABLE_LOOKUP(page, addr) (&(page)->entry[PAGE_TABLE_INDEX(addr)])
 #define PAGE_DIRECTORY_LOOKUP(page, addr) (&(page)->entry[PAGE_DIRECTORY_INDEX(addr)])
+// one bit for each page table below KERNEL_START
+#define PAGE_TABLE_BITMAP_SIZE (PAGE_DIRECTORY_INDEX(KERNEL_START) / 32)
 
-#define HEAP_SUPERVISOR 0b01
-#define HEAP_READONLY   0b10
+// number of pre-zeroed frames kept by the idle threads
+#define ZERO_POOL_SIZE 64
+
+#define HEAP_SUPERVISOR 0b001
+#define HEAP_READONLY   0b010
+// only map the first page, the rest is mapped by the page fault handler when touched
+#define HEAP_LAZY       0b100
 
 #define HEAP_FREE 0x7ea9f2ee
 #define HEAP_USED 0x7ea942ed
@@ -83,24 +99,41 @@ void pmmngr_init_region(physical_addr_t base, size_t size);
 void pmmngr_deinit_region(physical_addr_t base, size_t size);
 void* pmmngr_alloc_block();
 void* pmmngr_alloc_multi_block(size_t cnt);
+void* pmmngr_alloc_large_blocks(size_t cnt);
 void pmmngr_free_block(void* base);
 void pmmngr_free_multi_block(void* base, size_t cnt);
+bool pmmngr_ref_block(void* base);
+bool pmmngr_is_shared(void* base);
 void pmmngr_init(size_t size);
 
 // vmmngr.c
 page_directory_t* vmmngr_get_page_directory();
 page_directory_t* vmmngr_get_kernel_page_directory();
 physical_addr_t vmmngr_to_physical_addr(page_directory_t* page_directory, virtual_addr_t virt);
+bool vmmngr_is_user_writable(virtual_addr_t virt);
 MEM_ERR vmmngr_map(page_directory_t* page_directory, physical_addr_t phys, virtual_addr_t virt, unsigned flags);
 void vmmngr_unmap(page_directory_t* page_directory, virtual_addr_t virt);
+MEM_ERR vmmngr_map_range(page_directory_t* page_directory, physical_addr_t phys, virtual_addr_t virt, size_t size, unsigned flags);
+void vmmngr_unmap_range(page_directory_t* page_directory, virtual_addr_t virt, size_t size);
+void vmmngr_release_flushed_frames();
+void vmmngr_handle_shootdown();
 MEM_ERR vmmngr_alloc_page(pte_t* pte);
 void vmmngr_free_page(pte_t* pte);
 page_directory_t* vmmngr_alloc_page_directory();
-void vmmngr_free_page_directory(page_directory_t* page_directory);
-void vmmngr_switch_page_directory(page_directory_t* dir);
+void vmmngr_free_page_directory(page_directory_t* page_directory, const uint32_t* page_tables);
+page_directory_t* vmmngr_fork_page_directory(uint32_t* page_tables);
+bool vmmngr_copy_on_write(virtual_addr_t virt);
+MEM_ERR vmmngr_set_flags(page_directory_t* page_directory, virtual_addr_t virt, unsigned flags);
+void vmmngr_switch_page_directory(page_directory_t* dir, uint32_t* page_tables);
 void vmmngr_flush_tlb_entry(virtual_addr_t addr);
 void vmmngr_init();
 
+// zero_pool.c
+void* zero_pool_alloc();
+void zero_pool_write_frame(physical_addr_t phys, size_t offset, const void* data, size_t size);
+void zero_pool_refill();
+void zero_pool_init();
+
 // heap.c
 heap_t* heap_new(uint32_t start, uint32_t size, size_t max_size, uint8_t flags);
 bool heap_expand(heap_t* heap, size_t page_count, heap_header_t* last_header);
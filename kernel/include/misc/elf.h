@@ -36,6 +36,30 @@
 #define ELF_SHT_LOUSER       0x80000000
 #define ELF_SHT_HIUSER       0xffffffff
 
+// ET = elf type
+#define ELF_ET_NONE 0
+#define ELF_ET_REL  1
+#define ELF_ET_EXEC 2
+#define ELF_ET_DYN  3
+#define ELF_ET_CORE 4
+
+#define ELF_CLASS_32 1
+#define ELF_CLASS_64 2
+
+// PT = program header type
+#define ELF_PT_NULL    0
+#define ELF_PT_LOAD    1
+#define ELF_PT_DYNAMIC 2
+#define ELF_PT_INTERP  3
+#define ELF_PT_NOTE    4
+#define ELF_PT_SHLIB   5
+#define ELF_PT_PHDR    6
+
+// PF = program header flags
+#define ELF_PF_X 1
+#define ELF_PF_W 2
+#define ELF_PF_R 4
+
 #define ELF_ST_BIND(i) ((i) >> 4)
 #define ELF_ST_TYPE(i) ((i) & 0xf)
 
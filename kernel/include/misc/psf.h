@@ -18,4 +18,5 @@ typedef struct {
 
 bool psf_load(char* font_data);
 void psf_get_font_geometry(int* width, int* height, int* bpg);
+int psf_get_glyph_count();
 char* psf_get_glyph(char chr);
@@ -11,6 +11,7 @@
 void pit_timer_frequency(int hz);
 unsigned pit_get_count();
 void pit_set_count(unsigned count);
+void pit_sleep_polling(unsigned us);
 
 void pit_beep_start();
 void pit_beep_stop();
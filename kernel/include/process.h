@@ -2,66 +2,246 @@
 
 #include "mem.h"
 #include "system.h"
+#include "filesystem.h"
 
 #include "stdint.h"
 
-// how many ticks a process will run before got switch to others
+// how many ticks a thread will run before got switch to others
 #define PROCESS_ALIVE_TICKS 4
+// how often each cpu tries to even out the run queues
+#define SCHEDULER_BALANCE_TICKS 100
+// how many times to retry a lock whose owner is running before going to sleep
+#define MUTEX_SPIN_COUNT 1000
 
-enum PROCESS_STATE {
-    PROCESS_STATE_READY,
-    PROCESS_STATE_ACTIVE,
-    PROCESS_STATE_SLEEP,
-    PROCESS_STATE_BLOCK,
+// every thread has its own stack for kernel mode, interrupts and syscalls run on it
+#define THREAD_KERNEL_STACK_SIZE (16 * 1024)
+
+// user stacks are placed right below the kernel, one slot per thread
+// the lowest page of each slot is left unmapped to catch stack overflows
+#define USTACK_MAX_COUNT 32
+#define USTACK_SLOT_SIZE (USTACK_SIZE + MMNGR_PAGE_SIZE)
+#define USTACK_REGION_START (KERNEL_START - USTACK_MAX_COUNT * USTACK_SLOT_SIZE)
+
+enum THREAD_STATE {
+    THREAD_STATE_READY,
+    THREAD_STATE_ACTIVE,
+    THREAD_STATE_SLEEP,
+    THREAD_STATE_BLOCK,
+    // exited but not joined yet
+    THREAD_STATE_ZOMBIE,
 };
 
-typedef struct process {
+struct thread;
+struct process;
+struct mutex;
+
+typedef struct {
+    struct thread* top;
+    struct thread* bottom;
+    uint32_t size;
+} thread_queue_t;
+
+#define THREAD_QUEUE_INIT {NULL, NULL, 0}
+
+// threads are what the scheduler runs
+// threads of the same process share its page directory and heap
+typedef struct thread {
     int id;
     int priority;
+    // priority before being boosted by priority inheritance
+    int base_priority;
     int state;
     uint64_t alive_ticks;
     uint64_t sleep_ticks;
-    page_directory_t* page_directory;
+    // the cpu this thread ran on last time, -1 if it has never run
+    int last_cpu;
+    // lowest address of the user stack, 0 for kernel threads
     uint32_t stack_addr;
+    // lowest address of the kernel stack
+    uint32_t kernel_stack;
+    // set while a cpu that switched away from the thread is still running on its kernel stack
+    // the thread can not be resumed anywhere until then
+    atomic_bool stack_in_use;
+    // the registers it is resumed with, for a kernel mode thread useresp holds its esp
     regs_t regs;
-    struct process* next;
-} process_t;
+    struct process* process;
+    // next thread in the process's thread list
+    struct thread* sibling;
+    int exit_code;
+    // threads waiting in thread_join for this thread
+    thread_queue_t join_queue;
+    // the wait queue the thread is blocked on and the lock protecting it, NULL while not blocked
+    thread_queue_t* wait_queue;
+    ticketlock_t* wait_queue_lock;
+    // protects the wait queue fields and priority changes made by other threads
+    ticketlock_t lock;
+    // bumped each time another thread raises the priority, see mutex.c
+    unsigned priority_boosts;
+    // mutexes the thread holds, linked through next_held
+    struct mutex* held_mutexes;
+    struct thread* next;
+} thread_t;
 
+// what the shell shows about a thread, copied while the scheduler's locks are held
 typedef struct {
-    process_t* top;
-    process_t* bottom;
-    uint32_t size;
-} process_queue_t;
-
-#define PROCESS_QUEUE_INIT {NULL, NULL, 0}
+    int id;
+    int process_id;
+    int priority;
+    int state;
+    uint64_t alive_ticks;
+    uint64_t sleep_ticks;
+} thread_info_t;
 
 typedef struct {
     uint32_t max_count;
     uint32_t current_count;
-    process_queue_t waiting_queue;
+    thread_queue_t waiting_queue;
+    ticketlock_t lock;
 } semaphore_t;
 
+// sleeping locks below can only be used by threads, not interrupt handlers
+
+typedef struct mutex {
+    ticketlock_t lock;
+    bool locked;
+    thread_t* owner;
+    // whether the owner is running on a cpu right now, kept up to date by the scheduler
+    // waiters spin on this instead of looking at the owner, which may be gone by then
+    bool owner_running;
+    // next mutex held by the same owner
+    struct mutex* next_held;
+    // highest priority of the waiters, what the owner inherits through this mutex
+    int waiter_priority;
+    thread_queue_t waiting_queue;
+} mutex_t;
+
+#define MUTEX_INIT {TICKETLOCK_INIT, false, NULL, false, NULL, 0, THREAD_QUEUE_INIT}
+
+typedef struct {
+    ticketlock_t lock;
+    thread_queue_t waiting_queue;
+} condvar_t;
+
+#define CONDVAR_INIT {TICKETLOCK_INIT, THREAD_QUEUE_INIT}
+
+// readers are preferred so a reader can take the lock again while already holding it
+typedef struct {
+    ticketlock_t lock;
+    unsigned readers;
+    bool writing;
+    thread_t* writer;
+    thread_queue_t read_queue;
+    thread_queue_t write_queue;
+} rwlock_t;
+
+#define RWLOCK_INIT {TICKETLOCK_INIT, 0, false, NULL, THREAD_QUEUE_INIT, THREAD_QUEUE_INIT}
+
+// a range of user memory that is only mapped on the first access
+// the first file_size bytes are read from the process image, the rest is zero-filled
+typedef struct vm_area {
+    uint32_t start;
+    uint32_t end;
+    uint32_t file_offset;
+    uint32_t file_size;
+    bool writable;
+    struct vm_area* next;
+} vm_area_t;
+
+typedef struct process {
+    int id;
+    page_directory_t* page_directory;
+    // a bit for each user page table the page directory has, see vmmngr_free_page_directory()
+    uint32_t page_tables[PAGE_TABLE_BITMAP_SIZE];
+    // user heap, NULL for kernel processes
+    heap_t* heap;
+    // a bit for each used user stack slot
+    uint32_t stack_slots;
+    thread_t* threads;
+    // threads that have not exited yet
+    unsigned alive_threads;
+    // set by kill, the remaining threads are dropped when they are scheduled
+    bool killed;
+    ticketlock_t lock;
+    // the executable the lazily mapped areas are read from
+    fs_node_t image;
+    vm_area_t* areas;
+    // protects the area list, and makes checking and mapping a faulting page one step
+    ticketlock_t vm_lock;
+    // next process waiting for the reaper
+    struct process* next;
+} process_t;
+
 // process.c
 process_t* process_new(uint32_t eip, int priority, bool is_user);
+int process_fork(regs_t* regs);
 void process_delete(process_t* proc);
+void process_reap(process_t* proc);
+bool process_init_reaper(process_t* kernel_proc);
+
+// exec.c
+process_t* process_exec(fs_node_t* node, int priority);
 
-// process_queue.c
-bool process_sort_by_sleep_ticks(process_t* a, process_t* b);
-void process_queue_push(process_queue_t* procqueue, process_t* proc);
-void process_queue_sorted_push(process_queue_t* procqueue, process_t* proc, bool (*cmp)(process_t*, process_t*));
-process_t* process_queue_pop(process_queue_t* procqueue);
+// vm_area.c
+bool vm_area_add(process_t* proc, uint32_t start, uint32_t end, uint32_t file_offset, uint32_t file_size, bool writable);
+bool vm_area_copy_all(process_t* dst, process_t* src);
+void vm_area_free_all(process_t* proc);
+bool vm_area_page_fault(uint32_t addr, bool present);
+
+// thread.c
+thread_t* thread_new(process_t* proc, uint32_t eip, int priority);
+thread_t* thread_fork(process_t* proc, thread_t* src, regs_t* regs);
+void thread_finish(thread_t* thread);
+int thread_create(uint32_t eip, uint32_t arg);
+int thread_join(int id, regs_t* regs);
+void thread_exit(int exit_code);
+
+// thread_queue.c
+bool thread_sort_by_sleep_ticks(thread_t* a, thread_t* b);
+bool thread_sort_by_priority(thread_t* a, thread_t* b);
+void thread_queue_push(thread_queue_t* queue, thread_t* thread);
+void thread_queue_sorted_push(thread_queue_t* queue, thread_t* thread, bool (*cmp)(thread_t*, thread_t*));
+thread_t* thread_queue_pop(thread_queue_t* queue);
+bool thread_queue_remove(thread_queue_t* queue, thread_t* thread);
 
 // scheduler.c
-process_t* scheduler_get_current_process();
-process_t* scheduler_get_ready_processes();
-process_t* scheduler_get_sleep_processes();
+thread_t* scheduler_get_current_thread();
+unsigned scheduler_get_cpu_threads(unsigned cpu, thread_info_t* infos, unsigned max);
+unsigned scheduler_get_sleep_threads(thread_info_t* infos, unsigned max);
+void scheduler_add_thread(thread_t* thread);
 void scheduler_add_process(process_t* proc);
-void scheduler_kill_process(regs_t* regs);
+void scheduler_kill_process();
+void scheduler_exit_thread();
 void scheduler_set_sleep(regs_t* regs, unsigned ticks);
 void scheduler_switch(regs_t* regs);
-void scheduler_init(process_t* proc);
+regs_t* scheduler_resume_frame(regs_t* regs);
+bool scheduler_thread_switched();
+void scheduler_finish_switch();
+void scheduler_block(thread_queue_t* queue, ticketlock_t* lock, regs_t* regs);
+void scheduler_wait(thread_queue_t* queue, ticketlock_t* lock);
+bool scheduler_init(process_t* proc);
+bool scheduler_init_cpu();
 
 // scheduler.c
 semaphore_t* semaphore_create(unsigned max_count);
-void semaphore_acquire(semaphore_t* semaphore, regs_t* regs);
+void semaphore_acquire(semaphore_t* semaphore);
 void semaphore_release(semaphore_t* semaphore);
+
+// mutex.c
+void mutex_init(mutex_t* mutex);
+bool mutex_try_lock(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+void mutex_set_owner_running(thread_t* thread, bool running);
+
+// condvar.c
+void condvar_init(condvar_t* cond);
+void condvar_wait(condvar_t* cond, mutex_t* mutex);
+void condvar_signal(condvar_t* cond);
+void condvar_broadcast(condvar_t* cond);
+
+// rwlock.c
+void rwlock_init(rwlock_t* rwlock);
+void rwlock_read_lock(rwlock_t* rwlock);
+void rwlock_read_unlock(rwlock_t* rwlock);
+void rwlock_write_lock(rwlock_t* rwlock);
+void rwlock_write_unlock(rwlock_t* rwlock);
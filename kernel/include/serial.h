@@ -0,0 +1,35 @@
+#pragma once
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "stddef.h"
+
+#define PORT_COM1 0x3f8
+#define SERIAL_COM1_IRQ 4
+
+// offsets from the base port
+#define SERIAL_REG_DATA        0
+#define SERIAL_REG_INT_ENABLE  1
+#define SERIAL_REG_DIVISOR_LO  0 // when DLAB is set
+#define SERIAL_REG_DIVISOR_HI  1 // when DLAB is set
+#define SERIAL_REG_INT_ID      2 // when read
+#define SERIAL_REG_FIFO_CTRL   2 // when written
+#define SERIAL_REG_LINE_CTRL   3
+#define SERIAL_REG_MODEM_CTRL  4
+#define SERIAL_REG_LINE_STATUS 5
+
+#define SERIAL_LINE_DLAB 0x80
+#define SERIAL_LINE_8N1  0x03
+#define SERIAL_STATUS_TX_EMPTY 0x20
+#define SERIAL_INT_TX_EMPTY    0x02
+
+// the transmit FIFO of a 16550
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_TX_BUFFER_SIZE 4096
+
+#define SERIAL_BAUD 115200
+
+bool serial_init();
+void serial_init_irq();
+void serial_write(const char* data, size_t len);
+void serial_flush();
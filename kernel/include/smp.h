@@ -0,0 +1,25 @@
+#pragma once
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define MAX_CPU 8
+
+// APs start executing the trampoline at this physical address
+// it must be page aligned and lie under 1MiB
+#define AP_TRAMPOLINE_ADDR 0x8000
+#define AP_STACK_SIZE (16 * 1024)
+
+typedef struct {
+    uint8_t lapic_id;
+    volatile bool online;
+    uint32_t stack_addr;
+} cpu_t;
+
+// smp.c
+void smp_register_cpu(uint8_t lapic_id);
+unsigned smp_get_cpu_count();
+unsigned smp_get_online_count();
+cpu_t* smp_get_cpu(unsigned id);
+unsigned smp_get_cpu_id();
+bool smp_init();
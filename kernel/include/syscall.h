@@ -5,6 +5,12 @@ enum {
     SYSCALL_TIME,
     SYSCALL_KILL_PROCESS,
     SYSCALL_SLEEP,
+    SYSCALL_THREAD_CREATE,
+    SYSCALL_THREAD_JOIN,
+    SYSCALL_THREAD_EXIT,
+    SYSCALL_FORK,
+    SYSCALL_FRAMEBUFFER_MAP,
+    SYSCALL_FRAMEBUFFER_PRESENT,
     MAX_SYSCALL
 };
 
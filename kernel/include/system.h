@@ -1,10 +1,15 @@
 #pragma once
 
 #include "stdint.h"
+#include "stddef.h"
 #include "stdbool.h"
 #include "stdatomic.h"
 
-#define GDT_MAX_DESCRIPTORS 6
+#include "smp.h"
+
+// null, kernel code/data, user code/data and one TSS for each cpu
+#define GDT_TSS_GATE 5
+#define GDT_MAX_DESCRIPTORS (GDT_TSS_GATE + MAX_CPU)
 #define IDT_MAX_DESCRIPTORS 256
 
 typedef struct {
@@ -76,6 +81,41 @@ typedef struct stackframe {
   uint32_t eip;
 } stackframe_t;
 
+// contention statistics of a lock, only collected when built with LOCK_STATS=1
+// every field is written by the lock holder so they need no extra locking
+typedef struct lock_stats {
+    const char* name;
+    uint64_t acquisitions;
+    uint64_t contended; // acquisitions that had to wait
+    uint64_t spins;
+    uint64_t max_hold_time; // in TSC cycles
+    uint64_t acquire_time;
+    struct lock_stats* next;
+} lock_stats_t;
+
+// fair spinlock, cpus get the lock in the order they asked for it
+typedef struct {
+    atomic_uint next_ticket;
+    atomic_uint now_serving;
+    lock_stats_t* stats;
+} ticketlock_t;
+
+#define TICKETLOCK_INIT {0, 0, NULL}
+
+// MCS queue lock, each waiter spins on its own node instead of the shared lock
+// the node must stay alive until the lock is released, a local variable is fine
+typedef struct mcs_node {
+    struct mcs_node* _Atomic next;
+    atomic_bool locked;
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t* _Atomic tail;
+    lock_stats_t* stats;
+} mcslock_t;
+
+#define MCSLOCK_INIT {NULL, NULL}
+
 // port_io.c
 uint8_t port_inb(uint16_t port);
 void port_outb(uint16_t port, uint8_t data);
@@ -92,15 +132,17 @@ void kernel_panic(stackframe_t* stk);
 
 // tss.c
 void tss_set_stack(uint32_t esp);
-void tss_install(int gate, uint16_t kernel_ss, uint32_t kernel_esp);
-void tss_flush();
+void tss_install(int gate, unsigned cpu, uint16_t kernel_ss, uint32_t kernel_esp);
+void tss_flush(unsigned cpu);
 
 // gdt.c
 void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
 void gdt_init();
+void gdt_load(unsigned cpu);
 
 // idt.c
 void idt_init();
+void idt_load();
 void idt_set_descriptor(uint8_t vector, void (*isr)(regs_t*), uint8_t flags);
 
 // isr.c
@@ -108,7 +150,30 @@ void irq_install_handler(int irq, void (*handler)(regs_t*));
 void irq_uninstall_handler(int irq);
 void isr_new_interrupt(int isr, void (*handler)(regs_t*), uint8_t flags);
 void isr_init();
+uint32_t irq_save();
+void irq_restore(uint32_t eflags);
+
+// isr.asm
+void isr_call_with_frame(regs_t* (*fn)(regs_t*, void*), void* arg);
 
 // spinlock.c
 void spinlock_acquire(volatile atomic_flag* lock);
 void spinlock_release(volatile atomic_flag* lock);
+void ticketlock_acquire(ticketlock_t* lock);
+void ticketlock_release(ticketlock_t* lock);
+uint32_t ticketlock_acquire_irqsave(ticketlock_t* lock);
+void ticketlock_release_irqrestore(ticketlock_t* lock, uint32_t eflags);
+void mcslock_acquire(mcslock_t* lock, mcs_node_t* node);
+void mcslock_release(mcslock_t* lock, mcs_node_t* node);
+uint32_t mcslock_acquire_irqsave(mcslock_t* lock, mcs_node_t* node);
+void mcslock_release_irqrestore(mcslock_t* lock, mcs_node_t* node, uint32_t eflags);
+void lock_stats_register(lock_stats_t* stats, const char* name);
+lock_stats_t* lock_stats_get_list();
+
+// simd.c
+void simd_init();
+bool simd_available();
+uint32_t simd_begin();
+void simd_end(uint32_t eflags);
+void simd_fill32(void* dst, uint32_t pattern, size_t size);
+void simd_copy(void* dst, const void* src, size_t size);
@@ -2,11 +2,19 @@
 
 #include "stdint.h"
 #include "stdbool.h"
+#include "stddef.h"
+
+#include "sys/framebuffer.h"
 
 #define PORT_SCREEN_CTRL 0x3d4
 #define PORT_SCREEN_DATA 0x3d5
 
 #define VIDEO_TEXTMODE_ADDRESS 0xb8000
+// the text memory holds a few screens, used for scrolling
+#define VIDEO_TEXTMODE_SIZE 0x8000
+
+// how often the back buffer is copied to the screen, in ticks
+#define VIDEO_FLUSH_INTERVAL (TIMER_FREQUENCY / 60)
 
 #define VIDEO_VGA_BLACK         0x0
 #define VIDEO_VGA_BLUE          0x1
@@ -42,6 +50,35 @@
 #define VIDEO_LIGHT_YELLOW  255, 255, 85
 #define VIDEO_WHITE         255, 255, 255
 
+// where each colour is inside a pixel, from the multiboot framebuffer info
+typedef struct {
+    uint8_t red_position;
+    uint8_t red_size;
+    uint8_t green_position;
+    uint8_t green_size;
+    uint8_t blue_position;
+    uint8_t blue_size;
+} video_pixel_format_t;
+
+// one primitive for video_vesa_draw_batch
+typedef enum {
+    VIDEO_DRAW_LINE,        // from (x0, y0) to (x1, y1)
+    VIDEO_DRAW_RECTANGLE,   // corners (x0, y0) and (x1, y1), color is the border, fill < 0 for none
+    VIDEO_DRAW_CIRCLE,      // center (x0, y0), radius r
+    VIDEO_FILL_CIRCLE,      // center (x0, y0), radius r
+    VIDEO_FILL_TRIANGLE,    // corners (x0, y0), (x1, y1) and (x2, y2)
+} VIDEO_DRAW_TYPE;
+
+typedef struct {
+    VIDEO_DRAW_TYPE type;
+    int x0, y0;
+    int x1, y1;
+    int x2, y2;
+    int r;
+    int color;
+    int fill;
+} video_draw_cmd_t;
+
 // vga.c
 void video_vga_set_attr(int fg, int bg);
 void video_vga_get_size(int* w, int* h);
@@ -53,11 +90,18 @@ int video_vga_get_cursor();
 void video_vga_set_cursor(int offset);
 void video_vga_cls(int bg);
 void video_vga_print_char(char chr, int offset, int fg, int bg, bool move);
+void video_vga_print_string(const char* str, size_t len);
+void video_vga_flush();
 
 // vesa.c
 void video_vesa_set_attr(int fg, int bg);
 void video_vesa_get_size(int* w, int* h);
 void video_vesa_set_size(int pitch, int bpp, int w, int h);
+void video_vesa_set_backbuffer(void* buffer);
+void video_vesa_set_pixel_format(const video_pixel_format_t* format);
+void video_vesa_flush();
+void video_vesa_get_framebuffer_info(framebuffer_info_t* info);
+void video_vesa_present(const uint8_t* buffer, int x0, int y0, int x1, int y1);
 void video_vesa_set_font_size(int cw, int ch, int bpg);
 void video_vesa_get_font_size(int* w, int* h);
 bool video_vesa_set_font(char* font_data);
@@ -66,12 +110,17 @@ void video_vesa_plot_pixel(unsigned x, unsigned y, int color);
 int video_vesa_get_pixel(unsigned x, unsigned y);
 void video_vesa_fill_rectangle(int x0, int y0, int x1, int y1, int color);
 void video_vesa_draw_line(int x0, int y0, int x1, int y1, int color);
+void video_vesa_draw_rectangle(int x0, int y0, int x1, int y1, int border, int fill);
 void video_vesa_draw_circle(int x0, int y0, int r, int color);
+void video_vesa_fill_circle(int x0, int y0, int r, int color);
+void video_vesa_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int color);
+void video_vesa_draw_batch(const video_draw_cmd_t* cmds, unsigned count);
 int video_vesa_rgb(int r, int g, int b);
 int video_vesa_get_cursor();
 void video_vesa_set_cursor(int offset);
 void video_vesa_cls(int bg);
 void video_vesa_print_char(char chr, int offset, int fg, int bg, bool move);
+void video_vesa_print_string(const char* str, size_t len);
 
 // function pointers that are set to either text mode or linear graphics version of it
 // since they are pointers we need to use the keyword extern
@@ -82,6 +131,8 @@ extern int (*video_get_cursor)();
 extern void (*video_set_cursor)(int offset);
 extern void (*video_cls)(int bg);
 extern void (*video_print_char)(char chr, int offset, int fg, int bg, bool move);
+extern void (*video_print_string)(const char* str, size_t len);
+extern void (*video_flush)();
 
 // video_init.c
 void video_preinit_set_attr(int fg, int bg);
@@ -91,6 +142,7 @@ int  video_preinit_get_cursor();
 void video_preinit_set_cursor(int offset);
 void video_preinit_cls(int color);
 void video_preinit_print_char(char chr, int offset, int fg, int bg, bool move);
+void video_preinit_flush();
 void video_vga_init(uint8_t cols, uint8_t rows);
-void video_vesa_init(uint32_t width, uint32_t height, uint32_t pitch, uint8_t bpp);
+void video_vesa_init(uint32_t width, uint32_t height, uint32_t pitch, uint8_t bpp, const video_pixel_format_t* format, void* backbuffer);
 bool video_using_framebuffer();
@@ -0,0 +1,42 @@
+#include "console.h"
+#include "video.h"
+
+// sinks are only added while booting so the list needs no lock
+typedef struct {
+    void (*write)(const char* data, size_t len);
+    // push out what is still buffered, called with interrupts off
+    void (*flush)();
+} console_sink_t;
+
+static console_sink_t sinks[CONSOLE_MAX_SINKS];
+static unsigned sink_count = 0;
+
+// return true if there are too many sinks
+bool console_add_sink(void (*write)(const char* data, size_t len), void (*flush)()) {
+    if(sink_count == CONSOLE_MAX_SINKS) return true;
+
+    sinks[sink_count].write = write;
+    sinks[sink_count].flush = flush;
+    sink_count++;
+
+    return false;
+}
+
+// print at the cursor of the screen and copy it to every sink
+void console_write(const char* data, size_t len) {
+    video_print_string(data, len);
+    console_write_sinks(data, len);
+}
+
+// only the sinks, for things that are shown differently on the screen
+void console_write_sinks(const char* data, size_t len) {
+    for(unsigned i = 0; i < sink_count; i++)
+        sinks[i].write(data, len);
+}
+
+// get everything out before the system stops, see kernel_panic
+void console_flush() {
+    video_flush();
+    for(unsigned i = 0; i < sink_count; i++)
+        if(sinks[i].flush) sinks[i].flush();
+}
@@ -1,40 +1,218 @@
 #include "debug.h"
 #include "video.h"
+#include "timer.h"
+#include "console.h"
+#include "system.h"
+#include "process.h"
+#include "syscall.h"
+
 #include "stdio.h"
+#include "string.h"
+#include "stdatomic.h"
+
+// how often the log thread moves new records to the console
+#define KLOG_INTERVAL_TICKS 10
+// how many records are copied out of the ring at once before printing them
+#define KLOG_DRAIN_BATCH 8
+
+// print_debug only fills in a record, the log thread prints it later
+// so it is cheap and can be used from interrupt handlers
+// producers take a position with one atomic add and do not lock anything
+// the last KLOG_RECORD_COUNT records stay around for dmesg
+typedef struct {
+    // position + 1 once the record is complete, 0 while it is being written
+    atomic_uint seq;
+    unsigned ticks;
+    int log_tag;
+    char text[KLOG_TEXT_SIZE];
+} klog_record_t;
+
+static klog_record_t records[KLOG_RECORD_COUNT];
+// position of the next record
+static atomic_uint klog_head = 0;
+
+// the first record not printed to the console yet
+static unsigned console_tail = 0;
+static ticketlock_t console_tail_lock = TICKETLOCK_INIT;
+
+static bool klog_thread_running = false;
+
+static const char* tag_names[] = {"IF", "OK", "WN", "ER", "CR"};
 
+// the screen gets the coloured tag and the text, the log is not copied to the console sinks from here
 static void print_log_tag(int lt) {
-    putchar('[');
+    video_print_string("[", 1);
     switch(lt) {
         case LT_IF:
             video_set_attr(video_rgb(VIDEO_WHITE), video_rgb(VIDEO_BLACK));
-            printf("IF");
             break;
         case LT_OK:
             video_set_attr(video_rgb(VIDEO_LIGHT_GREEN), video_rgb(VIDEO_BLACK));
-            printf("OK");
             break;
         case LT_WN:
             video_set_attr(video_rgb(VIDEO_LIGHT_YELLOW), video_rgb(VIDEO_BLACK));
-            printf("WN");
             break;
         case LT_ER:
             video_set_attr(video_rgb(VIDEO_LIGHT_RED), video_rgb(VIDEO_BLACK));
-            printf("ER");
             break;
         case LT_CR:
             video_set_attr(video_rgb(VIDEO_RED), video_rgb(VIDEO_BLACK));
-            printf("CR");
             break;
     }
+    video_print_string(tag_names[lt], 2);
     video_set_attr(video_rgb(VIDEO_LIGHT_GREY), video_rgb(VIDEO_BLACK));
-    printf("] ");
+    video_print_string("] ", 2);
+}
+
+// copy the record at pos
+// return true if it is not there, it is either still being written or already overwritten
+static bool read_record(unsigned pos, klog_record_t* out) {
+    klog_record_t* record = &records[pos % KLOG_RECORD_COUNT];
+    unsigned seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+    if(seq != pos + 1) return true;
+
+    out->ticks = record->ticks;
+    out->log_tag = record->log_tag;
+    memcpy(out->text, record->text, KLOG_TEXT_SIZE);
+
+    // a producer that lapped us may have changed it while we were copying
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&record->seq, memory_order_relaxed) != seq;
+}
+
+// the line that goes to dmesg and the serial port
+static int format_record(char* buffer, size_t size, const klog_record_t* record) {
+    return snprintf(buffer, size, "[%8u] [%s] %s", record->ticks, tag_names[record->log_tag], record->text);
+}
+
+static void print_record(const klog_record_t* record) {
+    print_log_tag(record->log_tag);
+    video_print_string(record->text, strlen(record->text));
+
+    // the sinks get the tick too
+    char line[KLOG_TEXT_SIZE + 32];
+    int len = format_record(line, sizeof(line), record);
+    console_write_sinks(line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+// copy up to KLOG_DRAIN_BATCH records that the console has not seen into batch, console_tail_lock must be held
+// lost is set to the number of records overwritten before we got to them
+// return how many records were copied
+static unsigned take_records(klog_record_t* batch, unsigned* lost) {
+    unsigned count = 0;
+    *lost = 0;
+
+    unsigned head = atomic_load(&klog_head);
+    while(console_tail != head && count < KLOG_DRAIN_BATCH) {
+        // the producers went around the ring and overwrote the oldest ones
+        if(head - console_tail > KLOG_RECORD_COUNT) {
+            *lost += head - console_tail - KLOG_RECORD_COUNT;
+            console_tail = head - KLOG_RECORD_COUNT;
+        }
+
+        if(read_record(console_tail, &batch[count])) {
+            // overwritten right now, the check above skips it next time
+            if(atomic_load(&klog_head) - console_tail > KLOG_RECORD_COUNT) {
+                head = atomic_load(&klog_head);
+                continue;
+            }
+            // still being written, print it next time
+            break;
+        }
+
+        count++;
+        console_tail++;
+    }
+
+    return count;
+}
+
+static void print_records(const klog_record_t* batch, unsigned count, unsigned lost) {
+    if(lost) printf("%u log records dropped\n", lost);
+    for(unsigned i = 0; i < count; i++)
+        print_record(&batch[i]);
+}
+
+// print everything that is still waiting
+// the records are copied out under the lock and printed after releasing it
+// so print_debug callers on other cpus never wait for the screen or the serial port
+void klog_flush() {
+    klog_record_t batch[KLOG_DRAIN_BATCH];
+    unsigned count, lost;
+
+    do {
+        uint32_t eflags = ticketlock_acquire_irqsave(&console_tail_lock);
+        count = take_records(batch, &lost);
+        ticketlock_release_irqrestore(&console_tail_lock, eflags);
+
+        print_records(batch, count, lost);
+    } while(count == KLOG_DRAIN_BATCH);
+}
+
+// for kernel_panic, the lock may be held by the code that panicked so do not wait for it
+void klog_panic_flush() {
+    klog_record_t batch[KLOG_DRAIN_BATCH];
+    unsigned count, lost;
+
+    do {
+        count = take_records(batch, &lost);
+        print_records(batch, count, lost);
+    } while(count == KLOG_DRAIN_BATCH);
+}
+
+static void klog_thread() {
+    int ret;
+    while(true) {
+        klog_flush();
+        SYSCALL_1P(SYSCALL_SLEEP, ret, KLOG_INTERVAL_TICKS);
+    }
+}
+
+// start the thread that prints the log, until then print_debug prints right away
+// return true if there is not enough memory
+bool klog_init_thread(struct process* kernel_proc) {
+    thread_t* thread = thread_new(kernel_proc, (uint32_t)klog_thread, 0);
+    if(!thread) return true;
+
+    scheduler_add_thread(thread);
+    klog_thread_running = true;
+
+    return false;
+}
+
+// print the records still in the ring, oldest first
+void klog_dump() {
+    unsigned head = atomic_load(&klog_head);
+    unsigned pos = head > KLOG_RECORD_COUNT ? head - KLOG_RECORD_COUNT : 0;
+
+    for(; pos != head; pos++) {
+        klog_record_t record;
+        if(read_record(pos, &record)) continue;
+
+        char line[KLOG_TEXT_SIZE + 32];
+        format_record(line, sizeof(line), &record);
+        printf("%s", line);
+    }
 }
 
 void print_debug(int log_tag, const char* restrict format, ...) {
-    print_log_tag(log_tag);
+    unsigned pos = atomic_fetch_add(&klog_head, 1);
+    klog_record_t* record = &records[pos % KLOG_RECORD_COUNT];
+
+    atomic_store_explicit(&record->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    record->ticks = timer_get_current_ticks();
+    record->log_tag = log_tag;
 
     va_list arg;
     va_start(arg, format);
-    printf(format, va_arg(arg, int));
+    int len = vsnprintf(record->text, KLOG_TEXT_SIZE, format, arg);
     va_end(arg);
+    // keep the line break of a cut message
+    if(len >= KLOG_TEXT_SIZE) record->text[KLOG_TEXT_SIZE - 2] = '\n';
+
+    atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+
+    if(!klog_thread_running) klog_flush();
 }
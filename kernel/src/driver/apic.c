@@ -0,0 +1,168 @@
+#include "apic.h"
+#include "pic.h"
+#include "pit.h"
+#include "system.h"
+#include "mem.h"
+
+#define MMIO_FLAGS (PTE_WRITABLE | PTE_NOT_CACHEABLE | PTE_WRITETHOUGH)
+
+static bool enabled = false;
+
+// default address, may be changed by the MADT
+static uint32_t lapic_phys = 0xfee00000;
+static uint8_t* lapic = (uint8_t*)LAPIC_START;
+
+static uint32_t ioapic_phys = 0;
+static uint32_t ioapic_gsi_base = 0;
+static volatile uint32_t* ioapic = (uint32_t*)IOAPIC_START;
+
+// ISA IRQ to global system interrupt mapping
+// identity unless the firmware says otherwise (IRQ0 is usually wired to GSI 2)
+static uint32_t isa_gsi[IOAPIC_ISA_IRQS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+static uint16_t isa_flags[IOAPIC_ISA_IRQS];
+
+// how many LAPIC timer ticks (divided by 16) happen in 10ms
+static uint32_t lapic_ticks_per_10ms = 0;
+
+static uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(lapic + reg);
+}
+static void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(lapic + reg) = value;
+}
+
+static uint32_t ioapic_read(uint8_t reg) {
+    ioapic[IOAPIC_REG_SELECT / 4] = reg;
+    return ioapic[IOAPIC_REG_WINDOW / 4];
+}
+static void ioapic_write(uint8_t reg, uint32_t value) {
+    ioapic[IOAPIC_REG_SELECT / 4] = reg;
+    ioapic[IOAPIC_REG_WINDOW / 4] = value;
+}
+
+bool apic_available() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    return edx & (1 << 9);
+}
+
+bool apic_enabled() {
+    return enabled;
+}
+
+void lapic_set_base(uint32_t phys) {
+    lapic_phys = phys;
+}
+
+// must be run on every cpu
+void lapic_init() {
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    // clear errors left by the firmware
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_send_eoi();
+}
+
+uint8_t lapic_get_id() {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_send_eoi() {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+void lapic_send_ipi(uint8_t lapic_id, uint32_t flags) {
+    // ICR is written in 2 parts so an IPI sent from an interrupt handler must not get in between
+    uint32_t eflags = irq_save();
+
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)lapic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, flags);
+    while(lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING)
+        __builtin_ia32_pause();
+
+    irq_restore(eflags);
+}
+
+// measure the LAPIC timer against the PIT
+// all cpus are assumed to share the same bus frequency so this is only done once
+void lapic_timer_calibrate() {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0xffffffff);
+
+    pit_sleep_polling(10000);
+
+    lapic_ticks_per_10ms = 0xffffffff - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+}
+
+void lapic_timer_start(unsigned hz) {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, lapic_ticks_per_10ms * 100 / hz);
+}
+
+void ioapic_set_base(uint32_t phys, uint32_t gsi_base) {
+    // only the first IO APIC is used, it holds all ISA IRQs on PCs
+    if(ioapic_phys) return;
+
+    ioapic_phys = phys;
+    ioapic_gsi_base = gsi_base;
+}
+
+void ioapic_add_override(uint8_t irq, uint32_t gsi, uint16_t flags) {
+    if(irq >= IOAPIC_ISA_IRQS) return;
+
+    isa_gsi[irq] = gsi;
+    isa_flags[irq] = flags;
+}
+
+void ioapic_set_irq(uint8_t irq, uint8_t vector, uint8_t lapic_id, bool masked) {
+    if(irq >= IOAPIC_ISA_IRQS) return;
+
+    uint32_t pin = isa_gsi[irq] - ioapic_gsi_base;
+    uint32_t max_pin = (ioapic_read(IOAPIC_VERSION) >> 16) & 0xff;
+    if(pin > max_pin) return;
+
+    uint32_t low = vector;
+    if((isa_flags[irq] & APIC_POLARITY_MASK) == APIC_POLARITY_LOW) low |= IOAPIC_ACTIVE_LOW;
+    if((isa_flags[irq] & APIC_TRIGGER_MASK) == APIC_TRIGGER_LEVEL) low |= IOAPIC_LEVEL_TRIGGER;
+    if(masked) low |= IOAPIC_MASKED;
+
+    ioapic_write(IOAPIC_REDIRECTION_TABLE(pin) + 1, (uint32_t)lapic_id << 24);
+    ioapic_write(IOAPIC_REDIRECTION_TABLE(pin), low);
+}
+
+// switch from the 8259 PIC to the APICs
+// the base addresses must have been set by acpi_init() beforehand
+bool apic_init() {
+    if(!apic_available() || !ioapic_phys) return true;
+
+    vmmngr_map(NULL, lapic_phys, LAPIC_START, MMIO_FLAGS);
+    vmmngr_map(NULL, ioapic_phys & ~0xfff, IOAPIC_START, MMIO_FLAGS);
+    ioapic = (uint32_t*)(IOAPIC_START + (ioapic_phys & 0xfff));
+
+    // the PIC is still remapped to 32-47 so its spurious IRQs will not look like exceptions
+    pic_disable();
+
+    lapic_init();
+
+    // route ISA IRQs to the same vectors as before, delivered to the BSP
+    uint8_t bsp = lapic_get_id();
+    for(uint8_t irq = 0; irq < IOAPIC_ISA_IRQS; irq++) {
+        // IRQ2 is the PIC cascade and is never raised
+        if(irq == 2) continue;
+        ioapic_set_irq(irq, 32 + irq, bsp, false);
+    }
+
+    lapic_timer_calibrate();
+
+    enabled = true;
+    return false;
+}
@@ -1,5 +1,9 @@
 #include "ata.h"
 #include "system.h"
+#include "process.h"
+
+// there is only one drive, commands from different processes must not interleave
+static mutex_t drive_lock = MUTEX_INIT;
 
 static bool LBA28_mode;
 static bool LBA48_mode;
@@ -100,9 +104,7 @@ char* ata_pio_get_error() {
     return error_msg[i];
 }
 
-ATA_PIO_ERR ata_pio_LBA28_access(bool read_op, uint32_t lba, unsigned int sector_cnt, uint8_t* buff) {
-    if(!LBA28_mode) return ERR_ATA_PIO_METHOD_NOT_AVAILABLE;
-    if(sector_cnt == 0) return ERR_ATA_PIO_INVALID_PARAMS;
+static ATA_PIO_ERR LBA28_access(bool read_op, uint32_t lba, unsigned int sector_cnt, uint8_t* buff) {
     const int slavebit = 0; // idk what is this
 
     port_outb(PORT_ATA_PIO_DEV_CTRL, 0x2);
@@ -149,6 +151,17 @@ ATA_PIO_ERR ata_pio_LBA28_access(bool read_op, uint32_t lba, unsigned int sector
     return ERR_ATA_PIO_SUCCESS;
 }
 
+ATA_PIO_ERR ata_pio_LBA28_access(bool read_op, uint32_t lba, unsigned int sector_cnt, uint8_t* buff) {
+    if(!LBA28_mode) return ERR_ATA_PIO_METHOD_NOT_AVAILABLE;
+    if(sector_cnt == 0) return ERR_ATA_PIO_INVALID_PARAMS;
+
+    mutex_lock(&drive_lock);
+    ATA_PIO_ERR err = LBA28_access(read_op, lba, sector_cnt, buff);
+    mutex_unlock(&drive_lock);
+
+    return err;
+}
+
 // TODO: implement LBA48 access (do i even need it lol)
 
 ATA_PIO_ERR ata_pio_init(uint16_t* buff) {
@@ -34,6 +34,26 @@ void pit_set_count(unsigned count) {
 	return;
 }
 
+// busy wait using channel 2, works without interrupts
+// us must be lower than 55000 since the counter is 16 bit
+void pit_sleep_polling(unsigned us) {
+    uint16_t count = us * 1193 / 1000;
+
+    // enable the channel 2 gate but keep the speaker disconnected
+    uint8_t speaker = port_inb(PORT_PC_SPEAKER);
+    port_outb(PORT_PC_SPEAKER, (speaker & 0xfd) | 1);
+
+    // mode 0: output goes high when the count reaches 0
+    port_outb(PORT_PIT_COM, 0xb0);
+    port_outb(PORT_PIT_CH2, count & 0xff);
+    port_outb(PORT_PIT_CH2, count >> 8);
+
+    while(!(port_inb(PORT_PC_SPEAKER) & 0x20))
+        __builtin_ia32_pause();
+
+    port_outb(PORT_PC_SPEAKER, speaker);
+}
+
 void pit_beep_start() {
     uint8_t tmp = port_inb(PORT_PC_SPEAKER);
     port_outb(PORT_PC_SPEAKER, tmp | 3);
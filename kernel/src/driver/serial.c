@@ -0,0 +1,131 @@
+#include "serial.h"
+#include "system.h"
+
+#include "stdio.h"
+
+// bytes waiting for the transmitter, sent SERIAL_FIFO_SIZE at a time when it is empty
+// the positions only grow, the index into the buffer is the position modulo its size
+static char tx_buffer[SERIAL_TX_BUFFER_SIZE];
+static unsigned tx_head = 0;
+static unsigned tx_tail = 0;
+// bytes thrown away because the buffer was full
+static unsigned tx_dropped = 0;
+
+static bool serial_present = false;
+static bool irq_enabled = false;
+// the transmitter empty interrupt is only on while there is something to send
+static bool tx_irq_on = false;
+static ticketlock_t serial_lock = TICKETLOCK_INIT;
+
+// move bytes into the FIFO if it is empty, serial_lock must be held
+static void fill_fifo() {
+    if(port_inb(PORT_COM1 + SERIAL_REG_LINE_STATUS) & SERIAL_STATUS_TX_EMPTY) {
+        for(unsigned i = 0; i < SERIAL_FIFO_SIZE && tx_tail != tx_head; i++)
+            port_outb(PORT_COM1 + SERIAL_REG_DATA, tx_buffer[tx_tail++ % SERIAL_TX_BUFFER_SIZE]);
+    }
+
+    // keep the interrupt armed while anything is left, even if the FIFO was busy this time
+    // otherwise nothing would send the rest until the next write
+    // every port access is slow so only touch the register when it changes
+    bool pending = tx_tail != tx_head;
+    if(irq_enabled && pending != tx_irq_on) {
+        tx_irq_on = pending;
+        port_outb(PORT_COM1 + SERIAL_REG_INT_ENABLE, pending ? SERIAL_INT_TX_EMPTY : 0);
+    }
+}
+
+// return true if the buffer is full and c was dropped
+static bool push(char c) {
+    // never wait for the port here, a writer would spin with interrupts off for as long as the line is busy
+    if(tx_head - tx_tail == SERIAL_TX_BUFFER_SIZE) {
+        tx_dropped++;
+        return true;
+    }
+
+    tx_buffer[tx_head++ % SERIAL_TX_BUFFER_SIZE] = c;
+    return false;
+}
+
+// tell how much was lost once there is room again, serial_lock must be held
+static void report_dropped() {
+    char note[48];
+    int len = snprintf(note, sizeof(note), "\r\n[%u bytes dropped]\r\n", tx_dropped);
+    if(SERIAL_TX_BUFFER_SIZE - (tx_head - tx_tail) < (unsigned)len) return;
+
+    tx_dropped = 0;
+    for(int i = 0; i < len; i++)
+        push(note[i]);
+}
+
+static void serial_handler(regs_t* r) {
+    (void)(r);
+    // reading the interrupt identification acknowledges it
+    port_inb(PORT_COM1 + SERIAL_REG_INT_ID);
+
+    ticketlock_acquire(&serial_lock);
+    fill_fifo();
+    ticketlock_release(&serial_lock);
+}
+
+// set up COM1 as 115200 8N1 with the FIFO on
+// return true if there is no working port
+bool serial_init() {
+    port_outb(PORT_COM1 + SERIAL_REG_INT_ENABLE, 0);
+
+    uint16_t divisor = 115200 / SERIAL_BAUD;
+    port_outb(PORT_COM1 + SERIAL_REG_LINE_CTRL, SERIAL_LINE_DLAB);
+    port_outb(PORT_COM1 + SERIAL_REG_DIVISOR_LO, divisor & 0xff);
+    port_outb(PORT_COM1 + SERIAL_REG_DIVISOR_HI, divisor >> 8);
+    port_outb(PORT_COM1 + SERIAL_REG_LINE_CTRL, SERIAL_LINE_8N1);
+    // enable and clear the FIFOs, 14 byte threshold
+    port_outb(PORT_COM1 + SERIAL_REG_FIFO_CTRL, 0xc7);
+
+    // send a byte to ourself in loopback mode to see if anything is there
+    port_outb(PORT_COM1 + SERIAL_REG_MODEM_CTRL, 0x1e);
+    port_outb(PORT_COM1 + SERIAL_REG_DATA, 0xae);
+    if(port_inb(PORT_COM1 + SERIAL_REG_DATA) != 0xae) return true;
+
+    // normal mode, DTR, RTS and OUT2 which lets the interrupt through
+    port_outb(PORT_COM1 + SERIAL_REG_MODEM_CTRL, 0x0b);
+    serial_present = true;
+
+    return false;
+}
+
+// until this is called the buffer is only sent when more is written
+void serial_init_irq() {
+    if(!serial_present) return;
+
+    irq_install_handler(SERIAL_COM1_IRQ, serial_handler);
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&serial_lock);
+    irq_enabled = true;
+    fill_fifo();
+    ticketlock_release_irqrestore(&serial_lock, eflags);
+}
+
+// queue the data and return, newlines are sent as CRLF
+// whatever does not fit in the buffer is dropped
+void serial_write(const char* data, size_t len) {
+    if(!serial_present) return;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&serial_lock);
+    if(tx_dropped) report_dropped();
+    for(size_t i = 0; i < len; i++) {
+        if(data[i] == '\n') push('\r');
+        push(data[i]);
+    }
+    fill_fifo();
+    ticketlock_release_irqrestore(&serial_lock, eflags);
+}
+
+// send everything by polling, for kernel_panic
+// the lock is not taken since the code that panicked may hold it
+void serial_flush() {
+    if(!serial_present) return;
+
+    while(tx_tail != tx_head) {
+        __builtin_ia32_pause();
+        fill_fifo();
+    }
+}
@@ -3,6 +3,7 @@
 #include "pit.h"
 #include "rtc.h"
 #include "process.h"
+#include "video.h"
 
 static unsigned ticks = 0;
 static time_t start_timestamp;
@@ -16,6 +17,9 @@ static void tick_handler(regs_t* r) {
         ticks = 0;
     }
 
+    // only this cpu gets the PIT interrupt so the screen is never flushed twice at once
+    if(ticks % VIDEO_FLUSH_INTERVAL == 0) video_flush();
+
     scheduler_switch(r);
 }
 
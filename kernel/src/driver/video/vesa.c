@@ -1,9 +1,26 @@
 #include "video.h"
 #include "misc/psf.h"
 
+#include "system.h"
+#include "mem.h"
 #include "string.h"
 
+// everything is drawn into framebuffer which is the back buffer in RAM if there is one
+// reading VRAM is uncached and very slow, so the screen itself is only written by video_vesa_flush
 static uint8_t* framebuffer = (uint8_t*)VIDEO_START;
+static uint8_t* const screen = (uint8_t*)VIDEO_START;
+static bool using_backbuffer = false;
+
+// the area of the back buffer that is not on the screen yet, in pixels
+// empty if dirty_x0 > dirty_x1
+static int dirty_x0 = 0;
+static int dirty_y0 = 0;
+static int dirty_x1 = -1;
+static int dirty_y1 = -1;
+static ticketlock_t dirty_lock = TICKETLOCK_INIT;
+
+// copies start and end on this boundary so write combining sends whole bursts
+#define FLUSH_ALIGN 64
 
 static int current_fg = 0x969696;
 static int current_bg = 0x000000;
@@ -14,7 +31,20 @@ static int text_cols;
 static uint32_t fb_pitch;
 static uint32_t fb_width;
 static uint32_t fb_height;
-static uint8_t fb_bpp;
+static unsigned fb_bytes_per_pixel;
+
+// where the colours are inside a pixel
+static video_pixel_format_t pixel_format = {16, 8, 8, 8, 0, 8};
+
+// the pixel routines for the format of the framebuffer, chosen once in video_vesa_set_pixel_format
+// so none of them has to look at the format for every pixel
+static void put_pixel_none(unsigned x, unsigned y, int color) {(void)(x); (void)(y); (void)(color);}
+static int get_pixel_none(unsigned x, unsigned y) {(void)(x); (void)(y); return 0;}
+static void fill_row_none(uint8_t* dst, int color, size_t count) {(void)(dst); (void)(color); (void)(count);}
+static void (*put_pixel_format)(unsigned x, unsigned y, int color) = put_pixel_none;
+static int (*get_pixel_format)(unsigned x, unsigned y) = get_pixel_none;
+static void (*fill_row)(uint8_t* dst, int color, size_t count) = fill_row_none;
+static void (*blit_row)(uint8_t* dst, uint32_t mask, int fg, int bg) = NULL;
 
 static int cursor_posx = 0;
 static int cursor_posy = 0;
@@ -23,31 +53,132 @@ static int font_width;
 static int font_height;
 static int font_bpg;
 
-// the pixels behind the cursor
-static int cursor_buffer[512];
-static int cursor_buffer_posx = 0;
-static int cursor_buffer_posy = 0;
+typedef struct {
+    char chr;
+    int fg;
+    int bg;
+} console_cell_t;
+
+// the console text, printing only changes cells and the pixels are drawn on the next flush
+// the rows are a ring so scrolling does not move any cell, screen row r is grid row (grid_top + r) % text_rows
+static console_cell_t* grid = NULL;
+static int grid_cols = 0;
+static int grid_rows = 0;
+static int grid_top = 0;
+// the columns of each screen row that changed since they were drawn, none if from > to
+static int* row_dirty_from = NULL;
+static int* row_dirty_to = NULL;
+// rows the console scrolled since it was drawn, the pixels are moved once for all of them
+static int pending_scroll = 0;
+// where the cursor block is on the screen, -1 if it is not drawn
+static int drawn_cursor_posx = -1;
+static int drawn_cursor_posy = -1;
+// protects the grid and the cursor, taken before dirty_lock
+static ticketlock_t console_lock = TICKETLOCK_INIT;
+
+// the glyphs of the font as one mask per row, bit x is set if pixel x is in the foreground
+// NULL if the font is wider than 32 pixels or there was no memory, then the PSF data is used directly
+#define GLYPH_CACHE_SIZE 256
+static uint32_t* glyph_rows = NULL;
+
+// a group of pixels in the native format for every fg/bg pattern of it
+// 8bpp: 4 pixels in one word, 16bpp: 2 pixels in one word, 24bpp: 4 pixels in three words
+// it only depends on the colours so it is kept until a cell with other colours is drawn
+static uint32_t pattern_table[16 * 3];
+static int pattern_fg = -1;
+static int pattern_bg = -1;
+
+static void mark_dirty(int x0, int y0, int x1, int y1) {
+    if(!using_backbuffer) return;
+
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 >= (int)fb_width) x1 = fb_width - 1;
+    if(y1 >= (int)fb_height) y1 = fb_height - 1;
+    if(x0 > x1 || y0 > y1) return;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&dirty_lock);
+    if(dirty_x0 > dirty_x1) {
+        dirty_x0 = x0;
+        dirty_y0 = y0;
+        dirty_x1 = x1;
+        dirty_y1 = y1;
+    }
+    else {
+        if(x0 < dirty_x0) dirty_x0 = x0;
+        if(y0 < dirty_y0) dirty_y0 = y0;
+        if(x1 > dirty_x1) dirty_x1 = x1;
+        if(y1 > dirty_y1) dirty_y1 = y1;
+    }
+    ticketlock_release_irqrestore(&dirty_lock, eflags);
+}
+
+static console_cell_t* get_cell(int col, int row) {
+    return &grid[((grid_top + row) % text_rows) * grid_cols + col];
+}
+
+static void mark_cells(int row, int from, int to) {
+    if(from < row_dirty_from[row]) row_dirty_from[row] = from;
+    if(to > row_dirty_to[row]) row_dirty_to[row] = to;
+}
+
+static void clear_row(int row, int bg) {
+    for(int x = 0; x < text_cols; x++) {
+        console_cell_t* cell = get_cell(x, row);
+        cell->chr = ' ';
+        cell->fg = current_fg;
+        cell->bg = bg;
+    }
+    mark_cells(row, 0, text_cols - 1);
+}
+
+// empty the console, console_lock must be held
+static void reset_console(int bg) {
+    grid_top = 0;
+    pending_scroll = 0;
+    drawn_cursor_posx = -1;
+    drawn_cursor_posy = -1;
+    cursor_posx = 0;
+    cursor_posy = 0;
+
+    for(int y = 0; y < text_rows; y++) {
+        row_dirty_from[y] = text_cols;
+        row_dirty_to[y] = -1;
+        clear_row(y, bg);
+    }
+}
 
 static void scroll_screen(unsigned ammount) {
     if(cursor_posy == 0) return;
 
     cursor_posy -= ammount;
-    cursor_buffer_posy -= ammount;
     if(cursor_posy < 0) {
         ammount += cursor_posy;
         cursor_posy = 0;
-        cursor_buffer_posy = 0;
     }
 
-    memcpy(
-        framebuffer,
-        framebuffer + ammount * font_height * fb_pitch,
-        cursor_posy * font_height * fb_pitch
-    );
-    memset(
-        framebuffer + cursor_posy * font_height * fb_pitch,
-        0, ammount * font_height * fb_pitch
-    );
+    grid_top = (grid_top + ammount) % text_rows;
+    pending_scroll += ammount;
+    if(pending_scroll > text_rows) pending_scroll = text_rows;
+
+    // the changes move up with their rows
+    for(int y = 0; y < text_rows - (int)ammount; y++) {
+        row_dirty_from[y] = row_dirty_from[y + ammount];
+        row_dirty_to[y] = row_dirty_to[y + ammount];
+    }
+    for(int y = text_rows - ammount; y < text_rows; y++) {
+        row_dirty_from[y] = text_cols;
+        row_dirty_to[y] = -1;
+        clear_row(y, 0);
+    }
+
+    if(drawn_cursor_posy >= 0) {
+        drawn_cursor_posy -= ammount;
+        if(drawn_cursor_posy < 0) {
+            drawn_cursor_posx = -1;
+            drawn_cursor_posy = -1;
+        }
+    }
 }
 
 void video_vesa_set_attr(int fg, int bg) {
@@ -57,22 +188,112 @@ void video_vesa_set_attr(int fg, int bg) {
 
 void video_vesa_set_size(int pitch, int bpp, int w, int h) {
     fb_pitch = pitch;
-    fb_bpp = bpp;
+    fb_bytes_per_pixel = (bpp + 7) / 8;
     fb_width = w;
     fb_height = h;
 }
 
+// draw into buffer instead of the screen, it must hold fb_height * fb_pitch bytes
+// the screen is cleared on the next flush
+void video_vesa_set_backbuffer(void* buffer) {
+    if(!buffer) {
+        framebuffer = screen;
+        using_backbuffer = false;
+        return;
+    }
+
+    framebuffer = buffer;
+    using_backbuffer = true;
+    memset(framebuffer, 0, fb_height * fb_pitch);
+    mark_dirty(0, 0, fb_width - 1, fb_height - 1);
+}
+
 void video_vesa_get_size(int* w, int* h) {
     *w = fb_width;
     *h = fb_height;
 }
 
+// make a new grid for cols * rows cells, the console is emptied
+// if there is not enough memory the old grid stays and only the part of the screen that fits in it is used
+static void resize_console(int cols, int rows) {
+    console_cell_t* new_grid = kmalloc(cols * rows * sizeof(console_cell_t));
+    int* new_dirty = kmalloc(2 * rows * sizeof(int));
+    if(!new_grid || !new_dirty) {
+        if(new_grid) kfree(new_grid);
+        if(new_dirty) kfree(new_dirty);
+        new_grid = NULL;
+    }
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
+
+    console_cell_t* old_grid = grid;
+    int* old_dirty = row_dirty_from;
+    if(new_grid) {
+        grid = new_grid;
+        grid_cols = cols;
+        grid_rows = rows;
+        row_dirty_from = new_dirty;
+        row_dirty_to = new_dirty + rows;
+    }
+    text_cols = cols < grid_cols ? cols : grid_cols;
+    text_rows = rows < grid_rows ? rows : grid_rows;
+    if(grid) reset_console(0);
+
+    ticketlock_release_irqrestore(&console_lock, eflags);
+
+    if(new_grid && old_grid) {
+        kfree(old_grid);
+        kfree(old_dirty);
+    }
+}
+
+// expand the current PSF font into glyph masks, return NULL if they can not be made
+static uint32_t* cache_glyphs(int width, int height, int bpg) {
+    if(width > 32) return NULL;
+
+    uint32_t* rows = kmalloc(GLYPH_CACHE_SIZE * height * sizeof(uint32_t));
+    if(!rows) return NULL;
+    memset(rows, 0, GLYPH_CACHE_SIZE * height * sizeof(uint32_t));
+
+    int glyph_count = psf_get_glyph_count();
+    if(glyph_count > GLYPH_CACHE_SIZE) glyph_count = GLYPH_CACHE_SIZE;
+
+    for(int g = 0; g < glyph_count; g++) {
+        uint8_t* glyph = (uint8_t*)psf_get_glyph(g);
+        uint32_t* mask = rows + g * height;
+
+        int col = 0;
+        int line = 0;
+        for(int i = 0; i < bpg && line < height; i++) {
+            int remain_width = width - col;
+            if(remain_width > 8) remain_width = 8;
+            for(int j = 0; j < remain_width; j++)
+                if((glyph[i] >> (7-j)) & 1) mask[line] |= 1 << (col + j);
+
+            col += remain_width;
+            if(col >= width) {
+                line++;
+                col = 0;
+            }
+        }
+    }
+
+    return rows;
+}
+
 void video_vesa_set_font_size(int cw, int ch, int bpg) {
+    uint32_t* new_glyph_rows = cache_glyphs(cw, ch, bpg);
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
+    uint32_t* old_glyph_rows = glyph_rows;
+    glyph_rows = new_glyph_rows;
     font_width = cw;
     font_height = ch;
-    text_cols = fb_width / cw;
-    text_rows = fb_height / ch;
     font_bpg = bpg;
+    ticketlock_release_irqrestore(&console_lock, eflags);
+
+    if(old_glyph_rows) kfree(old_glyph_rows);
+    resize_console(fb_width / cw, fb_height / ch);
 }
 
 void video_vesa_get_font_size(int* w, int* h) {
@@ -88,9 +309,6 @@ bool video_vesa_set_font(char* font_data) {
     psf_get_font_geometry(&font_width, &font_height, &font_bpg);
     video_vesa_set_font_size(font_width, font_height, font_bpg);
 
-    cursor_posx = 0;
-    cursor_posy = 0;
-
     return false;
 }
 
@@ -99,54 +317,82 @@ void video_vesa_get_rowcol(int* c, int* r) {
     *r = text_rows;
 }
 
-void video_vesa_plot_pixel(unsigned x, unsigned y, int color) {
-    // TODO: support other bpp
+// pixels that are a whole integer type
+#define DEFINE_PIXEL_ROUTINES(bits, type) \
+    static void put_pixel_##bits(unsigned x, unsigned y, int color) { \
+        ((type*)(framebuffer + y * fb_pitch))[x] = color; \
+    } \
+    static int get_pixel_##bits(unsigned x, unsigned y) { \
+        return ((type*)(framebuffer + y * fb_pitch))[x]; \
+    }
 
-    if(x >= fb_width || y >= fb_height) return;
+DEFINE_PIXEL_ROUTINES(8, uint8_t)
+DEFINE_PIXEL_ROUTINES(16, uint16_t)
+DEFINE_PIXEL_ROUTINES(32, uint32_t)
 
-    if(fb_bpp == 8) {
-        uint8_t* pixel = framebuffer + y * fb_pitch + x;
-        *pixel = color;
-    }
-    else if(fb_bpp == 16) {
-        uint16_t* pixel = (uint16_t*)(framebuffer + y * fb_pitch) + x;
-        *pixel = color;
-    }
-    else if(fb_bpp == 32) {
-        uint32_t* pixel = (uint32_t*)(framebuffer + y * fb_pitch) + x;
-        *pixel = color;
-    }
+static void put_pixel_24(unsigned x, unsigned y, int color) {
+    uint8_t* pixel = framebuffer + y * fb_pitch + x * 3;
+    pixel[0] = color;
+    pixel[1] = color >> 8;
+    pixel[2] = color >> 16;
 }
 
-int video_vesa_get_pixel(unsigned x, unsigned y) {
-    // TODO: support other bpp
+static int get_pixel_24(unsigned x, unsigned y) {
+    uint8_t* pixel = framebuffer + y * fb_pitch + x * 3;
+    return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+}
 
-    if(x >= fb_width || y >= fb_height) return 0;
-    
-    int ret;
+// the colour repeated over 32 bits so rows are filled with whole words
+static void fill_row_8(uint8_t* dst, int color, size_t count) {
+    simd_fill32(dst, (color & 0xff) * 0x01010101, count);
+}
 
-    if(fb_bpp == 8) {
-        uint8_t* pixel = framebuffer + y * fb_pitch + x;
-        ret = *pixel;
-    }
-    else if(fb_bpp == 16) {
-        uint16_t* pixel = (uint16_t*)(framebuffer + y * fb_pitch) + x;
-        ret = *pixel;
-    }
-    else if(fb_bpp == 32) {
-        uint32_t* pixel = (uint32_t*)(framebuffer + y * fb_pitch) + x;
-        ret = *pixel;
+static void fill_row_16(uint8_t* dst, int color, size_t count) {
+    simd_fill32(dst, (color & 0xffff) * 0x00010001, count * 2);
+}
+
+static void fill_row_32(uint8_t* dst, int color, size_t count) {
+    simd_fill32(dst, color, count * 4);
+}
+
+// four pixels are three words
+static void fill_row_24(uint8_t* dst, int color, size_t count) {
+    uint32_t c = color & 0xffffff;
+    uint32_t w0 = c | (c << 24);
+    uint32_t w1 = (c >> 8) | (c << 16);
+    uint32_t w2 = (c >> 16) | (c << 8);
+
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        uint32_t* out = (uint32_t*)(dst + i * 3);
+        out[0] = w0;
+        out[1] = w1;
+        out[2] = w2;
     }
-    else {
-        ret = 0;
+    for(; i < count; i++) {
+        dst[i * 3] = c;
+        dst[i * 3 + 1] = c >> 8;
+        dst[i * 3 + 2] = c >> 16;
     }
+}
 
-    return ret;
+// draw a pixel without marking it dirty, the caller marks the whole area it drew
+static void put_pixel(unsigned x, unsigned y, int color) {
+    if(x >= fb_width || y >= fb_height) return;
+    put_pixel_format(x, y, color);
 }
 
-void video_vesa_fill_rectangle(int x0, int y0, int x1, int y1, int color) {
-    // TODO: support other bpp
+void video_vesa_plot_pixel(unsigned x, unsigned y, int color) {
+    put_pixel(x, y, color);
+    mark_dirty(x, y, x, y);
+}
+
+int video_vesa_get_pixel(unsigned x, unsigned y) {
+    if(x >= fb_width || y >= fb_height) return 0;
+    return get_pixel_format(x, y);
+}
 
+void video_vesa_fill_rectangle(int x0, int y0, int x1, int y1, int color) {
     if((unsigned)x0 >= fb_width) x0 = fb_width-1;
     if((unsigned)x1 >= fb_width) x1 = fb_width-1;
     if((unsigned)y0 >= fb_height) y0 = fb_height-1;
@@ -167,19 +413,116 @@ void video_vesa_fill_rectangle(int x0, int y0, int x1, int y1, int color) {
         y0 = _y1;
     }
 
-    int bytes_per_pixel = fb_bpp / 8;
     uint8_t* fb = framebuffer;
-    fb += y0 * fb_pitch + x0 * bytes_per_pixel;
+    fb += y0 * fb_pitch + x0 * fb_bytes_per_pixel;
 
-    for(int y = y0; y <= y1; y++) {
-        for(int x = x0; x <= x1; x++) {
-            if(fb_bpp == 8) *fb = color;
-            else if(fb_bpp == 16) *(uint16_t*)fb = color;
-            else if(fb_bpp == 32) *(uint32_t*)fb = color;
-            fb += bytes_per_pixel;
+    uint32_t eflags = simd_begin();
+    // rows without a gap between them are one span
+    if((dx+1) * fb_bytes_per_pixel == fb_pitch) {
+        fill_row(fb, color, (dx+1) * (dy+1));
+    }
+    else {
+        for(int y = y0; y <= y1; y++) {
+            fill_row(fb, color, dx+1);
+            fb += fb_pitch;
+        }
+    }
+    simd_end(eflags);
+
+    mark_dirty(x0, y0, x1, y1);
+}
+
+// the rasteriser clips every primitive once and then draws without checking each pixel
+// most of it is horizontal spans that are filled with the row routine of the pixel format
+// everything here must run between simd_begin and simd_end because of the row fills
+
+// a clipped horizontal line
+static void draw_span(int x0, int x1, int y, int color) {
+    if(y < 0 || y >= (int)fb_height) return;
+    if(x0 > x1) {
+        int _x1 = x1;
+        x1 = x0;
+        x0 = _x1;
+    }
+    if(x0 < 0) x0 = 0;
+    if(x1 >= (int)fb_width) x1 = fb_width - 1;
+    if(x0 > x1) return;
+
+    fill_row(framebuffer + y * fb_pitch + x0 * fb_bytes_per_pixel, color, x1 - x0 + 1);
+}
+
+// a clipped vertical line
+static void draw_column(int x, int y0, int y1, int color) {
+    if(x < 0 || x >= (int)fb_width) return;
+    if(y0 > y1) {
+        int _y1 = y1;
+        y1 = y0;
+        y0 = _y1;
+    }
+    if(y0 < 0) y0 = 0;
+    if(y1 >= (int)fb_height) y1 = fb_height - 1;
+
+    for(int y = y0; y <= y1; y++) put_pixel_format(x, y, color);
+}
+
+#define OUT_LEFT   1
+#define OUT_RIGHT  2
+#define OUT_TOP    4
+#define OUT_BOTTOM 8
+
+static int outcode(int x, int y) {
+    int code = 0;
+    if(x < 0) code |= OUT_LEFT;
+    else if(x >= (int)fb_width) code |= OUT_RIGHT;
+    if(y < 0) code |= OUT_TOP;
+    else if(y >= (int)fb_height) code |= OUT_BOTTOM;
+    return code;
+}
+
+// Cohen-Sutherland, cut the line to the screen
+// return true if nothing of it is on the screen
+static bool clip_line(int* x0, int* y0, int* x1, int* y1) {
+    int code0 = outcode(*x0, *y0);
+    int code1 = outcode(*x1, *y1);
+
+    while(code0 | code1) {
+        if(code0 & code1) return true;
+
+        int code = code0 ? code0 : code1;
+        // 64 bits so far away points can not overflow
+        int64_t dx = *x1 - *x0;
+        int64_t dy = *y1 - *y0;
+        int x, y;
+        if(code & OUT_TOP) {
+            y = 0;
+            x = *x0 + dx * (y - *y0) / dy;
+        }
+        else if(code & OUT_BOTTOM) {
+            y = fb_height - 1;
+            x = *x0 + dx * (y - *y0) / dy;
+        }
+        else if(code & OUT_LEFT) {
+            x = 0;
+            y = *y0 + dy * (x - *x0) / dx;
+        }
+        else {
+            x = fb_width - 1;
+            y = *y0 + dy * (x - *x0) / dx;
+        }
+
+        if(code == code0) {
+            *x0 = x;
+            *y0 = y;
+            code0 = outcode(x, y);
+        }
+        else {
+            *x1 = x;
+            *y1 = y;
+            code1 = outcode(x, y);
         }
-        fb += fb_pitch - (dx+1) * bytes_per_pixel;
     }
+
+    return false;
 }
 
 static void draw_line_low(int x0, int y0, int x1, int y1, int color) {
@@ -195,7 +538,7 @@ static void draw_line_low(int x0, int y0, int x1, int y1, int color) {
     int y = y0;
 
     for(int x = x0; x <= x1; x++) {
-        video_vesa_plot_pixel(x, y, color);
+        put_pixel_format(x, y, color);
         if(D > 0) {
             y += yi;
             D += 2 * (dy - dx);
@@ -216,7 +559,7 @@ static void draw_line_high(int x0, int y0, int x1, int y1, int color) {
     int x = x0;
 
     for(int y = y0; y <= y1; y++) {
-        video_vesa_plot_pixel(x, y, color);
+        put_pixel_format(x, y, color);
         if(D > 0) {
             x += xi;
             D += 2 * (dx - dy);
@@ -224,7 +567,18 @@ static void draw_line_high(int x0, int y0, int x1, int y1, int color) {
         else D += 2 * dx;
     }
 }
-void video_vesa_draw_line(int x0, int y0, int x1, int y1, int color) {
+static void raster_line(int x0, int y0, int x1, int y1, int color) {
+    if(clip_line(&x0, &y0, &x1, &y1)) return;
+
+    if(y0 == y1) {
+        draw_span(x0, x1, y0, color);
+        return;
+    }
+    if(x0 == x1) {
+        draw_column(x0, y0, y1, color);
+        return;
+    }
+
     int dy = y1 - y0;
     if(y1 < y0) dy = y0 - y1;
 
@@ -241,16 +595,20 @@ void video_vesa_draw_line(int x0, int y0, int x1, int y1, int color) {
     }
 }
 
-void video_vesa_draw_circle(int x0, int y0, int r, int color) {
-    int x = r;
-    int y = 0;
+static void raster_circle(int x0, int y0, int r, int color) {
+    if(r < 0) return;
 
-    video_vesa_plot_pixel(x + x0, y + y0, color);
+    // only check every pixel if the circle is not completely on the screen
+    void (*plot)(unsigned x, unsigned y, int color) = put_pixel_format;
+    if(x0 - r < 0 || y0 - r < 0 || x0 + r >= (int)fb_width || y0 + r >= (int)fb_height) plot = put_pixel;
 
-    video_vesa_plot_pixel(x + x0, -y + y0, color);
-    video_vesa_plot_pixel(y + x0, x + y0 , color);
-    video_vesa_plot_pixel(-y + x0, x + y0, color);
+    plot(x0 + r, y0, color);
+    plot(x0 - r, y0, color);
+    plot(x0, y0 + r, color);
+    plot(x0, y0 - r, color);
 
+    int x = r;
+    int y = 0;
     int P = 1 - r;
     while(x > y) {
         y++;
@@ -262,72 +620,538 @@ void video_vesa_draw_circle(int x0, int y0, int r, int color) {
 
         if(x < y) break;
 
-        video_vesa_plot_pixel(x + x0, y + y0, color);
-        video_vesa_plot_pixel(-x + x0, y + y0, color);
-        video_vesa_plot_pixel(x + x0, -y + y0, color);
-        video_vesa_plot_pixel(-x + x0, -y + y0, color);
+        plot(x + x0, y + y0, color);
+        plot(-x + x0, y + y0, color);
+        plot(x + x0, -y + y0, color);
+        plot(-x + x0, -y + y0, color);
         if(x != y) {
-            video_vesa_plot_pixel(y + x0, x + y0, color);
-            video_vesa_plot_pixel(-y + x0, x + y0, color);
-            video_vesa_plot_pixel(y + x0, -x + y0, color);
-            video_vesa_plot_pixel(-y + x0, -x + y0, color);
+            plot(y + x0, x + y0, color);
+            plot(-y + x0, x + y0, color);
+            plot(y + x0, -x + y0, color);
+            plot(-y + x0, -x + y0, color);
+        }
+    }
+}
+
+// same walk as the outline but each pair of points is joined by a span
+// the rows at y0 +- x only get their span when x is about to change, so no row is filled twice
+static void raster_filled_circle(int x0, int y0, int r, int color) {
+    if(r < 0) return;
+
+    int x = r;
+    int y = 0;
+    int P = 1 - r;
+    while(x >= y) {
+        draw_span(x0 - x, x0 + x, y0 + y, color);
+        if(y) draw_span(x0 - x, x0 + x, y0 - y, color);
+
+        y++;
+        if(P <= 0) P += 2 * y + 1;
+        else {
+            if(x >= y) {
+                draw_span(x0 - (y - 1), x0 + (y - 1), y0 + x, color);
+                draw_span(x0 - (y - 1), x0 + (y - 1), y0 - x, color);
+            }
+            x--;
+            P += 2 * (y - x) + 1;
+        }
+    }
+}
+
+// fill < 0 leaves the inside alone
+static void raster_rectangle(int x0, int y0, int x1, int y1, int border, int fill) {
+    if(x0 > x1) {
+        int _x1 = x1;
+        x1 = x0;
+        x0 = _x1;
+    }
+    if(y0 > y1) {
+        int _y1 = y1;
+        y1 = y0;
+        y0 = _y1;
+    }
+
+    draw_span(x0, x1, y0, border);
+    if(y1 == y0) return;
+    draw_span(x0, x1, y1, border);
+    if(y1 - y0 < 2) return;
+
+    draw_column(x0, y0 + 1, y1 - 1, border);
+    draw_column(x1, y0 + 1, y1 - 1, border);
+
+    if(fill < 0 || x1 - x0 < 2) return;
+    int top = y0 + 1 < 0 ? 0 : y0 + 1;
+    int bottom = y1 - 1 >= (int)fb_height ? (int)fb_height - 1 : y1 - 1;
+    for(int y = top; y <= bottom; y++) draw_span(x0 + 1, x1 - 1, y, fill);
+}
+
+// the x of the edge from (xa, ya) to (xb, yb) at y
+static int edge_x(int xa, int ya, int xb, int yb, int y) {
+    if(yb == ya) return xa;
+    return xa + (int64_t)(xb - xa) * (y - ya) / (yb - ya);
+}
+
+static void raster_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int color) {
+    // sort the corners from top to bottom
+    int t;
+    if(y1 < y0) { t = y0; y0 = y1; y1 = t; t = x0; x0 = x1; x1 = t; }
+    if(y2 < y0) { t = y0; y0 = y2; y2 = t; t = x0; x0 = x2; x2 = t; }
+    if(y2 < y1) { t = y1; y1 = y2; y2 = t; t = x1; x1 = x2; x2 = t; }
+
+    int top = y0 < 0 ? 0 : y0;
+    int bottom = y2 >= (int)fb_height ? (int)fb_height - 1 : y2;
+
+    // every row is between the long edge from the top to the bottom corner and one of the two short ones
+    for(int y = top; y <= bottom; y++) {
+        int xa = edge_x(x0, y0, x2, y2, y);
+        int xb = y < y1 ? edge_x(x0, y0, x1, y1, y) : edge_x(x1, y1, x2, y2, y);
+        draw_span(xa, xb, y, color);
+    }
+}
+
+static void command_bounds(const video_draw_cmd_t* cmd, int* x0, int* y0, int* x1, int* y1) {
+    switch(cmd->type) {
+        case VIDEO_DRAW_CIRCLE:
+        case VIDEO_FILL_CIRCLE:
+            *x0 = cmd->x0 - cmd->r;
+            *y0 = cmd->y0 - cmd->r;
+            *x1 = cmd->x0 + cmd->r;
+            *y1 = cmd->y0 + cmd->r;
+            return;
+        case VIDEO_FILL_TRIANGLE:
+            *x0 = cmd->x0 < cmd->x1 ? cmd->x0 : cmd->x1;
+            *x0 = *x0 < cmd->x2 ? *x0 : cmd->x2;
+            *y0 = cmd->y0 < cmd->y1 ? cmd->y0 : cmd->y1;
+            *y0 = *y0 < cmd->y2 ? *y0 : cmd->y2;
+            *x1 = cmd->x0 > cmd->x1 ? cmd->x0 : cmd->x1;
+            *x1 = *x1 > cmd->x2 ? *x1 : cmd->x2;
+            *y1 = cmd->y0 > cmd->y1 ? cmd->y0 : cmd->y1;
+            *y1 = *y1 > cmd->y2 ? *y1 : cmd->y2;
+            return;
+        default:
+            *x0 = cmd->x0 < cmd->x1 ? cmd->x0 : cmd->x1;
+            *y0 = cmd->y0 < cmd->y1 ? cmd->y0 : cmd->y1;
+            *x1 = cmd->x0 > cmd->x1 ? cmd->x0 : cmd->x1;
+            *y1 = cmd->y0 > cmd->y1 ? cmd->y0 : cmd->y1;
+            return;
+    }
+}
+
+// draw all commands in one go, the SSE state is saved once and the screen gets one dirty area for all of them
+// interrupts are off while drawing so very long lists should be split
+void video_vesa_draw_batch(const video_draw_cmd_t* cmds, unsigned count) {
+    int dirty_x0 = fb_width;
+    int dirty_y0 = fb_height;
+    int dirty_x1 = -1;
+    int dirty_y1 = -1;
+
+    uint32_t eflags = simd_begin();
+    for(unsigned i = 0; i < count; i++) {
+        const video_draw_cmd_t* cmd = &cmds[i];
+        switch(cmd->type) {
+            case VIDEO_DRAW_LINE:
+                raster_line(cmd->x0, cmd->y0, cmd->x1, cmd->y1, cmd->color);
+                break;
+            case VIDEO_DRAW_RECTANGLE:
+                raster_rectangle(cmd->x0, cmd->y0, cmd->x1, cmd->y1, cmd->color, cmd->fill);
+                break;
+            case VIDEO_DRAW_CIRCLE:
+                raster_circle(cmd->x0, cmd->y0, cmd->r, cmd->color);
+                break;
+            case VIDEO_FILL_CIRCLE:
+                raster_filled_circle(cmd->x0, cmd->y0, cmd->r, cmd->color);
+                break;
+            case VIDEO_FILL_TRIANGLE:
+                raster_filled_triangle(cmd->x0, cmd->y0, cmd->x1, cmd->y1, cmd->x2, cmd->y2, cmd->color);
+                break;
+            default:
+                continue;
         }
+
+        int x0, y0, x1, y1;
+        command_bounds(cmd, &x0, &y0, &x1, &y1);
+        if(x0 < dirty_x0) dirty_x0 = x0;
+        if(y0 < dirty_y0) dirty_y0 = y0;
+        if(x1 > dirty_x1) dirty_x1 = x1;
+        if(y1 > dirty_y1) dirty_y1 = y1;
     }
+    simd_end(eflags);
+
+    mark_dirty(dirty_x0, dirty_y0, dirty_x1, dirty_y1);
+}
+
+void video_vesa_draw_line(int x0, int y0, int x1, int y1, int color) {
+    video_draw_cmd_t cmd = {.type = VIDEO_DRAW_LINE, .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1, .color = color};
+    video_vesa_draw_batch(&cmd, 1);
+}
+
+void video_vesa_draw_rectangle(int x0, int y0, int x1, int y1, int border, int fill) {
+    video_draw_cmd_t cmd = {.type = VIDEO_DRAW_RECTANGLE, .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1, .color = border, .fill = fill};
+    video_vesa_draw_batch(&cmd, 1);
+}
+
+void video_vesa_draw_circle(int x0, int y0, int r, int color) {
+    video_draw_cmd_t cmd = {.type = VIDEO_DRAW_CIRCLE, .x0 = x0, .y0 = y0, .r = r, .color = color};
+    video_vesa_draw_batch(&cmd, 1);
+}
+
+void video_vesa_fill_circle(int x0, int y0, int r, int color) {
+    video_draw_cmd_t cmd = {.type = VIDEO_FILL_CIRCLE, .x0 = x0, .y0 = y0, .r = r, .color = color};
+    video_vesa_draw_batch(&cmd, 1);
+}
+
+void video_vesa_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int color) {
+    video_draw_cmd_t cmd = {.type = VIDEO_FILL_TRIANGLE, .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1, .x2 = x2, .y2 = y2, .color = color};
+    video_vesa_draw_batch(&cmd, 1);
+}
+
+// scale an 8 bit colour channel to its size in the pixel and move it to its place
+static int pack_channel(int value, uint8_t position, uint8_t size) {
+    if(size < 8) value >>= 8 - size;
+    else value <<= size - 8;
+    return value << position;
 }
 
 int video_vesa_rgb(int r, int g, int b) {
-    // TODO: support other bpp mode
-    return (r << 16) | (g << 8) | b;
+    return pack_channel(r & 0xff, pixel_format.red_position, pixel_format.red_size)
+        | pack_channel(g & 0xff, pixel_format.green_position, pixel_format.green_size)
+        | pack_channel(b & 0xff, pixel_format.blue_position, pixel_format.blue_size);
 }
 
-// should be called after changing either cursor_posx or cursor_posy
-static void draw_cursor(bool load_buffer) {
-    for(int y = 0; y < font_height; y++) {
-        for(int x = 0; x < font_width; x++) {
-            if(load_buffer)
-                video_vesa_plot_pixel(
-                    x + cursor_buffer_posx * font_width,
-                    y + cursor_buffer_posy * font_height,
-                    cursor_buffer[y * font_width + x]
-                );
-
-            // load new location to buffer
-            cursor_buffer[y * font_width + x] = video_vesa_get_pixel(
-                x + cursor_posx * font_width,
-                y + cursor_posy * font_height
+// draw a cell straight from the PSF data
+static void draw_cell_uncached(int col, int row, console_cell_t* cell) {
+    char* glyph = psf_get_glyph(cell->chr);
+
+    int col_px = 0;
+    int line = 0;
+    for(int i = 0; i < font_bpg; i++) {
+        int remain_width = font_width - col_px;
+        if(remain_width > 8) remain_width = 8;
+        for(int j = 0; j < remain_width; j++) {
+            put_pixel(
+                col * font_width + j + col_px,
+                row * font_height + line,
+                ((*(glyph+i) >> (7-j)) & 1) ? cell->fg : cell->bg
             );
+        }
+
+        col_px += remain_width;
+        if(col_px >= font_width) {
+            line++;
+            col_px = 0;
+        }
+    }
+}
 
-            // now draw the cursor
-            video_vesa_plot_pixel(
-                x + cursor_posx * font_width,
-                y + cursor_posy * font_height,
-                video_vesa_rgb(180, 170, 170)
+static void build_pattern_table(int fg, int bg) {
+    if(fg == pattern_fg && bg == pattern_bg) return;
+    pattern_fg = fg;
+    pattern_bg = bg;
+
+    for(int n = 0; n < 16; n++) {
+        if(fb_bytes_per_pixel == 1) {
+            uint32_t word = 0;
+            for(int i = 0; i < 4; i++)
+                word |= (uint32_t)(((n >> i) & 1 ? fg : bg) & 0xff) << (i * 8);
+            pattern_table[n] = word;
+        }
+        else if(fb_bytes_per_pixel == 2 && n < 4) {
+            pattern_table[n] = ((n & 1 ? fg : bg) & 0xffff) | (((n & 2 ? fg : bg) & 0xffff) << 16);
+        }
+        else if(fb_bytes_per_pixel == 3) {
+            uint8_t bytes[12];
+            for(int i = 0; i < 4; i++) {
+                int color = (n >> i) & 1 ? fg : bg;
+                bytes[i * 3] = color;
+                bytes[i * 3 + 1] = color >> 8;
+                bytes[i * 3 + 2] = color >> 16;
+            }
+            memcpy(&pattern_table[n * 3], bytes, 12);
+        }
+    }
+}
+
+static void blit_row_8(uint8_t* dst, uint32_t mask, int fg, int bg) {
+    int x = 0;
+    for(; x + 4 <= font_width; x += 4)
+        *(uint32_t*)(dst + x) = pattern_table[(mask >> x) & 0xf];
+    for(; x < font_width; x++)
+        dst[x] = (mask >> x) & 1 ? fg : bg;
+}
+
+static void blit_row_16(uint8_t* dst, uint32_t mask, int fg, int bg) {
+    int x = 0;
+    for(; x + 2 <= font_width; x += 2)
+        *(uint32_t*)(dst + x * 2) = pattern_table[(mask >> x) & 0x3];
+    if(x < font_width)
+        *(uint16_t*)(dst + x * 2) = (mask >> x) & 1 ? fg : bg;
+}
+
+static void blit_row_24(uint8_t* dst, uint32_t mask, int fg, int bg) {
+    int x = 0;
+    for(; x + 4 <= font_width; x += 4) {
+        uint32_t* words = &pattern_table[((mask >> x) & 0xf) * 3];
+        uint32_t* out = (uint32_t*)(dst + x * 3);
+        out[0] = words[0];
+        out[1] = words[1];
+        out[2] = words[2];
+    }
+    for(; x < font_width; x++) {
+        int color = (mask >> x) & 1 ? fg : bg;
+        dst[x * 3] = color;
+        dst[x * 3 + 1] = color >> 8;
+        dst[x * 3 + 2] = color >> 16;
+    }
+}
+
+static void blit_row_32(uint8_t* dst, uint32_t mask, int fg, int bg) {
+    uint32_t* out = (uint32_t*)dst;
+    for(int x = 0; x < font_width; x++)
+        out[x] = (mask >> x) & 1 ? fg : bg;
+}
+
+static void draw_cell(int col, int row, console_cell_t* cell) {
+    // the font may have just changed while the grid is still the old one
+    if((unsigned)((col + 1) * font_width) > fb_width || (unsigned)((row + 1) * font_height) > fb_height) return;
+
+    if(!glyph_rows || !blit_row) {
+        draw_cell_uncached(col, row, cell);
+        return;
+    }
+
+    if(fb_bytes_per_pixel != 4) build_pattern_table(cell->fg, cell->bg);
+
+    uint32_t* mask = glyph_rows + (uint8_t)cell->chr * font_height;
+    uint8_t* dst = framebuffer + row * font_height * fb_pitch + col * font_width * fb_bytes_per_pixel;
+    for(int y = 0; y < font_height; y++) {
+        blit_row(dst, mask[y], cell->fg, cell->bg);
+        dst += fb_pitch;
+    }
+}
+
+// use the colour layout of the framebuffer, NULL for 8 bits of red, green and blue from the top
+// video_vesa_set_size must be called before
+void video_vesa_set_pixel_format(const video_pixel_format_t* format) {
+    if(format) pixel_format = *format;
+
+    // 15 bpp pixels are stored in 16 bits like 16 bpp
+    switch(fb_bytes_per_pixel) {
+        case 1:
+            put_pixel_format = put_pixel_8;
+            get_pixel_format = get_pixel_8;
+            fill_row = fill_row_8;
+            blit_row = blit_row_8;
+            break;
+        case 2:
+            put_pixel_format = put_pixel_16;
+            get_pixel_format = get_pixel_16;
+            fill_row = fill_row_16;
+            blit_row = blit_row_16;
+            break;
+        case 3:
+            put_pixel_format = put_pixel_24;
+            get_pixel_format = get_pixel_24;
+            fill_row = fill_row_24;
+            blit_row = blit_row_24;
+            break;
+        case 4:
+            put_pixel_format = put_pixel_32;
+            get_pixel_format = get_pixel_32;
+            fill_row = fill_row_32;
+            blit_row = blit_row_32;
+            break;
+        default:
+            put_pixel_format = put_pixel_none;
+            get_pixel_format = get_pixel_none;
+            fill_row = fill_row_none;
+            blit_row = NULL;
+            break;
+    }
+
+    // the colours in the pattern table may be in the old layout
+    pattern_fg = -1;
+    pattern_bg = -1;
+    current_fg = video_vesa_rgb(150, 150, 150);
+    current_bg = video_vesa_rgb(0, 0, 0);
+}
+
+static void draw_cursor() {
+    video_vesa_fill_rectangle(
+        cursor_posx * font_width, cursor_posy * font_height,
+        (cursor_posx + 1) * font_width - 1, (cursor_posy + 1) * font_height - 1,
+        video_vesa_rgb(180, 170, 170)
+    );
+
+    drawn_cursor_posx = cursor_posx;
+    drawn_cursor_posy = cursor_posy;
+}
+
+// draw the cells that changed since the last time, console_lock must be held
+static void render_console() {
+    if(!grid) return;
+
+    if(pending_scroll) {
+        // moving the pixels is cheaper than drawing every glyph again but only when it does not read VRAM
+        if(using_backbuffer && pending_scroll < text_rows) {
+            uint32_t eflags = simd_begin();
+            simd_copy(
+                framebuffer,
+                framebuffer + pending_scroll * font_height * fb_pitch,
+                (text_rows - pending_scroll) * font_height * fb_pitch
             );
+            simd_end(eflags);
+            mark_dirty(0, 0, fb_width - 1, text_rows * font_height - 1);
         }
+        else {
+            for(int y = 0; y < text_rows; y++) mark_cells(y, 0, text_cols - 1);
+        }
+        pending_scroll = 0;
+    }
+
+    bool cursor_moved = drawn_cursor_posx != cursor_posx || drawn_cursor_posy != cursor_posy;
+    // the old cursor block goes away by drawing the cell behind it
+    if(cursor_moved && drawn_cursor_posy >= 0 && drawn_cursor_posy < text_rows)
+        mark_cells(drawn_cursor_posy, drawn_cursor_posx, drawn_cursor_posx);
+
+    bool changed = false;
+    for(int y = 0; y < text_rows; y++) {
+        int from = row_dirty_from[y];
+        int to = row_dirty_to[y];
+        if(from > to) continue;
+
+        for(int x = from; x <= to; x++) draw_cell(x, y, get_cell(x, y));
+        mark_dirty(from * font_width, y * font_height, (to + 1) * font_width - 1, (y + 1) * font_height - 1);
+
+        row_dirty_from[y] = text_cols;
+        row_dirty_to[y] = -1;
+        changed = true;
+    }
+
+    if((changed || cursor_moved) && cursor_posy < text_rows) draw_cursor();
+}
+
+static void flush_span(uint32_t start, uint32_t end) {
+    // the back buffer mirrors the whole screen so copying a bit more around the span is fine
+    start &= ~(FLUSH_ALIGN - 1);
+    end = (end + FLUSH_ALIGN - 1) & ~(FLUSH_ALIGN - 1);
+    if(end > fb_height * fb_pitch) end = fb_height * fb_pitch;
+
+    simd_copy(screen + start, framebuffer + start, end - start);
+}
+
+// draw the console and copy the dirty part of the back buffer to the screen
+void video_vesa_flush() {
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
+    render_console();
+    ticketlock_release_irqrestore(&console_lock, eflags);
+
+    if(!using_backbuffer) return;
+
+    eflags = ticketlock_acquire_irqsave(&dirty_lock);
+    int x0 = dirty_x0;
+    int y0 = dirty_y0;
+    int x1 = dirty_x1;
+    int y1 = dirty_y1;
+    dirty_x0 = 0;
+    dirty_y0 = 0;
+    dirty_x1 = -1;
+    dirty_y1 = -1;
+    ticketlock_release_irqrestore(&dirty_lock, eflags);
+
+    if(x0 > x1) return;
+
+    unsigned bytes_per_pixel = fb_bytes_per_pixel;
+    eflags = simd_begin();
+
+    // full rows are next to each other so they go in one copy
+    if(x0 == 0 && x1 == (int)fb_width - 1) {
+        flush_span(y0 * fb_pitch, (y1 + 1) * fb_pitch);
+    }
+    else {
+        for(int y = y0; y <= y1; y++)
+            flush_span(y * fb_pitch + x0 * bytes_per_pixel, y * fb_pitch + (x1 + 1) * bytes_per_pixel);
+    }
+
+    simd_end(eflags);
+}
+
+void video_vesa_get_framebuffer_info(framebuffer_info_t* info) {
+    info->width = fb_width;
+    info->height = fb_height;
+    info->pitch = fb_pitch;
+    info->bpp = fb_bytes_per_pixel * 8;
+    info->red_position = pixel_format.red_position;
+    info->red_size = pixel_format.red_size;
+    info->green_position = pixel_format.green_position;
+    info->green_size = pixel_format.green_size;
+    info->blue_position = pixel_format.blue_position;
+    info->blue_size = pixel_format.blue_size;
+}
+
+// copy a rectangle of buffer to the same place in the back buffer, it is shown with the next flush
+// buffer has the layout given by video_vesa_get_framebuffer_info and must be mapped completely
+void video_vesa_present(const uint8_t* buffer, int x0, int y0, int x1, int y1) {
+    if(x0 > x1) {
+        int _x1 = x1;
+        x1 = x0;
+        x0 = _x1;
+    }
+    if(y0 > y1) {
+        int _y1 = y1;
+        y1 = y0;
+        y0 = _y1;
+    }
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 >= (int)fb_width) x1 = fb_width - 1;
+    if(y1 >= (int)fb_height) y1 = fb_height - 1;
+    if(x0 > x1 || y0 > y1) return;
+
+    uint32_t eflags = simd_begin();
+    if(x0 == 0 && x1 == (int)fb_width - 1) {
+        simd_copy(framebuffer + y0 * fb_pitch, buffer + y0 * fb_pitch, (y1 - y0 + 1) * fb_pitch);
+    }
+    else {
+        size_t offset = x0 * fb_bytes_per_pixel;
+        size_t size = (x1 - x0 + 1) * fb_bytes_per_pixel;
+        for(int y = y0; y <= y1; y++)
+            simd_copy(framebuffer + y * fb_pitch + offset, buffer + y * fb_pitch + offset, size);
     }
+    simd_end(eflags);
 
-    // load new location
-    cursor_buffer_posx = cursor_posx;
-    cursor_buffer_posy = cursor_posy;
+    mark_dirty(x0, y0, x1, y1);
 }
 
 int video_vesa_get_cursor() {
     return cursor_posy * text_cols + cursor_posx;
 }
 void video_vesa_set_cursor(int offset) {
+    if(!text_cols) return;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
     cursor_posy = offset / text_cols;
     cursor_posx = offset % text_cols;
+    ticketlock_release_irqrestore(&console_lock, eflags);
 }
 
 void video_vesa_cls(int bg) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
+
     video_vesa_fill_rectangle(0, 0, fb_width-1, fb_height-1, bg);
-    cursor_posy = 0;
-    cursor_posx = 0;
-}
+    if(grid) {
+        reset_console(bg);
+        // the cells already look like that
+        for(int y = 0; y < text_rows; y++) {
+            row_dirty_from[y] = text_cols;
+            row_dirty_to[y] = -1;
+        }
+    }
 
-void video_vesa_print_char(char chr, int offset, int fg, int bg, bool move) {
-    if(chr == 0) return;
+    ticketlock_release_irqrestore(&console_lock, eflags);
+}
 
+// console_lock must be held and the grid must exist
+static void put_char(char chr, int offset, int fg, int bg, bool move) {
     int _cursor_posx = cursor_posx;
     int _cursor_posy = cursor_posy;
     if(fg < 0) fg = current_fg;
@@ -338,14 +1162,11 @@ void video_vesa_print_char(char chr, int offset, int fg, int bg, bool move) {
         _cursor_posx = offset % text_cols;
     }
 
-    bool load_cursor_buffer = false;
     if(chr == '\n') {
-        load_cursor_buffer = true;
         _cursor_posx = 0;
         _cursor_posy++;
     }
     else if(chr == '\b') {
-        load_cursor_buffer = true;
         _cursor_posx -= 1;
         if(_cursor_posx < 0) {
             _cursor_posx = text_cols - 1;
@@ -353,35 +1174,20 @@ void video_vesa_print_char(char chr, int offset, int fg, int bg, bool move) {
             if(_cursor_posy < 0) _cursor_posy = 0;
         }
         // manually delete the char
-        for(int y = 0; y < font_height; y++)
-            for(int x = 0; x < font_width; x++)
-                video_vesa_plot_pixel(
-                    x + _cursor_posx * font_width,
-                    y + _cursor_posy * font_height,
-                    0x0
-                );
+        if(_cursor_posy < text_rows) {
+            console_cell_t* cell = get_cell(_cursor_posx, _cursor_posy);
+            cell->chr = ' ';
+            cell->bg = 0x0;
+            mark_cells(_cursor_posy, _cursor_posx, _cursor_posx);
+        }
     }
     else {
-        char* glyph = psf_get_glyph(chr);
-
-        int col = 0;
-        int line = 0;
-        for(int i = 0; i < font_bpg; i++) {
-            int remain_width = font_width - col;
-            if(remain_width > 8) remain_width = 8;
-            for(int j = 0; j < remain_width; j++) {
-                video_vesa_plot_pixel(
-                    _cursor_posx * font_width + j + col,
-                    _cursor_posy * font_height + line,
-                    ((*(glyph+i) >> (7-j)) & 1) ? fg : bg
-                );
-            }
-
-            col += remain_width;
-            if(col >= font_width) {
-                line++;
-                col = 0;
-            }
+        if(_cursor_posy < text_rows) {
+            console_cell_t* cell = get_cell(_cursor_posx, _cursor_posy);
+            cell->chr = chr;
+            cell->fg = fg;
+            cell->bg = bg;
+            mark_cells(_cursor_posy, _cursor_posx, _cursor_posx);
         }
         _cursor_posx++;
     }
@@ -395,6 +1201,22 @@ void video_vesa_print_char(char chr, int offset, int fg, int bg, bool move) {
         cursor_posy = _cursor_posy;
         if(cursor_posy == text_rows) scroll_screen(1);
     }
+}
 
-    draw_cursor(load_cursor_buffer);
+void video_vesa_print_char(char chr, int offset, int fg, int bg, bool move) {
+    if(chr == 0) return;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
+    if(grid) put_char(chr, offset, fg, bg, move);
+    ticketlock_release_irqrestore(&console_lock, eflags);
+}
+
+// write len chars at the cursor with the current colours, taking the lock once for all of them
+void video_vesa_print_string(const char* str, size_t len) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&console_lock);
+    if(grid) {
+        for(size_t i = 0; i < len; i++)
+            if(str[i]) put_char(str[i], -1, -1, -1, true);
+    }
+    ticketlock_release_irqrestore(&console_lock, eflags);
 }
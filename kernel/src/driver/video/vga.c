@@ -1,10 +1,25 @@
 #include "video.h"
 #include "system.h"
 
-static uint8_t* vid_mem = (uint8_t*)VIDEO_START;
+#include "string.h"
+
+// each cell is the char in the low byte and the attribute in the high byte
+static uint16_t* const vid_cells = (uint16_t*)VIDEO_START;
 
 static uint8_t current_attr = 0x7;
 
+// the screen is a window into the text memory that moves down when scrolling
+// this is the first cell of the window
+static int screen_start = 0;
+#define TEXTMODE_CELLS (VIDEO_TEXTMODE_SIZE / 2)
+
+// relative to screen_start, -1 until it is read from the hardware
+static int cursor = -1;
+// changed since the last flush
+static bool start_dirty = false;
+static bool cursor_dirty = false;
+static ticketlock_t vga_lock = TICKETLOCK_INIT;
+
 static int text_rows;
 static int text_cols;
 
@@ -23,16 +38,20 @@ void video_vga_get_size(int* w, int* h) {
 }
 
 void video_vga_enable_cursor(int cursor_scanline_start, int cursor_scanline_end) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
     port_outb(PORT_SCREEN_CTRL, 0x0a);
     port_outb(PORT_SCREEN_DATA, (port_inb(PORT_SCREEN_DATA) & 0xc0) | cursor_scanline_start);
 
     port_outb(PORT_SCREEN_CTRL, 0x0b);
     port_outb(PORT_SCREEN_DATA, (port_inb(PORT_SCREEN_DATA) & 0xe0) | cursor_scanline_end);
+    ticketlock_release_irqrestore(&vga_lock, eflags);
 }
 
 void video_vga_disable_cursor() {
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
     port_outb(PORT_SCREEN_CTRL, 0x0a);
     port_outb(PORT_SCREEN_DATA, 0x20);
+    ticketlock_release_irqrestore(&vga_lock, eflags);
 }
 
 static unsigned color_difference(unsigned r1, unsigned g1, unsigned b1, unsigned r2, unsigned g2, unsigned b2) {
@@ -147,73 +166,152 @@ int video_vga_rgb(int r, int g, int b) {
     return ret;
 }
 
-int video_vga_get_cursor() {
+// port writes are slow, each one is a VM exit under a hypervisor
+// so the cursor and the window start are only kept here and given to the hardware by video_vga_flush
+static void write_crtc() {
+    if(start_dirty) {
+        port_outb(PORT_SCREEN_CTRL, 0x0c);
+        port_outb(PORT_SCREEN_DATA, (uint8_t)(screen_start >> 8));
+        port_outb(PORT_SCREEN_CTRL, 0x0d);
+        port_outb(PORT_SCREEN_DATA, (uint8_t)(screen_start));
+        start_dirty = false;
+    }
+    if(cursor_dirty) {
+        int offset = screen_start + cursor;
+        port_outb(PORT_SCREEN_CTRL, 0x0e);
+        port_outb(PORT_SCREEN_DATA, (uint8_t)(offset >> 8));
+        port_outb(PORT_SCREEN_CTRL, 0x0f);
+        port_outb(PORT_SCREEN_DATA, (uint8_t)(offset));
+        cursor_dirty = false;
+    }
+}
+
+// the cursor starts wherever the bootloader left it, vga_lock must be held
+static void load_cursor() {
+    if(cursor >= 0) return;
+
     int offset = 0;
     port_outb(PORT_SCREEN_CTRL, 0x0f);
     offset |= port_inb(PORT_SCREEN_DATA);
     port_outb(PORT_SCREEN_CTRL, 0x0e);
     offset |= port_inb(PORT_SCREEN_DATA) << 8;
+    cursor = offset - screen_start;
+}
+
+int video_vga_get_cursor() {
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
+    load_cursor();
+    int offset = cursor;
+    ticketlock_release_irqrestore(&vga_lock, eflags);
     return offset;
 }
 
 void video_vga_set_cursor(int offset) {
-    port_outb(PORT_SCREEN_CTRL, 14);
-    port_outb(PORT_SCREEN_DATA, (uint8_t)(offset >> 8));
-    port_outb(PORT_SCREEN_CTRL, 15);
-    port_outb(PORT_SCREEN_DATA, (uint8_t)(offset));
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
+    cursor = offset;
+    cursor_dirty = true;
+    ticketlock_release_irqrestore(&vga_lock, eflags);
 }
 
-void video_vga_cls(int bg) {
-    for(int i = 0; i < text_rows * text_cols; i++) {
-        vid_mem[i * 2 + 1] = (bg & 0xf) << 4;
-        vid_mem[i * 2]     = ' ';
-    }
-    video_vga_set_cursor(0);
+static void fill_cells(int from, int to, uint16_t cell) {
+    for(int i = from; i < to; i++) vid_cells[i] = cell;
 }
 
-static void scroll_screen(unsigned ammount) {
-    int end = video_vga_get_cursor();
+void video_vga_cls(int bg) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
+    screen_start = 0;
+    cursor = 0;
+    start_dirty = true;
+    cursor_dirty = true;
+    fill_cells(0, text_rows * text_cols, ((bg & 0xf) << 12) | ' ');
+    ticketlock_release_irqrestore(&vga_lock, eflags);
+}
 
-    int start = end - text_cols * ammount;
-    // already on top
-    if(end < text_cols) start = 0;
+// tell the hardware where the window and the cursor ended up
+void video_vga_flush() {
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
+    write_crtc();
+    ticketlock_release_irqrestore(&vga_lock, eflags);
+}
 
-    for(int i = 0; i < start; i++) {
-        vid_mem[i * 2] = vid_mem[i * 2 + text_cols * 2 * ammount];
-        vid_mem[i * 2 + 1] = vid_mem[i * 2 + text_cols * 2 * ammount + 1];
+// move the window down by rows and clear the rows that come in, vga_lock must be held
+// the window is panned through the text memory so only the new rows are written
+// the rows on screen are only copied when the end of the text memory is reached
+static void scroll_screen(int rows) {
+    int screen_cells = text_rows * text_cols;
+    int kept = rows < text_rows ? screen_cells - rows * text_cols : 0;
+
+    int start_cell = screen_start + rows * text_cols;
+    if(start_cell + screen_cells > TEXTMODE_CELLS) {
+        memmove(vid_cells, vid_cells + start_cell, kept * sizeof(uint16_t));
+        start_cell = 0;
     }
-    for(int i = start; i <= end; i++) {
-        vid_mem[i * 2] = ' ';
-        vid_mem[i * 2 + 1] = 0xf;
+    screen_start = start_cell;
+    start_dirty = true;
+    cursor_dirty = true;
+
+    fill_cells(screen_start + kept, screen_start + screen_cells, 0x0f00 | ' ');
+}
+
+// write chr at offset and return the offset after it, vga_lock must be held
+static int put_char(char chr, int offset, uint8_t attr) {
+    if(chr == '\n') return offset + text_cols - (offset % text_cols);
+
+    if(chr == '\b') {
+        if(offset == 0) return 0;
+        offset--;
+        vid_cells[screen_start + offset] = (vid_cells[screen_start + offset] & 0xff00) | ' ';
+        return offset;
     }
 
-    video_vga_set_cursor(start);
+    vid_cells[screen_start + offset] = (attr << 8) | (uint8_t)chr;
+    return offset + 1;
+}
+
+// keep the cursor on the screen, vga_lock must be held
+static void follow_cursor() {
+    int screen_cells = text_rows * text_cols;
+    if(cursor < screen_cells) return;
+
+    int rows = (cursor - screen_cells) / text_cols + 1;
+    scroll_screen(rows);
+    cursor -= rows * text_cols;
 }
 
 void video_vga_print_char(char chr, int offset, int fg, int bg, bool move) {
     if(chr == 0) return;
 
-    if(offset < 0) offset = video_vga_get_cursor();
-
     uint8_t attr = current_attr;
-    if(fg >= 0) attr = (attr & 0x0f) | fg;
-    if(bg >= 0) attr = (attr & 0xf0) | bg;
+    if(fg >= 0) attr = (attr & 0xf0) | fg;
+    if(bg >= 0) attr = (attr & 0x0f) | (bg << 4);
 
-    if(chr == '\n') {
-        offset += text_cols - (offset % text_cols);
-    }
-    else if(chr == '\b') {
-        offset--;
-        vid_mem[offset * 2] = ' ';
-    }
-    else {
-        vid_mem[offset * 2] = chr;
-        vid_mem[offset * 2 + 1] = attr;
-        offset++;
-    }
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
+    load_cursor();
+    if(offset < 0) offset = cursor;
 
+    offset = put_char(chr, offset, attr);
     if(move) {
-        video_vga_set_cursor(offset);
-        if(offset > text_rows * text_cols - 1) scroll_screen(1);
+        cursor = offset;
+        cursor_dirty = true;
+        follow_cursor();
     }
+
+    ticketlock_release_irqrestore(&vga_lock, eflags);
+}
+
+// write len chars at the cursor with the current attribute
+// the lock is taken once for all of them and the hardware only hears about it at the next flush
+void video_vga_print_string(const char* str, size_t len) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&vga_lock);
+    load_cursor();
+
+    uint8_t attr = current_attr;
+    for(size_t i = 0; i < len; i++) {
+        if(str[i] == 0) continue;
+        cursor = put_char(str[i], cursor, attr);
+        follow_cursor();
+    }
+    cursor_dirty = true;
+
+    ticketlock_release_irqrestore(&vga_lock, eflags);
 }
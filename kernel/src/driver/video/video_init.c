@@ -30,6 +30,11 @@ void video_preinit_print_char(char chr, int offset, int fg, int bg, bool move) {
     preinit_buffer[offset++] = chr;
     if(move) preinit_cursor = offset;
 }
+void video_preinit_print_string(const char* str, size_t len) {
+    for(size_t i = 0; i < len; i++)
+        video_preinit_print_char(str[i], -1, -1, -1, true);
+}
+void video_preinit_flush() {}
 
 // actually define the pointers else we would get undefined reference error
 void (*video_set_attr)(int fg, int bg) = video_preinit_set_attr;
@@ -39,6 +44,8 @@ int (*video_get_cursor)() = video_preinit_get_cursor;
 void (*video_set_cursor)(int offset) = video_preinit_set_cursor;
 void (*video_cls)(int color) = video_preinit_cls;
 void (*video_print_char)(char chr, int offset, int fg, int bg, bool move) = video_preinit_print_char;
+void (*video_print_string)(const char* str, size_t len) = video_preinit_print_string;
+void (*video_flush)() = video_preinit_flush;
 
 void video_vga_init(uint8_t cols, uint8_t rows) {
     linear_graphics_mode = false;
@@ -50,15 +57,15 @@ void video_vga_init(uint8_t cols, uint8_t rows) {
     video_set_cursor    = video_vga_set_cursor;
     video_cls           = video_vga_cls;
     video_print_char    = video_vga_print_char;
+    video_print_string  = video_vga_print_string;
+    video_flush         = video_vga_flush;
 
     video_vga_set_size(cols, rows);
 
-    if(preinit_buffer_len > 0) {
-        for(unsigned i = 0; i < preinit_buffer_len; i++)
-            video_vga_print_char(preinit_buffer[i], -1, -1, -1, true);
-    }
+    if(preinit_buffer_len > 0) video_vga_print_string(preinit_buffer, preinit_buffer_len);
+    video_vga_flush();
 }
-void video_vesa_init(uint32_t width, uint32_t height, uint32_t pitch, uint8_t bpp) {
+void video_vesa_init(uint32_t width, uint32_t height, uint32_t pitch, uint8_t bpp, const video_pixel_format_t* format, void* backbuffer) {
     linear_graphics_mode = true;
 
     video_set_attr      = video_vesa_set_attr;
@@ -68,17 +75,19 @@ void video_vesa_init(uint32_t width, uint32_t height, uint32_t pitch, uint8_t bp
     video_set_cursor    = video_vesa_set_cursor;
     video_cls           = video_vesa_cls;
     video_print_char    = video_vesa_print_char;
+    video_print_string  = video_vesa_print_string;
+    video_flush         = video_vesa_flush;
 
     video_vesa_set_size(pitch, bpp, width, height);
+    video_vesa_set_pixel_format(format);
+    video_vesa_set_backbuffer(backbuffer);
 
     int font_width, font_height, font_bpg;
     psf_get_font_geometry(&font_width, &font_height, &font_bpg);
     video_vesa_set_font_size(font_width, font_height, font_bpg);
 
-    if(preinit_buffer_len > 0) {
-        for(unsigned i = 0; i < preinit_buffer_len; i++)
-            video_vesa_print_char(preinit_buffer[i], -1, -1, -1, true);
-    }
+    if(preinit_buffer_len > 0) video_vesa_print_string(preinit_buffer, preinit_buffer_len);
+    video_vesa_flush();
 }
 
 bool video_using_framebuffer() {
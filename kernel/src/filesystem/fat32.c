@@ -1,5 +1,6 @@
 #include "filesystem.h"
 #include "ata.h"
+#include "process.h"
 
 #include "string.h"
 
@@ -51,6 +52,8 @@
 static uint8_t FAT[512];
 // store the last sector that is read to FAT
 static int last_read_FAT_sector = -1;
+// readers share the cached sector
+static mutex_t FAT_lock = MUTEX_INIT;
 
 static void parse_lfn(fat_lfn_entry_t* lfn, char* buff, int offset, int* cnt) {
     *cnt = 0;
@@ -78,6 +81,8 @@ static void set_FAT_entry(fat32_bootrecord_t* bootrec, fs_t* fs,
     int FAT_offset = cluster * 4;
     int FAT_sector = first_FAT_sector + FAT_offset / bootrec->bpb.bytes_per_sector;
     int entry_offset = FAT_offset % bootrec->bpb.bytes_per_sector;
+
+    mutex_lock(&FAT_lock);
     if(FAT_sector != last_read_FAT_sector) {
         ata_pio_LBA28_access(true, fs->partition.LBA_start + FAT_sector, 1, FAT);
         last_read_FAT_sector = FAT_sector;
@@ -85,18 +90,24 @@ static void set_FAT_entry(fat32_bootrecord_t* bootrec, fs_t* fs,
 
     *((uint32_t*)&(FAT[entry_offset])) = val;
     ata_pio_LBA28_access(false, fs->partition.LBA_start + FAT_sector, 1, FAT);
+    mutex_unlock(&FAT_lock);
 }
 static uint32_t get_FAT_entry(fat32_bootrecord_t* bootrec, fs_t* fs,
         uint32_t first_FAT_sector, uint32_t cluster) {
     int FAT_offset = cluster * 4;
     int FAT_sector = first_FAT_sector + FAT_offset / bootrec->bpb.bytes_per_sector;
     int entry_offset = FAT_offset % bootrec->bpb.bytes_per_sector;
+
+    mutex_lock(&FAT_lock);
     if(FAT_sector != last_read_FAT_sector) {
         ata_pio_LBA28_access(true, fs->partition.LBA_start + FAT_sector, 1, FAT);
         last_read_FAT_sector = FAT_sector;
     }
 
-    return *((uint32_t*)&(FAT[entry_offset])) & 0x0fffffff;
+    uint32_t val = *((uint32_t*)&(FAT[entry_offset])) & 0x0fffffff;
+    mutex_unlock(&FAT_lock);
+
+    return val;
 }
 
 static uint8_t gen_checksum(char* shortname) {
@@ -1,7 +1,13 @@
 #include "filesystem.h"
+#include "process.h"
 
 #include "string.h"
 
+// readers can run at the same time, anything that changes the filesystem runs alone
+static rwlock_t fs_lock = RWLOCK_INIT;
+// fs_find passes its state to the callback through the two statics below
+static mutex_t find_lock = MUTEX_INIT;
+
 static char name_buffer[FILENAME_LIMIT];
 static fs_node_t ret_node;
 
@@ -21,39 +27,47 @@ static bool find_node_callback(fs_node_t node) {
     return true;
 }
 
-FS_ERR fs_rm_recursive(fs_node_t*  parent, fs_node_t delete_node); // declare it first
+static FS_ERR rm_recursive(fs_node_t*  parent, fs_node_t delete_node); // declare it first
 static bool rm_node_callback(fs_node_t node) {
     // ignore . and ..
     if(strcmp(node.name, ".") || strcmp(node.name, "..")) return true;
     
-    FS_ERR err = fs_rm_recursive(node.parent_node, node);
+    FS_ERR err = rm_recursive(node.parent_node, node);
     if(err) return false;
 
     return true;
 }
 
-FS_ERR fs_copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name); // declare it first
+static FS_ERR copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name); // declare it first
 static fs_node_t copy_current_dir;
 static bool cp_node_callback(fs_node_t node) {
     // ignore . and ..
     if(strcmp(node.name, ".") || strcmp(node.name, "..")) return true;
     
-    FS_ERR err = fs_copy_recursive(&node, &copy_current_dir, NULL, NULL);
+    FS_ERR err = copy_recursive(&node, &copy_current_dir, NULL, NULL);
     if(err) return false;
 
     return true;
 }
 
 // go through all files and directories in `parent`. call the callback when found one
+// the callback may list other directories but must not change the filesystem
 FS_ERR fs_list_dir(fs_node_t* parent, bool (*callback)(fs_node_t)) {
+    FS_ERR err = ERR_FS_UNKNOWN_FS;
+
+    rwlock_read_lock(&fs_lock);
     if(parent->fs->type == FS_FAT32)
-        return fat32_read_dir(parent, callback);
+        err = fat32_read_dir(parent, callback);
+    rwlock_read_unlock(&fs_lock);
 
-    return ERR_FS_UNKNOWN_FS;
+    return err;
 }
 
 // find a node in parent
 fs_node_t fs_find(fs_node_t* parent, const char* nodename) {
+    rwlock_read_lock(&fs_lock);
+    mutex_lock(&find_lock);
+
     memcpy(name_buffer, nodename, strlen(nodename) + 1);
 
     ret_node.valid = false;
@@ -63,22 +77,29 @@ fs_node_t fs_find(fs_node_t* parent, const char* nodename) {
         else ret_node.valid = false;
     }
 
-    return ret_node;
+    fs_node_t node = ret_node;
+
+    mutex_unlock(&find_lock);
+    rwlock_read_unlock(&fs_lock);
+
+    return node;
 }
 
 // make a directory in parent node
 // return invalid node when failed to find free cluster / fs not defined / directory already exists
 fs_node_t fs_mkdir(fs_node_t* parent, char* name) {
-    ret_node.valid = false;
+    fs_node_t node;
+    node.valid = false;
 
+    rwlock_write_lock(&fs_lock);
     if(parent->fs->type == FS_FAT32) {
         uint32_t dir_cluster = fat32_allocate_clusters(parent->fs, 1);
-        if(dir_cluster == 0) return ret_node;
-
-        ret_node = fat32_mkdir(parent, name, dir_cluster, FAT_ATTR_DIRECTORY);
+        if(dir_cluster != 0)
+            node = fat32_mkdir(parent, name, dir_cluster, FAT_ATTR_DIRECTORY);
     }
+    rwlock_write_unlock(&fs_lock);
 
-    return ret_node;
+    return node;
 }
 
 // make an empty file in parent node
@@ -86,25 +107,25 @@ fs_node_t fs_touch(fs_node_t* parent, char* name) {
     fs_node_t node;
     node.valid = false;
 
+    rwlock_write_lock(&fs_lock);
     if(parent->fs->type == FS_FAT32) {
         uint32_t file_cluster = fat32_allocate_clusters(parent->fs, 1);
-        if(file_cluster == 0) return node;
-        node = fat32_add_entry(parent, name, file_cluster, 0, 0);
+        if(file_cluster != 0)
+            node = fat32_add_entry(parent, name, file_cluster, 0, 0);
     }
+    rwlock_write_unlock(&fs_lock);
 
     return node;
 }
 
-// remove a node
-FS_ERR fs_rm(fs_node_t* node, fs_node_t delete_node) {
+static FS_ERR rm(fs_node_t* node, fs_node_t delete_node) {
     if(node->fs->type == FS_FAT32)
         return fat32_remove_entry(node, delete_node, true);
 
     return ERR_FS_UNKNOWN_FS;
 }
 
-// remove a directory or a file and its content recursively if is a directory
-FS_ERR fs_rm_recursive(fs_node_t* parent, fs_node_t delete_node) {
+static FS_ERR rm_recursive(fs_node_t* parent, fs_node_t delete_node) {
     if(delete_node.isdir) {
         // try remove its content recursively
         if(parent->fs->type == FS_FAT32) {
@@ -117,12 +138,28 @@ FS_ERR fs_rm_recursive(fs_node_t* parent, fs_node_t delete_node) {
     }
 
     // now try remove it. it should success
-    return fs_rm(parent, delete_node);
+    return rm(parent, delete_node);
 }
 
-// move a node to new parent
-// set new_name to NULL to reuse the old name
-FS_ERR fs_move(fs_node_t* node, fs_node_t* new_parent, char* new_name) {
+// remove a node
+FS_ERR fs_rm(fs_node_t* node, fs_node_t delete_node) {
+    rwlock_write_lock(&fs_lock);
+    FS_ERR err = rm(node, delete_node);
+    rwlock_write_unlock(&fs_lock);
+
+    return err;
+}
+
+// remove a directory or a file and its content recursively if is a directory
+FS_ERR fs_rm_recursive(fs_node_t* parent, fs_node_t delete_node) {
+    rwlock_write_lock(&fs_lock);
+    FS_ERR err = rm_recursive(parent, delete_node);
+    rwlock_write_unlock(&fs_lock);
+
+    return err;
+}
+
+static FS_ERR move(fs_node_t* node, fs_node_t* new_parent, char* new_name) {
     fs_node_t copied;
 
     if(new_parent->fs->type == FS_FAT32)
@@ -143,7 +180,17 @@ FS_ERR fs_move(fs_node_t* node, fs_node_t* new_parent, char* new_name) {
     return ERR_FS_SUCCESS;
 }
 
-FS_ERR fs_copy(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name) {
+// move a node to new parent
+// set new_name to NULL to reuse the old name
+FS_ERR fs_move(fs_node_t* node, fs_node_t* new_parent, char* new_name) {
+    rwlock_write_lock(&fs_lock);
+    FS_ERR err = move(node, new_parent, new_name);
+    rwlock_write_unlock(&fs_lock);
+
+    return err;
+}
+
+static FS_ERR copy(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name) {
     if(new_parent->fs->type == FS_FAT32) {
         uint32_t start_cluster = fat32_copy_cluster_chain(new_parent->fs, node->start_cluster);
         if(start_cluster == 0) return ERR_FS_FAILED;
@@ -158,8 +205,8 @@ FS_ERR fs_copy(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char*
     return ERR_FS_SUCCESS;
 }
 
-FS_ERR fs_copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name) {
-    if(!node->isdir) return fs_copy(node, new_parent, copied, new_name);
+static FS_ERR copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name) {
+    if(!node->isdir) return copy(node, new_parent, copied, new_name);
 
     // the node we need to copy is a directory at this point
 
@@ -188,6 +235,22 @@ FS_ERR fs_copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copi
     return ERR_FS_SUCCESS;
 }
 
+FS_ERR fs_copy(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name) {
+    rwlock_write_lock(&fs_lock);
+    FS_ERR err = copy(node, new_parent, copied, new_name);
+    rwlock_write_unlock(&fs_lock);
+
+    return err;
+}
+
+FS_ERR fs_copy_recursive(fs_node_t* node, fs_node_t* new_parent, fs_node_t* copied, char* new_name) {
+    rwlock_write_lock(&fs_lock);
+    FS_ERR err = copy_recursive(node, new_parent, copied, new_name);
+    rwlock_write_unlock(&fs_lock);
+
+    return err;
+}
+
 FILE file_open(fs_node_t* node, int mode) {
     FILE file;
     file.valid = false;
@@ -207,7 +270,9 @@ FILE file_open(fs_node_t* node, int mode) {
         case FILE_APPEND:
             file.valid = true;
             file.position = node->size;
+            rwlock_read_lock(&fs_lock);
             file.current_cluster = fat32_get_last_cluster_of_chain(node->fs, node->start_cluster);
+            rwlock_read_unlock(&fs_lock);
             break;
     }
 
@@ -217,7 +282,7 @@ FILE file_open(fs_node_t* node, int mode) {
     return file;
 }
 
-FS_ERR file_write(FILE* file, uint8_t* data, size_t size) {
+static FS_ERR write(FILE* file, uint8_t* data, size_t size) {
     if(file->mode == FILE_READ) return ERR_FS_FAILED;
 
     if(file->node->fs->type == FS_FAT32) {
@@ -250,7 +315,7 @@ FS_ERR file_write(FILE* file, uint8_t* data, size_t size) {
     return ERR_FS_SUCCESS;
 }
 
-FS_ERR file_read(FILE* file, uint8_t* buffer, size_t size) {
+static FS_ERR read(FILE* file, uint8_t* buffer, size_t size) {
     if(file->mode != FILE_READ) return ERR_FS_FAILED;
 
     if(file->position == file->node->size) return ERR_FS_EOF;
@@ -274,14 +339,54 @@ FS_ERR file_read(FILE* file, uint8_t* buffer, size_t size) {
     file->position += size;
     if(file->position > file->node->size) file->position = file->node->size;
     return ERR_FS_SUCCESS;
+}
 
+FS_ERR file_write(FILE* file, uint8_t* data, size_t size) {
+    rwlock_write_lock(&fs_lock);
+    FS_ERR err = write(file, data, size);
+    rwlock_write_unlock(&fs_lock);
+
+    return err;
+}
+
+FS_ERR file_read(FILE* file, uint8_t* buffer, size_t size) {
+    rwlock_read_lock(&fs_lock);
+    FS_ERR err = read(file, buffer, size);
+    rwlock_read_unlock(&fs_lock);
+
+    return err;
+}
+
+// read from any position of a file without going through it from the start
+// size is cut down to what is left in the file
+FS_ERR file_read_at(fs_node_t* node, uint32_t offset, uint8_t* buffer, size_t size) {
+    if(offset >= node->size) return ERR_FS_EOF;
+    if(size > node->size - offset) size = node->size - offset;
+
+    FS_ERR err;
+    rwlock_read_lock(&fs_lock);
+    if(node->fs->type == FS_FAT32) {
+        uint32_t cluster = node->start_cluster;
+        err = fat32_read_file(node->fs, &cluster, buffer, size, offset);
+        // also returned when the last cluster is read to its end
+        if(err == ERR_FS_EOF) err = ERR_FS_SUCCESS;
+    }
+    else err = ERR_FS_UNKNOWN_FS;
+    rwlock_read_unlock(&fs_lock);
+
+    return err;
 }
 
 FS_ERR file_close(FILE* file) {
+    FS_ERR err = ERR_FS_SUCCESS;
+
+    rwlock_write_lock(&fs_lock);
     if(file->node->fs->type == FS_FAT32)
         fat32_update_entry(file->node);
-    else return ERR_FS_UNKNOWN_FS;
+    else err = ERR_FS_UNKNOWN_FS;
+    rwlock_write_unlock(&fs_lock);
 
+    if(err) return err;
     file->valid = false;
     return ERR_FS_SUCCESS;
 }
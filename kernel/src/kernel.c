@@ -4,6 +4,7 @@
 #include "process.h"
 #include "syscall.h"
 #include "mem.h"
+#include "acpi.h"
 
 #include "video.h"
 #include "ata.h"
@@ -11,6 +12,8 @@
 #include "timer.h"
 #include "filesystem.h"
 #include "locale.h"
+#include "serial.h"
+#include "console.h"
 
 #include "stdio.h"
 #include "stdlib.h"
@@ -64,6 +67,7 @@ void mem_init(void* mmap_addr, uint32_t mmap_length) {
     pmmngr_update_usage(); // always run this after init and deinit regions
 
     vmmngr_init();
+    zero_pool_init();
 }
 
 void video_init(multiboot_info_t* mbd) {
@@ -72,6 +76,7 @@ void video_init(multiboot_info_t* mbd) {
     unsigned video_height = 0;
     unsigned video_pitch = 0;
     unsigned video_bpp = 0;
+    video_pixel_format_t video_format;
 
     bool using_framebuffer = false;
     if(mbd->flags & MULTIBOOT_INFO_FRAMEBUFFER_INFO) {
@@ -89,7 +94,12 @@ void video_init(multiboot_info_t* mbd) {
                 break;
             case MULTIBOOT_FRAMEBUFFER_TYPE_RGB:
                 using_framebuffer = true;
-                // TODO: do sth with framebuffer color_info
+                video_format.red_position = mbd->framebuffer_red_field_position;
+                video_format.red_size = mbd->framebuffer_red_mask_size;
+                video_format.green_position = mbd->framebuffer_green_field_position;
+                video_format.green_size = mbd->framebuffer_green_mask_size;
+                video_format.blue_position = mbd->framebuffer_blue_field_position;
+                video_format.blue_size = mbd->framebuffer_blue_mask_size;
                 break;
             case MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT:
                 using_framebuffer = false;
@@ -106,14 +116,44 @@ void video_init(multiboot_info_t* mbd) {
     }
 
     // map video ptr
-    for(unsigned i = 0; i < video_height * video_pitch; i += MMNGR_PAGE_SIZE)
-        vmmngr_map(NULL, video_addr + i, VIDEO_START + i, PTE_WRITABLE);
+    // a mode that does not fit the window is cut to the rows that do
+    if(using_framebuffer && video_height * video_pitch > VIDEO_MAX_SIZE) {
+        print_debug(LT_WN, "%ux%u video mode is too big, only %u rows are used\n", video_width, video_height, VIDEO_MAX_SIZE / video_pitch);
+        video_height = VIDEO_MAX_SIZE / video_pitch;
+    }
+
+    // a framebuffer gets a whole 4MiB page if it is aligned, the video memory behind the screen is never smaller
+    size_t video_size = video_height * video_pitch;
+    if(!using_framebuffer) video_size = VIDEO_TEXTMODE_SIZE;
+    if(using_framebuffer && video_addr % MMNGR_LARGE_PAGE_SIZE == 0 && video_size < MMNGR_LARGE_PAGE_SIZE)
+        video_size = MMNGR_LARGE_PAGE_SIZE;
+    // let the cpu combine framebuffer writes into bursts instead of sending them to the bus one by one
+    // this is plain uncached if the cpu has no PAT
+    unsigned video_flags = PTE_WRITABLE;
+    if(using_framebuffer) video_flags |= PTE_WRITE_COMBINING;
+    if(vmmngr_map_range(NULL, video_addr, VIDEO_START, video_size, video_flags)) {
+        print_debug(LT_CR, "not enough memory to map the video memory\n");
+        kernel_panic(NULL);
+    }
     if(using_framebuffer) {
+        // draw into RAM and only write the changed parts to the screen, reading VRAM is very slow
+        // it is too big for the kernel heap so take the frames directly
+        void* backbuffer = NULL;
+        size_t backbuffer_size = video_height * video_pitch;
+        size_t backbuffer_pages = (backbuffer_size + MMNGR_PAGE_SIZE - 1) / MMNGR_PAGE_SIZE;
+        physical_addr_t backbuffer_phys = (physical_addr_t)pmmngr_alloc_multi_block(backbuffer_pages);
+        // if a page table can not be allocated the frames mapped so far are left unused, we are out of memory anyway
+        if(backbuffer_phys && !vmmngr_map_range(NULL, backbuffer_phys, VIDEO_BACKBUFFER_START, backbuffer_pages * MMNGR_PAGE_SIZE, PTE_WRITABLE))
+            backbuffer = (void*)VIDEO_BACKBUFFER_START;
+
         video_vesa_init(
             video_width, video_height,
-            video_pitch, video_bpp
+            video_pitch, video_bpp,
+            &video_format,
+            backbuffer
         );
         print_debug(LT_OK, "VESA video initialised\n");
+        if(!backbuffer) print_debug(LT_WN, "not enough memory for the video back buffer. drawing directly to the screen\n");
     }
     else {
         video_vga_init(video_width, video_height);
@@ -179,6 +219,10 @@ void kinit(multiboot_info_t* mbd) {
     extern char kernel_end;
     kernel_size = &kernel_end - &kernel_start;
 
+    // everything printed is copied to COM1 if there is one
+    bool serial_missing = serial_init();
+    if(!serial_missing) console_add_sink(serial_write, serial_flush);
+
     // greeting msg to let us know we are in the kernel
     // note that this will print into preinit video buffer
     // and will not drawn to screen until video is initialised
@@ -196,6 +240,9 @@ void kinit(multiboot_info_t* mbd) {
     // so those physical address of ELF section headers need to offset to KERNEL_START too
     mbd = (void*)mbd + KERNEL_START;
 
+    if(serial_missing) print_debug(LT_IF, "no serial port found\n");
+    else print_debug(LT_OK, "COM1 initialised\n");
+
     if(mbd->flags & MULTIBOOT_INFO_BOOT_LOADER_NAME)
         print_debug(LT_IF, "using %s bootloader\n", mbd->boot_loader_name + KERNEL_START);
 
@@ -205,14 +252,18 @@ void kinit(multiboot_info_t* mbd) {
     if(!(mbd->flags & MULTIBOOT_INFO_MEM_MAP)) kernel_panic(NULL);
     mem_init((void*)mbd->mmap_addr + KERNEL_START, mbd->mmap_length);
 
-    video_init(mbd);
-
     if(kheap_init()) {
         print_debug(LT_ER, "failed to initialise kernel heap. not enough memory\n");
         kernel_panic(NULL);
     }
     print_debug(LT_OK, "kernel heap initialised\n");
 
+    // the console text is kept on the heap
+    video_init(mbd);
+
+    if(acpi_init()) print_debug(LT_WN, "no ACPI or MP tables found. only the BSP will be used\n");
+    else print_debug(LT_OK, "found %d cpu(s)\n", smp_get_cpu_count());
+
     // if(mbd->flags & MULTIBOOT_INFO_AOUT_SYMS) {
     //     aout_sym = mbd->u.aout_sym;
     // }
@@ -252,6 +303,9 @@ void kinit(multiboot_info_t* mbd) {
     isr_init();
     print_debug(LT_OK, "ISR initialised\n");
 
+    simd_init();
+    if(simd_available()) print_debug(LT_OK, "SSE2 enabled\n");
+
     uint32_t esp = 0; asm volatile("mov %%esp, %%eax" : "=a" (esp));
     tss_set_stack(esp);
     print_debug(LT_OK, "TSS installed\n");
@@ -271,6 +325,8 @@ void kinit(multiboot_info_t* mbd) {
     timer_init();
     print_debug(LT_OK, "timer initialised\n");
 
+    serial_init_irq();
+
     // add kernel process
     // there must be at least one process in the scheduler
     kernel_process = process_new((uint32_t)kmain, 0, false);
@@ -279,11 +335,20 @@ void kinit(multiboot_info_t* mbd) {
         kernel_panic(NULL);
     }
     print_debug(LT_IF, "created kernel main process\n");
-    scheduler_init(kernel_process);
+    if(scheduler_init(kernel_process)) {
+        print_debug(LT_CR, "failed to initialise scheduler. not enough memory\n");
+        kernel_panic(NULL);
+    }
     print_debug(LT_OK, "scheduler initialised\n");
 
+    if(process_init_reaper(kernel_process)) print_debug(LT_WN, "failed to start the reaper thread. processes will be freed by the scheduler\n");
+    if(klog_init_thread(kernel_process)) print_debug(LT_WN, "failed to start the log thread. messages will be printed right away\n");
+
+    if(smp_init()) print_debug(LT_WN, "APIC is not available. fall back to the PIC\n");
+    else print_debug(LT_OK, "SMP initialised, %d cpu(s) online\n", smp_get_online_count());
+
     // start interrupts again after setting up everything
-    // this will also start the scheduler and cause a process switch to kmain
+    // this will also start the scheduler and cause a thread switch to kmain
     asm volatile("sti");
 
     // wait for process switch
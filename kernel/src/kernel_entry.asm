@@ -99,7 +99,7 @@ kernel_entry:
     loop .loop_kernel1
 
     ; map kernel_pd_virt using the final entry
-    ; this will be mapped to 0xc03ff000 (VMMNGR_PD)
+    ; this will be mapped to 0xc03ff000
     mov eax, kernel_pd_virt - KERNEL_START
     ; FIXME: kernel is temporary accessible to user (flag 0b111)
     or eax, 0b111
@@ -110,8 +110,9 @@ kernel_entry:
     mov cr3, eax
 
     ; enable paging
+    ; WP makes the kernel fault on read-only pages too, needed by copy-on-write
     mov eax, cr0
-    or eax, 0x80000000
+    or eax, 0x80010000
     mov cr0, eax
 
     ; now jump
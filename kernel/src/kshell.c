@@ -7,6 +7,7 @@
 #include "filesystem.h"
 #include "pit.h"
 #include "process.h"
+#include "debug.h"
 
 #include "string.h"
 #include "stdio.h"
@@ -15,6 +16,8 @@
 #include "time.h"
 
 #define MAX_INPUT 1024
+// threads shown per queue by catproc
+#define CATPROC_MAX_THREADS 64
 
 typedef enum {
     ERR_SHELL_SUCCESS,
@@ -107,7 +110,7 @@ static int path_find_last_node(char* path, fs_node_t* parent, fs_node_t* node) {
 
 static void help(char* arg) {
     if(arg == NULL) {
-        puts("help clear . echo clocks ls read cd mkdir rm touch write mv cp stat pwd datetime beep draw panic catproc sleep exit");
+        puts("help clear . echo clocks ls read cd mkdir rm touch write mv cp stat pwd datetime beep draw panic catproc lockstat dmesg sleep exec exit");
     }
     else {
         arg = strtok(arg, " ");
@@ -144,13 +147,19 @@ static void help(char* arg) {
                 "available mode:\n"
                 "    line  <arg> = x0 y0 x1 y1 color\n"
                 "    rect  <arg> = x0 y0 x1 y1 color\n"
-                "    circ  <arg> = x y r color"
+                "    box   <arg> = x0 y0 x1 y1 color\n"
+                "    circ  <arg> = x y r color\n"
+                "    fcirc <arg> = x y r color\n"
+                "    tri   <arg> = x0 y0 x1 y1 x2 y2 color"
             );
         }
         else if(strcmp(arg, "panic")) puts("causes the kernel to panic\npanic <no-args>");
-        else if(strcmp(arg, "catproc")) puts("print all processes and their info\ncatproc <no-args>");
+        else if(strcmp(arg, "catproc")) puts("print all threads and their info\ncatproc <no-args>");
+        else if(strcmp(arg, "lockstat")) puts("print lock contention statistics\nlockstat <no-args>");
+        else if(strcmp(arg, "dmesg")) puts("print the kernel log with the tick of each message\ndmesg <no-args>");
         else if(strcmp(arg, "sleep")) puts("halt for an ammount of time\nsleep <ticks>");
         else if(strcmp(arg, "loadfont")) puts("load new font\nloadfont <psf-file>");
+        else if(strcmp(arg, "exec")) puts("run an ELF executable in a new process\nexec <elf-file>");
         else if(strcmp(arg, "exit")) puts("quit shell and continue to usermode\nexit <no-arg>");
     }
 }
@@ -821,7 +830,7 @@ static void draw(char* arg) {
 
         video_vesa_draw_line(x0, y0, x1, y1, color);
     }
-    else if(strcmp(mode, "rect")) {
+    else if(strcmp(mode, "rect") || strcmp(mode, "box")) {
         char* x0_str = strtok(NULL, " ");
         char* y0_str = strtok(NULL, " ");
         char* x1_str = strtok(NULL, " ");
@@ -864,9 +873,10 @@ static void draw(char* arg) {
         x1 = atoi(x1_str);
         y1 = atoi(y1_str);
 
-        video_vesa_fill_rectangle(x0, y0, x1, y1, color);
+        if(strcmp(mode, "rect")) video_vesa_fill_rectangle(x0, y0, x1, y1, color);
+        else video_vesa_draw_rectangle(x0, y0, x1, y1, color, -1);
     }
-    else if(strcmp(mode, "circ")) {
+    else if(strcmp(mode, "circ") || strcmp(mode, "fcirc")) {
         char* x_str = strtok(NULL, " ");
         char* y_str = strtok(NULL, " ");
         char* r_str = strtok(NULL, " ");
@@ -903,7 +913,39 @@ static void draw(char* arg) {
         y = atoi(y_str);
         r = atoi(r_str);
 
-        video_vesa_draw_circle(x, y, r, color);
+        if(strcmp(mode, "circ")) video_vesa_draw_circle(x, y, r, color);
+        else video_vesa_fill_circle(x, y, r, color);
+    }
+    else if(strcmp(mode, "tri")) {
+        char* str[6];
+        int p[6];
+        const char* names[6] = {"x0", "y0", "x1", "y1", "x2", "y2"};
+        for(int i = 0; i < 6; i++) str[i] = strtok(NULL, " ");
+        char* color_str = strtok(NULL, " ");
+
+        int color;
+
+        for(int i = 0; i < 6; i++) {
+            if(str[i] == NULL) {
+                printf("no %s provided\n", names[i]);
+                return;
+            }
+            p[i] = atoi(str[i]);
+        }
+
+        if(color_str == NULL) color = video_vesa_rgb(255, 255, 255);
+        else {
+            int r, g, b;
+            _color(color_str, &r, &g, &b);
+            if(b == -1) {
+                puts("color not provided");
+                return;
+            }
+
+            color = video_vesa_rgb(r, g, b);
+        }
+
+        video_vesa_fill_triangle(p[0], p[1], p[2], p[3], p[4], p[5], color);
     }
     else {
         puts("mode not recognised");
@@ -915,40 +957,74 @@ static void panic(char* arg) {
    kernel_panic(NULL);
 }
 
-static void print_proc(process_t* proc) {
-    if(!proc) return;
+static void print_thread(const thread_info_t* thread) {
     printf(
-        "process %d:\n"
+        "thread %d of process %d:\n"
         "    priority: %d\n"
         "    state: %s\n"
-        "    alive ticks: %d\n"
+        "    alive ticks: %llu\n"
         ,
-        proc->id, proc->priority,
-        proc->state == PROCESS_STATE_ACTIVE ? "active" : 
-        proc->state == PROCESS_STATE_READY ? "ready" : "sleep",
-        proc->alive_ticks
+        thread->id, thread->process_id, thread->priority,
+        thread->state == THREAD_STATE_ACTIVE ? "active" : 
+        thread->state == THREAD_STATE_READY ? "ready" : "sleep",
+        thread->alive_ticks
     );
 
-    if(proc->state == PROCESS_STATE_SLEEP)
-        printf("    sleep ticks: %d\n", proc->sleep_ticks);
+    if(thread->state == THREAD_STATE_SLEEP)
+        printf("    sleep ticks: %llu\n", thread->sleep_ticks);
 }
 static void catproc(char* arg) {
     (void)(arg);
 
-    // print all processes
+    // print all threads
+    // the scheduler hands out copies since a thread can be freed at any time
+    thread_info_t* infos = kmalloc(sizeof(thread_info_t) * CATPROC_MAX_THREADS);
+    if(!infos) {
+        puts("not enough memory");
+        return;
+    }
 
-    print_proc(scheduler_get_current_process());
+    for(unsigned cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
+        unsigned count = scheduler_get_cpu_threads(cpu, infos, CATPROC_MAX_THREADS);
+        if(!count) continue;
 
-    process_t* proc = scheduler_get_ready_processes();
-    while(proc) {
-        print_proc(proc);
-        proc = proc->next;
+        printf("cpu %d:\n", cpu);
+        for(unsigned i = 0; i < count; i++)
+            print_thread(&infos[i]);
     }
 
-    proc = scheduler_get_sleep_processes();
-    while(proc) {
-        print_proc(proc);
-        proc = proc->next;
+    unsigned count = scheduler_get_sleep_threads(infos, CATPROC_MAX_THREADS);
+    for(unsigned i = 0; i < count; i++)
+        print_thread(&infos[i]);
+
+    kfree(infos);
+}
+
+static void dmesg(char* arg) {
+    (void)(arg);
+    klog_dump();
+}
+
+static void lockstat(char* arg) {
+    (void)(arg);
+
+    if(!LOCK_STATS) {
+        puts("lock statistics are disabled, rebuild with LOCK_STATS=1");
+        return;
+    }
+
+    lock_stats_t* stats = lock_stats_get_list();
+    while(stats) {
+        printf(
+            "%s\n"
+            "    acquisitions: %u, contended: %u, spins: %u\n"
+            "    max hold time: %u cycles\n"
+            ,
+            stats->name,
+            (unsigned)stats->acquisitions, (unsigned)stats->contended, (unsigned)stats->spins,
+            (unsigned)stats->max_hold_time
+        );
+        stats = stats->next;
     }
 }
 
@@ -1017,6 +1093,44 @@ static void loadfont(char* path) {
     current_font = new_font;
 }
 
+static void exec(char* path) {
+    fs_node_t* current_node = node_stack_top();
+    if(!current_node->valid) {
+        puts("no fs installed");
+        return;
+    }
+
+    if(path == NULL) {
+        puts("no file input");
+        return;
+    }
+
+    path = strtok(path, " ");
+
+    fs_node_t node_parent;
+    fs_node_t node;
+    SHELL_ERR err = path_find_last_node(path, &node_parent, &node);
+    if(err == ERR_SHELL_NOT_FOUND || err == ERR_SHELL_NOT_A_DIR) {
+        printf("no such directory '%s'\n", node.name);
+        return;
+    }
+    if(err == ERR_SHELL_TARGET_NOT_FOUND || node.isdir) {
+        printf("no such file '%s'\n", node.name);
+        return;
+    }
+
+    process_t* proc = process_exec(&node, 0);
+    if(!proc) {
+        printf("cannot execute '%s'\n", node.name);
+        return;
+    }
+
+    // the process may exit and be freed as soon as it is added
+    int id = proc->id;
+    scheduler_add_process(proc);
+    printf("started process %d\n", id);
+}
+
 static void exit(char* arg) {
     (void)(arg);
 
@@ -1054,7 +1168,10 @@ void shell_process_prompt(char* prompts, unsigned prompts_len) {
         else if(strcmp(cmd_name, "draw")) draw(remain_arg);
         else if(strcmp(cmd_name, "panic")) panic(remain_arg);
         else if(strcmp(cmd_name, "catproc")) catproc(remain_arg);
+        else if(strcmp(cmd_name, "lockstat")) lockstat(remain_arg);
+        else if(strcmp(cmd_name, "dmesg")) dmesg(remain_arg);
         else if(strcmp(cmd_name, "loadfont")) loadfont(remain_arg);
+        else if(strcmp(cmd_name, "exec")) exec(remain_arg);
         else if(strcmp(cmd_name, "sleep")) sleep(remain_arg);
         else if(strcmp(cmd_name, "exit")) exit(remain_arg);
         else if(prompt_len == 0); // just skip
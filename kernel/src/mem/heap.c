@@ -10,13 +10,18 @@
 
 heap_t* heap_new(uint32_t start, uint32_t size, size_t max_size, uint8_t flags) {
     // map heap
-    physical_addr_t phys = (physical_addr_t)pmmngr_alloc_multi_block(size / MMNGR_PAGE_SIZE);
+    // a lazy heap only needs the page holding the heap info and the first header
+    uint32_t mapped_size = (flags & HEAP_LAZY) ? MMNGR_PAGE_SIZE : size;
+    physical_addr_t phys = 0;
+    // whole 4MiB blocks can be mapped with large pages, heap_contract never goes below this size
+    if(mapped_size % MMNGR_LARGE_PAGE_SIZE == 0 && start % MMNGR_LARGE_PAGE_SIZE == 0)
+        phys = (physical_addr_t)pmmngr_alloc_large_blocks(mapped_size / MMNGR_LARGE_PAGE_SIZE);
+    if(!phys) phys = (physical_addr_t)pmmngr_alloc_multi_block(mapped_size / MMNGR_PAGE_SIZE);
     if(!phys) return 0;
     int f = PTE_PRESENT;
     if(!(flags & HEAP_SUPERVISOR)) f |= PTE_USER;
     if(!(flags & HEAP_READONLY)) f |= PTE_WRITABLE;
-    for(unsigned i = 0; i < size; i += MMNGR_PAGE_SIZE)
-        vmmngr_map(NULL, phys + i, start + i, f);
+    vmmngr_map_range(NULL, phys, start, mapped_size, f);
 
     heap_t* heap = (heap_t*)start;
     heap->end = start + size;
@@ -36,14 +41,15 @@ heap_t* heap_new(uint32_t start, uint32_t size, size_t max_size, uint8_t flags)
 bool heap_expand(heap_t* heap, size_t page_count, heap_header_t* last_header) {
     if(heap->end + page_count * MMNGR_PAGE_SIZE > heap->max_addr) return true;
 
-    physical_addr_t new_page = (physical_addr_t)pmmngr_alloc_multi_block(page_count);
-    if(!new_page) return true;
+    if(!(heap->flags & HEAP_LAZY)) {
+        physical_addr_t new_page = (physical_addr_t)pmmngr_alloc_multi_block(page_count);
+        if(!new_page) return true;
 
-    int flags = PTE_PRESENT;
-    if(!(heap->flags & HEAP_SUPERVISOR)) flags |= PTE_USER;
-    if(!(heap->flags & HEAP_READONLY)) flags |= PTE_WRITABLE;
-    for(unsigned i = 0; i < page_count; i++)
-        vmmngr_map(NULL, new_page + i * MMNGR_PAGE_SIZE, heap->end + i * MMNGR_PAGE_SIZE, flags);
+        int flags = PTE_PRESENT;
+        if(!(heap->flags & HEAP_SUPERVISOR)) flags |= PTE_USER;
+        if(!(heap->flags & HEAP_READONLY)) flags |= PTE_WRITABLE;
+        vmmngr_map_range(NULL, new_page, heap->end, page_count * MMNGR_PAGE_SIZE, flags);
+    }
 
     // assume that last_header is valid
 
@@ -73,11 +79,8 @@ void heap_contract(heap_t* heap, size_t page_count, heap_header_t* last_header)
     }
 
     last_header->size -= page_count * MMNGR_PAGE_SIZE;
-    while(page_count > 0) {
-        heap->end -= MMNGR_PAGE_SIZE;
-        vmmngr_unmap(NULL, heap->end);
-        page_count--;
-    }
+    heap->end -= page_count * MMNGR_PAGE_SIZE;
+    vmmngr_unmap_range(NULL, heap->end, page_count * MMNGR_PAGE_SIZE);
 }
 
 void* heap_alloc(heap_t* heap, size_t size, bool page_align) {
@@ -1,6 +1,10 @@
 #include "mem.h"
+#include "system.h"
 
 static heap_t* kheap;
+// kernel processes on every cpu share the same heap
+static mcslock_t kheap_lock = MCSLOCK_INIT;
+static lock_stats_t kheap_lock_stats;
 
 bool kheap_init() {
     kheap = heap_new(
@@ -11,13 +15,29 @@ bool kheap_init() {
     );
 
     if(!kheap) return true;
+
+    lock_stats_register(&kheap_lock_stats, "kheap");
+    kheap_lock.stats = &kheap_lock_stats;
+
     return false;
 }
 
 void* kmalloc(size_t size) {
-    return heap_alloc(kheap, size, false);
+    mcs_node_t node;
+    uint32_t eflags = mcslock_acquire_irqsave(&kheap_lock, &node);
+
+    void* ret = heap_alloc(kheap, size, false);
+
+    mcslock_release_irqrestore(&kheap_lock, &node, eflags);
+
+    return ret;
 }
 
 void kfree(void* addr) {
+    mcs_node_t node;
+    uint32_t eflags = mcslock_acquire_irqsave(&kheap_lock, &node);
+
     heap_free(kheap, addr);
+
+    mcslock_release_irqrestore(&kheap_lock, &node, eflags);
 }
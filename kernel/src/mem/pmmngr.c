@@ -1,10 +1,19 @@
 #include "mem.h"
+#include "system.h"
 
 // bitmap, the length is hardcoded because memory size will not exceed 3GiB
 static uint32_t bitmap[24576]; // 3GiB * 1024*1024*1024 / 4096(block size) / 32 (size of uint32_t)
 static size_t used_block;
 static size_t total_block;
 
+// how many more times a block is mapped besides its first owner, used by copy-on-write
+// a block is only freed once this drops to 0
+static uint8_t refcount[786432]; // 3GiB / 4096(block size)
+
+// the bitmap is shared by all cpus
+static mcslock_t bitmap_lock = MCSLOCK_INIT;
+static lock_stats_t bitmap_lock_stats;
+
 static void set_bit(uint32_t bit) {
     bitmap[bit/32] |= (1 << (bit % 32));
 }
@@ -93,38 +102,58 @@ void pmmngr_deinit_region(physical_addr_t base, size_t size) {
 }
 
 void* pmmngr_alloc_block() {
-    if(total_block == used_block) return NULL;
-    int frame = find_first_free_block();
-    if(frame == -1) return NULL;
-
-    set_bit(frame);
-
-    physical_addr_t base = frame * MMNGR_PAGE_SIZE;
-    used_block++;
-
-    return (void*)base;
+    return pmmngr_alloc_multi_block(1);
 }
 void* pmmngr_alloc_multi_block(size_t cnt) {
-    if(used_block + cnt > total_block) return NULL;
-    int frame = find_first_free(cnt);
-    if(frame == -1) return NULL;
-
-    for(uint32_t i = 0; i < cnt; i++)
-        set_bit(frame + i);
+    mcs_node_t node;
+    uint32_t eflags = mcslock_acquire_irqsave(&bitmap_lock, &node);
+
+    int frame = -1;
+    if(used_block + cnt <= total_block) frame = find_first_free(cnt);
+    if(frame != -1) {
+        for(uint32_t i = 0; i < cnt; i++)
+            set_bit(frame + i);
+        used_block += cnt;
+    }
 
-    physical_addr_t addr = frame * MMNGR_PAGE_SIZE;
-    used_block += cnt;
+    mcslock_release_irqrestore(&bitmap_lock, &node, eflags);
 
-    return (void*)addr;
+    if(frame == -1) return NULL;
+    return (void*)(frame * MMNGR_PAGE_SIZE);
 }
-void pmmngr_free_block(void* base) {
-    physical_addr_t addr = (physical_addr_t)base;
-    int frame = addr / MMNGR_PAGE_SIZE;
+// allocate cnt contiguous blocks of MMNGR_LARGE_PAGE_SIZE that can be mapped with 4MiB pages
+// return NULL if there is no such free range
+void* pmmngr_alloc_large_blocks(size_t cnt) {
+    // a large block is 32 whole words of the bitmap
+    const unsigned words = MMNGR_LARGE_PAGE_SIZE / MMNGR_PAGE_SIZE / 32;
+    if(cnt == 0) return NULL;
+
+    mcs_node_t node;
+    uint32_t eflags = mcslock_acquire_irqsave(&bitmap_lock, &node);
+
+    int frame = -1;
+    unsigned free_words = 0;
+    for(unsigned i = 0; i < total_block/32 && frame == -1; i++) {
+        // restart at every large page boundary that follows a used word
+        if(bitmap[i]) free_words = 0;
+        else if(free_words || i % words == 0) free_words++;
+
+        if(free_words == cnt * words) frame = (i + 1 - free_words) * 32;
+    }
+    if(frame != -1) {
+        for(unsigned i = 0; i < cnt * words; i++)
+            bitmap[frame / 32 + i] = 0xffffffff;
+        used_block += cnt * words * 32;
+    }
 
-    if(frame == 0) return;
+    mcslock_release_irqrestore(&bitmap_lock, &node, eflags);
+
+    if(frame == -1) return NULL;
+    return (void*)(frame * MMNGR_PAGE_SIZE);
+}
 
-    unset_bit(frame);
-    used_block--;
+void pmmngr_free_block(void* base) {
+    pmmngr_free_multi_block(base, 1);
 }
 void pmmngr_free_multi_block(void* base, size_t cnt) {
     physical_addr_t addr = (physical_addr_t)base;
@@ -132,9 +161,40 @@ void pmmngr_free_multi_block(void* base, size_t cnt) {
 
     if(frame == 0) return;
 
-    for(uint32_t i = 0; i < cnt; i++)
+    mcs_node_t node;
+    uint32_t eflags = mcslock_acquire_irqsave(&bitmap_lock, &node);
+
+    for(uint32_t i = 0; i < cnt; i++) {
+        // still mapped somewhere else
+        if(refcount[frame+i]) {
+            refcount[frame+i]--;
+            continue;
+        }
         unset_bit(frame+i);
-    used_block -= cnt;
+        used_block--;
+    }
+
+    mcslock_release_irqrestore(&bitmap_lock, &node, eflags);
+}
+
+// add a reference to a block, it then needs one more free to be released
+// return true if the block has too many references already
+bool pmmngr_ref_block(void* base) {
+    int frame = (physical_addr_t)base / MMNGR_PAGE_SIZE;
+
+    mcs_node_t node;
+    uint32_t eflags = mcslock_acquire_irqsave(&bitmap_lock, &node);
+
+    bool full = refcount[frame] == UINT8_MAX;
+    if(!full) refcount[frame]++;
+
+    mcslock_release_irqrestore(&bitmap_lock, &node, eflags);
+
+    return full;
+}
+
+bool pmmngr_is_shared(void* base) {
+    return refcount[(physical_addr_t)base / MMNGR_PAGE_SIZE] != 0;
 }
 
 void pmmngr_init(size_t size) {
@@ -144,4 +204,7 @@ void pmmngr_init(size_t size) {
     used_block = total_block;
     for(unsigned i = 0; i < total_block / 32; i++)
         bitmap[i] = 0xffffffff;
+
+    lock_stats_register(&bitmap_lock_stats, "pmmngr");
+    bitmap_lock.stats = &bitmap_lock_stats;
 }
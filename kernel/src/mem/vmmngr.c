@@ -1,8 +1,18 @@
 #include "mem.h"
+#include "system.h"
+#include "smp.h"
+#include "apic.h"
 
 #include "string.h"
 
 #define PAGE_FRAME_BITS 0x7ffff000
+#define LARGE_PAGE_FRAME_BITS 0xffc00000
+
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+
+#define MSR_PAT 0x277
+#define PAT_WRITE_COMBINING 0x01
 
 // our page table VIRTUAL address can be get by adding 0xffc00000 (4*1024*1024*1023)
 // with page directory index multiply by page size
@@ -12,7 +22,14 @@
 
 extern void* kernel_pd_virt;
 
-static page_directory_t* current_page_directory = 0;
+static page_directory_t* current_page_directory[MAX_CPU];
+// inventory of user page tables of the loaded page directory, NULL for the kernel's
+static uint32_t* current_page_tables[MAX_CPU];
+
+// whether the cpus support 4MiB pages, checked on the BSP
+static bool large_pages = false;
+// without PAT the PAT bits are reserved and must stay clear
+static bool pat_enabled = false;
 static page_directory_t* kernel_page_directory = (page_directory_t*)((unsigned)&kernel_pd_virt - KERNEL_START);
 
 static void page_entry_set_frame(uint32_t* pe, physical_addr_t addr) {
@@ -25,16 +42,63 @@ static void page_entry_del_attrib(uint32_t* pe, uint16_t attrib) {
     *pe &= ~(attrib & 0xfff);
 }
 
-static page_directory_t* mapped_temporal_pd = 0;
-static void map_temporary_pd(page_directory_t* pd) {
-    if(pd == mapped_temporal_pd) return;
-    mapped_temporal_pd = pd;
+static MEM_ERR map_page(page_directory_t* virt_pd, physical_addr_t phys, virtual_addr_t virt, unsigned flags);
+
+// ranges longer than this many pages are flushed with a whole tlb flush instead of invlpg
+#define TLB_FLUSH_THRESHOLD 32
+// frames given back at once by vmmngr_unmap_range
+#define UNMAP_BATCH_SIZE 128
+
+// frames unmapped while other cpus may still have them in their tlb, see vmmngr_unmap_range()
+#define DEFERRED_FRAME_COUNT 4096
+
+typedef struct {
+    physical_addr_t frame;
+    unsigned epoch;
+    unsigned cpu;
+} deferred_frame_t;
+
+static deferred_frame_t deferred_frames[DEFERRED_FRAME_COUNT];
+static unsigned deferred_head = 0;
+static unsigned deferred_count = 0;
+// also serialises the senders of shootdowns
+static ticketlock_t deferred_lock = TICKETLOCK_INIT;
+static lock_stats_t deferred_lock_stats;
+
+// incremented by each shootdown, each cpu records the last one it has flushed for
+static atomic_uint shootdown_epoch = 0;
+static atomic_uint flushed_epoch[MAX_CPU];
+
+static void set_table_bit(uint32_t* page_tables, unsigned idx) {
+    // threads of the same process may create tables on different cpus at once
+    __atomic_fetch_or(&page_tables[idx / 32], 1u << (idx % 32), __ATOMIC_RELAXED);
+}
+
+// VMMNGR_RESERVED is shared by all cpus so only one of them can use it at a time
+static ticketlock_t temporary_pd_lock = TICKETLOCK_INIT;
+static lock_stats_t temporary_pd_lock_stats;
+static uint32_t temporary_pd_eflags;
+
+// copy-on-write faults of threads of the same process must not copy a page twice
+static ticketlock_t cow_lock = TICKETLOCK_INIT;
+static lock_stats_t cow_lock_stats;
+
+static page_directory_t* map_temporary_pd(page_directory_t* pd) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&temporary_pd_lock);
+    temporary_pd_eflags = eflags;
+
+    // always remap and flush since other cpus may have used the window
+    map_page((page_directory_t*)VMMNGR_PD, (physical_addr_t)pd, VMMNGR_RESERVED, PTE_PRESENT | PTE_WRITABLE);
+
+    return (page_directory_t*)VMMNGR_RESERVED;
+}
 
-    vmmngr_map(NULL, (physical_addr_t)pd, VMMNGR_RESERVED, PTE_PRESENT | PTE_WRITABLE);
+static void unmap_temporary_pd() {
+    ticketlock_release_irqrestore(&temporary_pd_lock, temporary_pd_eflags);
 }
 
 page_directory_t* vmmngr_get_page_directory() {
-    return current_page_directory;
+    return current_page_directory[smp_get_cpu_id()];
 }
 
 page_directory_t* vmmngr_get_kernel_page_directory() {
@@ -44,48 +108,70 @@ page_directory_t* vmmngr_get_kernel_page_directory() {
 physical_addr_t vmmngr_to_physical_addr(page_directory_t* page_directory, virtual_addr_t virt) {
     page_directory_t* virt_pd;
     if(page_directory == NULL) virt_pd = (page_directory_t*)VMMNGR_PD;
-    else {
-        map_temporary_pd(page_directory);
-        virt_pd = (page_directory_t*)VMMNGR_RESERVED;
-    }
+    else virt_pd = map_temporary_pd(page_directory);
 
+    physical_addr_t phys = 0;
     pde_t* pde = PAGE_DIRECTORY_LOOKUP(virt_pd, virt);
-    if(!(*pde & PDE_PRESENT)) return 0;
-
-    page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
-    pte_t* pte = PAGE_TABLE_LOOKUP(table, virt);
-    if(!(*pte & PTE_PRESENT)) return 0;
+    if((*pde & PDE_PRESENT) && (*pde & PDE_4MB))
+        phys = (*pde & LARGE_PAGE_FRAME_BITS) + (virt & (MMNGR_LARGE_PAGE_SIZE - 1));
+    else if(*pde & PDE_PRESENT) {
+        page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
+        pte_t* pte = PAGE_TABLE_LOOKUP(table, virt);
+        if(*pte & PTE_PRESENT) phys = (physical_addr_t)(*pte & PAGE_FRAME_BITS);
+    }
 
-    return (physical_addr_t)(*pte & PAGE_FRAME_BITS);
+    if(page_directory) unmap_temporary_pd();
+    return phys;
 }
 
-MEM_ERR vmmngr_map(page_directory_t* page_directory, physical_addr_t phys, virtual_addr_t virt, unsigned flags) {
-    page_directory_t* virt_pd;
-    if(page_directory == NULL) virt_pd = (page_directory_t*)VMMNGR_PD;
-    else {
-        map_temporary_pd(page_directory);
-        virt_pd = (page_directory_t*)VMMNGR_RESERVED;
-    }
+// return true if virt is mapped in the current address space as a page usermode can write to
+bool vmmngr_is_user_writable(virtual_addr_t virt) {
+    pde_t* pde = PAGE_DIRECTORY_LOOKUP((page_directory_t*)VMMNGR_PD, virt);
+    if(!(*pde & PDE_PRESENT) || !(*pde & PDE_USER) || !(*pde & PDE_WRITABLE)) return false;
+    if(*pde & PDE_4MB) return true;
+
+    page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
+    pte_t pte = *PAGE_TABLE_LOOKUP(table, virt);
+    return (pte & PTE_PRESENT) && (pte & PTE_USER) && (pte & PTE_WRITABLE);
+}
 
+// return the page table that maps virt in table, it is created if it does not exist
+// virt_pd must be the current page directory or the temporary one
+static MEM_ERR get_table(page_directory_t* virt_pd, virtual_addr_t virt, unsigned flags, page_table_t** table) {
     pde_t* pde = PAGE_DIRECTORY_LOOKUP(virt_pd, virt);
+    if((*pde & PDE_PRESENT) && (*pde & PDE_4MB)) return ERR_MEM_LARGE_PAGE;
 
-    bool new_table = false;
     // if the page table is not present then allocate it
+    // the frame comes zeroed, which also works when virt_pd is not the current page directory
     if(!(*pde & PDE_PRESENT)) {
-        physical_addr_t new_phys = (physical_addr_t)pmmngr_alloc_block();
+        physical_addr_t new_phys = (physical_addr_t)zero_pool_alloc();
         if(!new_phys) return ERR_MEM_OOM;
-        new_table = true;
 
         // create a new entry
-        page_entry_add_attrib(pde, flags | PDE_PRESENT); // the first few PDE and PTE flags are the same so we can do this
+        // the table is shared by pages with different permissions, so let the PTEs decide
+        page_entry_add_attrib(pde, (flags & PDE_USER) | PDE_WRITABLE | PDE_PRESENT); // the first few PDE and PTE flags are the same so we can do this
         page_entry_set_frame(pde, new_phys);
+
+        // remember it so that vmmngr_free_page_directory does not have to search for it
+        unsigned idx = PAGE_DIRECTORY_INDEX((uint32_t)virt);
+        uint32_t* page_tables = current_page_tables[smp_get_cpu_id()];
+        if(virt_pd == (page_directory_t*)VMMNGR_PD && page_tables && idx < PAGE_DIRECTORY_INDEX(KERNEL_START))
+            set_table_bit(page_tables, idx);
     }
 
-    page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
+    *table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
+    return ERR_MEM_SUCCESS;
+}
 
-    // clear the table if we have just created it
-    if(new_table)
-        memset(table, 0, sizeof(page_table_t));
+static MEM_ERR map_page(page_directory_t* virt_pd, physical_addr_t phys, virtual_addr_t virt, unsigned flags) {
+    if(!pat_enabled) flags &= ~PTE_PAT;
+
+    page_table_t* table;
+    MEM_ERR err = get_table(virt_pd, virt, flags, &table);
+    if(err) return err;
+
+    // the kernel half is the same in every address space so it can survive cr3 reloads
+    if(virt >= KERNEL_START) flags |= PTE_CPU_GLOBAL;
 
     pte_t* pte = PAGE_TABLE_LOOKUP(table, virt);
     page_entry_add_attrib(pte, PTE_PRESENT | flags);
@@ -96,16 +182,18 @@ MEM_ERR vmmngr_map(page_directory_t* page_directory, physical_addr_t phys, virtu
     return ERR_MEM_SUCCESS;
 }
 
-void vmmngr_unmap(page_directory_t* page_directory, virtual_addr_t virt) {
-    page_directory_t* virt_pd;
-    if(page_directory == NULL) virt_pd = (page_directory_t*)VMMNGR_PD;
-    else {
-        map_temporary_pd(page_directory);
-        virt_pd = (page_directory_t*)VMMNGR_RESERVED;
-    }
+MEM_ERR vmmngr_map(page_directory_t* page_directory, physical_addr_t phys, virtual_addr_t virt, unsigned flags) {
+    if(page_directory == NULL) return map_page((page_directory_t*)VMMNGR_PD, phys, virt, flags);
+
+    MEM_ERR err = map_page(map_temporary_pd(page_directory), phys, virt, flags);
+    unmap_temporary_pd();
+    return err;
+}
 
+static void unmap_page(page_directory_t* virt_pd, virtual_addr_t virt) {
     pde_t* pde = PAGE_DIRECTORY_LOOKUP(virt_pd, virt);
-    if(!(*pde & PDE_PRESENT)) return;
+    // large pages only map devices and the kernel heap's first part, they stay
+    if(!(*pde & PDE_PRESENT) || (*pde & PDE_4MB)) return;
 
     page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
     pte_t* pte = PAGE_TABLE_LOOKUP(table, virt);
@@ -119,6 +207,244 @@ void vmmngr_unmap(page_directory_t* page_directory, virtual_addr_t virt) {
     vmmngr_flush_tlb_entry(virt);
 }
 
+void vmmngr_unmap(page_directory_t* page_directory, virtual_addr_t virt) {
+    if(page_directory == NULL) {
+        vmmngr_unmap_range(NULL, virt, MMNGR_PAGE_SIZE);
+        return;
+    }
+
+    unmap_page(map_temporary_pd(page_directory), virt);
+    unmap_temporary_pd();
+}
+
+// flush the whole tlb of this cpu, global pages too if asked
+static void flush_tlb(bool global) {
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r" (cr4));
+    if(global && (cr4 & CR4_PGE)) {
+        // turning PGE off and on again drops every entry
+        asm volatile("mov %0, %%cr4; mov %1, %%cr4" : : "r" (cr4 & ~CR4_PGE), "r" (cr4) : "memory");
+        return;
+    }
+
+    asm volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax", "memory");
+}
+
+// a few invlpg are cheaper than refilling the whole tlb, many are not
+static void flush_tlb_range(virtual_addr_t virt, size_t page_count) {
+    if(page_count > TLB_FLUSH_THRESHOLD) {
+        flush_tlb(virt + page_count * MMNGR_PAGE_SIZE > KERNEL_START);
+        return;
+    }
+
+    for(size_t i = 0; i < page_count; i++)
+        vmmngr_flush_tlb_entry(virt + i * MMNGR_PAGE_SIZE);
+}
+
+// whether other cpus may have entries of a range in their tlb
+// the kernel half is loaded everywhere, a user range only where its page directory is
+// the entries must be cleared before this is asked, see release_frames
+static bool needs_shootdown(bool kernel_range) {
+    if(!apic_enabled() || smp_get_online_count() < 2) return false;
+    if(kernel_range) return true;
+
+    unsigned self = smp_get_cpu_id();
+    for(unsigned cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
+        if(cpu == self || !smp_get_cpu(cpu)->online) continue;
+        if(current_page_directory[cpu] == current_page_directory[self]) return true;
+    }
+    return false;
+}
+
+// a deferred frame can be reused once every other online cpu has handled a shootdown as recent as its own
+static bool deferred_frame_flushed(deferred_frame_t* deferred) {
+    for(unsigned cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
+        if(cpu == deferred->cpu || !smp_get_cpu(cpu)->online) continue;
+        if((int)(atomic_load(&flushed_epoch[cpu]) - deferred->epoch) < 0) return false;
+    }
+    return true;
+}
+
+// give back the unmapped frames that no cpu can reach through its tlb anymore
+void vmmngr_release_flushed_frames() {
+    uint32_t eflags = ticketlock_acquire_irqsave(&deferred_lock);
+    while(deferred_count && deferred_frame_flushed(&deferred_frames[deferred_head])) {
+        pmmngr_free_block((void*)deferred_frames[deferred_head].frame);
+        deferred_head = (deferred_head + 1) % DEFERRED_FRAME_COUNT;
+        deferred_count--;
+    }
+    ticketlock_release_irqrestore(&deferred_lock, eflags);
+}
+
+// called on the IPI sent by vmmngr_unmap_range
+// the ranges of all requests so far are covered by flushing everything
+void vmmngr_handle_shootdown() {
+    unsigned epoch = atomic_load(&shootdown_epoch);
+    flush_tlb(true);
+    atomic_store(&flushed_epoch[smp_get_cpu_id()], epoch);
+}
+
+// give back frames whose entries are cleared and flushed from the tlb of this cpu
+// other cpus are only looked at after the entries are cleared
+// a cpu that loads the page directory after that can not cache them, one that loaded it before is seen here
+// if any cpu may still reach them they get a shootdown IPI, and the frames are only freed after
+// they have flushed, so nobody has to wait here for them
+static void release_frames(const physical_addr_t* frames, unsigned count, bool kernel_range) {
+    if(!count) return;
+
+    // loading cr3 drains the store buffer of the other cpu, this does the same for our cleared entries
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if(!needs_shootdown(kernel_range)) {
+        for(unsigned i = 0; i < count; i++)
+            pmmngr_free_block((void*)frames[i]);
+        return;
+    }
+
+    ticketlock_acquire(&deferred_lock);
+
+    // every frame already in the list has its epoch published and its IPI sent
+    // so room is made as soon as the other cpus handle their interrupts
+    // another cpu may wait here too with interrupts off, so we do our part of the flush ourselves
+    while(DEFERRED_FRAME_COUNT - deferred_count < count) {
+        ticketlock_release(&deferred_lock);
+        vmmngr_handle_shootdown();
+        __builtin_ia32_pause();
+        vmmngr_release_flushed_frames();
+        ticketlock_acquire(&deferred_lock);
+    }
+
+    // the frames get the epoch of the IPI sent below
+    unsigned epoch = atomic_load(&shootdown_epoch) + 1;
+    unsigned self = smp_get_cpu_id();
+    for(unsigned i = 0; i < count; i++) {
+        deferred_frame_t* deferred = &deferred_frames[(deferred_head + deferred_count) % DEFERRED_FRAME_COUNT];
+        deferred->frame = frames[i];
+        deferred->epoch = epoch;
+        deferred->cpu = self;
+        deferred_count++;
+    }
+
+    // the entries are cleared, anyone who sees this epoch flushes after that
+    atomic_store(&shootdown_epoch, epoch);
+    ticketlock_release(&deferred_lock);
+    lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_IPI_VECTOR);
+}
+
+// unmap size bytes at virt in the current page directory and free their frames
+// each page table is walked once, the frames are given back UNMAP_BATCH_SIZE at a time
+// so a large range costs a few tlb flushes and IPIs instead of one per page
+void vmmngr_unmap_range(page_directory_t* page_directory, virtual_addr_t virt, size_t size) {
+    if(page_directory) {
+        for(size_t offset = 0; offset < size; offset += MMNGR_PAGE_SIZE)
+            vmmngr_unmap(page_directory, virt + offset);
+        return;
+    }
+
+    vmmngr_release_flushed_frames();
+
+    // stay on this cpu, the checks are about the cpu we run on
+    uint32_t eflags = irq_save();
+
+    bool kernel_range = virt + size > KERNEL_START;
+    physical_addr_t frames[UNMAP_BATCH_SIZE];
+    unsigned count = 0;
+    // start of the part whose frames are in the batch
+    virtual_addr_t batch_start = virt;
+
+    page_directory_t* virt_pd = (page_directory_t*)VMMNGR_PD;
+    for(size_t offset = 0; offset < size;) {
+        virtual_addr_t addr = virt + offset;
+        pde_t* pde = PAGE_DIRECTORY_LOOKUP(virt_pd, addr);
+        // large pages only map devices and the kernel heap's first part, they stay
+        if(!(*pde & PDE_PRESENT) || (*pde & PDE_4MB)) {
+            offset += MMNGR_LARGE_PAGE_SIZE - addr % MMNGR_LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)addr));
+        for(unsigned i = PAGE_TABLE_INDEX(addr); i < 1024 && offset < size; i++, offset += MMNGR_PAGE_SIZE) {
+            pte_t pte = table->entry[i];
+            if(!(pte & PTE_PRESENT)) continue;
+            table->entry[i] = 0;
+            frames[count++] = pte & PAGE_FRAME_BITS;
+
+            if(count == UNMAP_BATCH_SIZE) {
+                virtual_addr_t batch_end = virt + offset + MMNGR_PAGE_SIZE;
+                flush_tlb_range(batch_start, (batch_end - batch_start) / MMNGR_PAGE_SIZE);
+                release_frames(frames, count, kernel_range);
+                batch_start = batch_end;
+                count = 0;
+            }
+        }
+    }
+
+    if(batch_start < virt + size) flush_tlb_range(batch_start, (virt + size - batch_start) / MMNGR_PAGE_SIZE);
+    release_frames(frames, count, kernel_range);
+
+    irq_restore(eflags);
+}
+
+// only for the kernel half of the current page directory, new user page directories copy it
+static bool can_map_large(page_directory_t* page_directory, physical_addr_t phys, virtual_addr_t virt, size_t size) {
+    if(!large_pages || page_directory || virt < KERNEL_START) return false;
+    if(size < MMNGR_LARGE_PAGE_SIZE) return false;
+    if(phys % MMNGR_LARGE_PAGE_SIZE || virt % MMNGR_LARGE_PAGE_SIZE) return false;
+
+    // do not throw away a page table that is already there
+    return !(*PAGE_DIRECTORY_LOOKUP((page_directory_t*)VMMNGR_PD, virt) & PDE_PRESENT);
+}
+
+// map size bytes starting at phys to virt
+// 4MiB pages are used where both addresses are 4MiB aligned and a whole 4MiB is left, 4KiB pages elsewhere
+// each page table is looked up once, and the tlb is only flushed if a present page got replaced
+MEM_ERR vmmngr_map_range(page_directory_t* page_directory, physical_addr_t phys, virtual_addr_t virt, size_t size, unsigned flags) {
+    if(page_directory) {
+        for(size_t offset = 0; offset < size; offset += MMNGR_PAGE_SIZE) {
+            MEM_ERR err = vmmngr_map(page_directory, phys + offset, virt + offset, flags);
+            if(err) return err;
+        }
+        return ERR_MEM_SUCCESS;
+    }
+
+    if(!pat_enabled) flags &= ~PTE_PAT;
+
+    page_directory_t* virt_pd = (page_directory_t*)VMMNGR_PD;
+    unsigned pte_flags = PTE_PRESENT | (flags & 0xfff);
+    // the kernel half is the same in every address space so it can survive cr3 reloads
+    if(virt >= KERNEL_START) pte_flags |= PTE_CPU_GLOBAL;
+
+    bool replaced = false;
+    MEM_ERR err = ERR_MEM_SUCCESS;
+    size_t offset = 0;
+    while(offset < size && !err) {
+        if(can_map_large(page_directory, phys + offset, virt + offset, size - offset)) {
+            pde_t* pde = PAGE_DIRECTORY_LOOKUP(virt_pd, virt + offset);
+            // bit 7 is PAT in a PTE but the page size in a PDE, which has PAT in bit 12 instead
+            *pde = (phys + offset) | PDE_4MB | PDE_CPU_GLOBAL | PDE_PRESENT | (flags & (PDE_WRITABLE | PDE_USER | PDE_PWT | PDE_PCD));
+            if(flags & PTE_PAT) *pde |= PDE_4MB_PAT;
+            vmmngr_flush_tlb_entry(virt + offset);
+            offset += MMNGR_LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        // fill the rest of this page table in one go
+        page_table_t* table;
+        err = get_table(virt_pd, virt + offset, flags, &table);
+        if(err) break;
+
+        for(unsigned i = PAGE_TABLE_INDEX(virt + offset); i < 1024 && offset < size; i++, offset += MMNGR_PAGE_SIZE) {
+            if(table->entry[i] & PTE_PRESENT) replaced = true;
+            table->entry[i] = (phys + offset) | pte_flags;
+        }
+    }
+
+    // a page that was not present can not be in any tlb
+    if(replaced) flush_tlb_range(virt, offset / MMNGR_PAGE_SIZE);
+
+    return err;
+}
+
 MEM_ERR vmmngr_alloc_page(pte_t* pte) {
     void* p = pmmngr_alloc_block();
     if(!p) return ERR_MEM_OOM;
@@ -140,53 +466,179 @@ page_directory_t* vmmngr_alloc_page_directory() {
     page_directory_t* pd = (page_directory_t*)pmmngr_alloc_block();
     if(pd == NULL) return NULL;
 
-    map_temporary_pd(pd);
-    page_directory_t* virt_pd = (page_directory_t*)VMMNGR_RESERVED;
+    page_directory_t* virt_pd = map_temporary_pd(pd);
 
-    // copy the current page directory
+    // copy the kernel part of the current page directory
     page_directory_t* kernel_pd = (page_directory_t*)VMMNGR_PD;
     memcpy(virt_pd, kernel_pd, sizeof(page_directory_t));
+    memset(virt_pd, 0, PAGE_DIRECTORY_INDEX(KERNEL_START) * sizeof(pde_t));
 
     // set final entry to itself for recursive paging
+    // this also makes it visible at VMMNGR_PD once it is loaded
     pde_t* pde = &virt_pd->entry[1023];
     page_entry_add_attrib(pde, PDE_PRESENT | PDE_WRITABLE);
     page_entry_set_frame(pde, (physical_addr_t)pd);
 
-    // map itself to VMMNGR_PD
-    vmmngr_map(pd, (physical_addr_t)pd, VMMNGR_PD, PTE_PRESENT | PTE_WRITABLE);
-
+    unmap_temporary_pd();
     return pd;
 }
 
 // free all memory lower than KERNEL_START of page_directory and itself
-void vmmngr_free_page_directory(page_directory_t* page_directory) {
-    map_temporary_pd(page_directory);
-    page_directory_t* virt_pd = (page_directory_t*)VMMNGR_RESERVED;
+// page_tables tells which user page tables it has, only those are looked at
+// the page directory must not be loaded on any cpu
+void vmmngr_free_page_directory(page_directory_t* page_directory, const uint32_t* page_tables) {
+    for(unsigned i = 0; i < PAGE_TABLE_BITMAP_SIZE; i++) {
+        uint32_t bits = page_tables[i];
+        while(bits) {
+            unsigned idx = i * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            // the window holds one page at a time, so read the entry first then map the table there
+            pde_t pde = map_temporary_pd(page_directory)->entry[idx];
+            unmap_temporary_pd();
+            if(!(pde & PDE_PRESENT)) continue;
+
+            physical_addr_t phys_table = pde & PAGE_FRAME_BITS;
+            page_table_t* virt_table = (page_table_t*)map_temporary_pd((page_directory_t*)phys_table);
+            for(unsigned j = 0; j < 1024; j++) {
+                pte_t pte = virt_table->entry[j];
+                if(pte & PTE_PRESENT) pmmngr_free_block((void*)(pte & PAGE_FRAME_BITS));
+            }
+            unmap_temporary_pd();
+
+            pmmngr_free_block((void*)phys_table);
+        }
+    }
+
+    pmmngr_free_block(page_directory);
+}
+
+// copy the current address space for fork
+// user pages are not copied, both sides map them read-only until one of them writes (see vmmngr_copy_on_write)
+// so the cost only depends on the number of page tables
+// the copy's user page tables are recorded in page_tables
+page_directory_t* vmmngr_fork_page_directory(uint32_t* page_tables) {
+    page_directory_t* pd = vmmngr_alloc_page_directory();
+    if(pd == NULL) return NULL;
+
+    page_directory_t* current_pd = (page_directory_t*)VMMNGR_PD;
+    bool err = false;
+    for(unsigned i = 0; i < PAGE_DIRECTORY_INDEX(KERNEL_START) && !err; i++) {
+        if(!(current_pd->entry[i] & PDE_PRESENT)) continue;
+
+        physical_addr_t new_table = (physical_addr_t)pmmngr_alloc_block();
+        if(!new_table) {
+            err = true;
+            break;
+        }
+        set_table_bit(page_tables, i);
+
+        page_table_t* table = PAGE_TABLE_ADDR(i);
+        page_table_t* virt_table = (page_table_t*)map_temporary_pd((page_directory_t*)new_table);
+        for(unsigned j = 0; j < 1024; j++) {
+            pte_t pte = table->entry[j];
+            if(pte & PTE_PRESENT) {
+                if(pmmngr_ref_block((void*)(pte & PAGE_FRAME_BITS))) {
+                    // too many sharers, leave the rest unmapped and give up
+                    memset(&virt_table->entry[j], 0, (1024 - j) * sizeof(pte_t));
+                    err = true;
+                    break;
+                }
+                if(pte & PTE_WRITABLE) {
+                    pte = (pte & ~PTE_WRITABLE) | PTE_COPY_ON_WRITE;
+                    table->entry[j] = pte;
+                }
+            }
+            virt_table->entry[j] = pte;
+        }
+        unmap_temporary_pd();
+
+        page_directory_t* virt_pd = map_temporary_pd(pd);
+        virt_pd->entry[i] = (current_pd->entry[i] & ~PAGE_FRAME_BITS) | new_table;
+        unmap_temporary_pd();
+    }
+
+    // the pages we just made read-only may still be writable in the tlb
+    asm volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax", "memory");
+
+    if(err) {
+        vmmngr_free_page_directory(pd, page_tables);
+        return NULL;
+    }
+
+    return pd;
+}
+
+// handle a write to a present page of the current address space
+// give it its own copy of a copy-on-write page, the last sharer just gets the page back writable
+// return true if the page is not copy-on-write or there is not enough memory
+bool vmmngr_copy_on_write(virtual_addr_t virt) {
+    pde_t* pde = PAGE_DIRECTORY_LOOKUP((page_directory_t*)VMMNGR_PD, virt);
+    if(!(*pde & PDE_PRESENT)) return true;
 
-    for(unsigned i = 0; i < 1024; i++) {
-        // only free page table that map to address lower than KERNEL_START
-        if(i * MMNGR_PAGE_SIZE * 1024 >= KERNEL_START) break;
+    uint32_t eflags = ticketlock_acquire_irqsave(&cow_lock);
 
-        if(virt_pd->entry[i] == 0) continue;
-        physical_addr_t phys_table = (virt_pd->entry[i] & PAGE_FRAME_BITS);
-        page_table_t* virt_table = PAGE_TABLE_ADDR(i);
+    page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
+    pte_t* pte = PAGE_TABLE_LOOKUP(table, virt);
+    bool err = !(*pte & PTE_PRESENT) || !(*pte & PTE_COPY_ON_WRITE);
+
+    virtual_addr_t page = virt & ~(MMNGR_PAGE_SIZE - 1);
+    physical_addr_t old_frame = (physical_addr_t)(*pte & PAGE_FRAME_BITS);
+    physical_addr_t new_frame = old_frame;
+    if(!err && pmmngr_is_shared((void*)old_frame)) {
+        new_frame = (physical_addr_t)pmmngr_alloc_block();
+        if(!new_frame) err = true;
+        else {
+            memcpy(map_temporary_pd((page_directory_t*)new_frame), (void*)page, MMNGR_PAGE_SIZE);
+            unmap_temporary_pd();
+        }
+    }
 
-        // free memory to map that page table
-        for(int j = 0; j < 1024; j++)
-            pmmngr_free_block((void*)virt_table->entry[i]);
+    if(!err) {
+        page_entry_del_attrib(pte, PTE_COPY_ON_WRITE);
+        page_entry_add_attrib(pte, PTE_WRITABLE);
+        page_entry_set_frame(pte, new_frame);
+        vmmngr_flush_tlb_entry(page);
 
-        // finally free the table
-        pmmngr_free_block((void*)phys_table);
+        // drop our reference to the shared frame
+        if(new_frame != old_frame) pmmngr_free_block((void*)old_frame);
     }
 
-    pmmngr_free_block(page_directory);
+    ticketlock_release_irqrestore(&cow_lock, eflags);
+
+    return err;
+}
+
+// replace the flags of a mapped page, the frame stays the same
+MEM_ERR vmmngr_set_flags(page_directory_t* page_directory, virtual_addr_t virt, unsigned flags) {
+    page_directory_t* virt_pd;
+    if(page_directory == NULL) virt_pd = (page_directory_t*)VMMNGR_PD;
+    else virt_pd = map_temporary_pd(page_directory);
+
+    MEM_ERR err = ERR_MEM_UNMAPPED;
+    pde_t* pde = PAGE_DIRECTORY_LOOKUP(virt_pd, virt);
+    if((*pde & PDE_PRESENT) && (*pde & PDE_4MB)) err = ERR_MEM_LARGE_PAGE;
+    else if(*pde & PDE_PRESENT) {
+        page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX((uint32_t)virt));
+        pte_t* pte = PAGE_TABLE_LOOKUP(table, virt);
+        if(*pte & PTE_PRESENT) {
+            *pte = (*pte & PAGE_FRAME_BITS) | PTE_PRESENT | (flags & 0xfff);
+            vmmngr_flush_tlb_entry(virt);
+            err = ERR_MEM_SUCCESS;
+        }
+    }
+
+    if(page_directory) unmap_temporary_pd();
+    return err;
 }
 
-void vmmngr_switch_page_directory(page_directory_t* dir) {
-    if(current_page_directory == dir) return;
+// page_tables is the inventory that gets new user page tables of dir, NULL for the kernel page directory
+void vmmngr_switch_page_directory(page_directory_t* dir, uint32_t* page_tables) {
+    unsigned cpu = smp_get_cpu_id();
+    current_page_tables[cpu] = page_tables;
+    if(current_page_directory[cpu] == dir) return;
 
-    current_page_directory = dir;
-    mapped_temporal_pd = 0;
+    current_page_directory[cpu] = dir;
     asm volatile("mov %0, %%cr3" : : "r" (dir));
 }
 
@@ -194,6 +646,68 @@ void vmmngr_flush_tlb_entry(virtual_addr_t addr) {
 	asm volatile("invlpg (%0)" : : "b" ((void*)addr) : "memory");
 }
 
+// turn on 4MiB and global pages if the cpu has them
+// the APs get the same cr4 from the trampoline already, since the page directory may have 4MiB pages by then
+static void enable_paging_features() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r" (cr4));
+    if(edx & (1 << 3)) cr4 |= CR4_PSE;
+    if(edx & (1 << 13)) cr4 |= CR4_PGE;
+    asm volatile("mov %0, %%cr4" : : "r" (cr4) : "memory");
+
+    large_pages = cr4 & CR4_PSE;
+}
+
+// make PAT entry 4 write-combining, it is selected by PTE_WRITE_COMBINING
+// the other entries keep their power-on types, so PWT and PCD alone mean the same as without PAT
+// every cpu must do this before using a write-combining mapping
+static void init_pat() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    if(!(edx & (1 << 16))) return;
+    pat_enabled = true;
+
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (MSR_PAT));
+    high = (high & ~0xff) | PAT_WRITE_COMBINING;
+
+    // the old type may still be in the caches and the tlb
+    asm volatile("wbinvd" : : : "memory");
+    asm volatile("wrmsr" : : "a" (low), "d" (high), "c" (MSR_PAT));
+    flush_tlb(true);
+}
+
+// the boot page table of the kernel has no global pages yet
+// smp_init identity maps this table while the APs start, the APs run the trampoline in the first MiB
+// so that part is kept out, else it would stay in their tlb after the identity map is gone
+static void make_kernel_table_global() {
+    page_table_t* table = PAGE_TABLE_ADDR(PAGE_DIRECTORY_INDEX(KERNEL_START));
+    for(unsigned i = 0x100000 / MMNGR_PAGE_SIZE; i < 1024; i++)
+        if(table->entry[i] & PTE_PRESENT) page_entry_add_attrib(&table->entry[i], PTE_CPU_GLOBAL);
+}
+
+// called by each cpu
 void vmmngr_init() {
-    current_page_directory = kernel_page_directory;
+    unsigned cpu = smp_get_cpu_id();
+    current_page_directory[cpu] = kernel_page_directory;
+    current_page_tables[cpu] = NULL;
+    // nothing unmapped before can be in the tlb of a cpu that is just starting
+    atomic_store(&flushed_epoch[cpu], atomic_load(&shootdown_epoch));
+
+    init_pat();
+
+    if(cpu == 0) {
+        enable_paging_features();
+        make_kernel_table_global();
+
+        lock_stats_register(&temporary_pd_lock_stats, "vmmngr temporary pd");
+        temporary_pd_lock.stats = &temporary_pd_lock_stats;
+        lock_stats_register(&cow_lock_stats, "vmmngr copy-on-write");
+        cow_lock.stats = &cow_lock_stats;
+        lock_stats_register(&deferred_lock_stats, "vmmngr shootdown");
+        deferred_lock.stats = &deferred_lock_stats;
+    }
 }
@@ -0,0 +1,82 @@
+#include "mem.h"
+#include "system.h"
+
+#include "string.h"
+
+// frames that are already zeroed, filled by the idle threads
+// so that page tables and zero-filled user pages do not have to be cleared when they are needed
+static physical_addr_t pool[ZERO_POOL_SIZE];
+static unsigned pool_count = 0;
+
+static ticketlock_t pool_lock = TICKETLOCK_INIT;
+static lock_stats_t pool_lock_stats;
+
+// keep this much memory free for everything else, the pool is not refilled below it
+#define ZERO_POOL_RESERVE (4 * ZERO_POOL_SIZE * MMNGR_PAGE_SIZE)
+
+// each cpu has its own window in ZERO_WINDOW_START so no lock is needed to use it
+static void zero_frame(physical_addr_t phys) {
+    // stay on this cpu and keep the window for ourself until we are done
+    uint32_t eflags = irq_save();
+
+    virtual_addr_t window = ZERO_WINDOW_START + smp_get_cpu_id() * MMNGR_PAGE_SIZE;
+    // the window is in the first 4MiB so its page table always exists
+    vmmngr_map(NULL, phys, window, PTE_WRITABLE);
+    memset((void*)window, 0, MMNGR_PAGE_SIZE);
+
+    irq_restore(eflags);
+}
+
+// copy data into a frame that is not mapped anywhere yet, through the window of this cpu
+void zero_pool_write_frame(physical_addr_t phys, size_t offset, const void* data, size_t size) {
+    uint32_t eflags = irq_save();
+
+    virtual_addr_t window = ZERO_WINDOW_START + smp_get_cpu_id() * MMNGR_PAGE_SIZE;
+    vmmngr_map(NULL, phys, window, PTE_WRITABLE);
+    memcpy((void*)(window + offset), data, size);
+
+    irq_restore(eflags);
+}
+
+// return a zeroed frame, or NULL if out of memory
+// takes one from the pool if possible else zeroes a new one right away
+void* zero_pool_alloc() {
+    physical_addr_t phys = 0;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&pool_lock);
+    if(pool_count) phys = pool[--pool_count];
+    ticketlock_release_irqrestore(&pool_lock, eflags);
+
+    if(phys) return (void*)phys;
+
+    phys = (physical_addr_t)pmmngr_alloc_block();
+    if(phys) zero_frame(phys);
+    return (void*)phys;
+}
+
+// zero frames until the pool is full, called by the idle threads
+// interrupts stay on between frames so a thread that becomes ready is not delayed by more than one frame
+void zero_pool_refill() {
+    while(pool_count < ZERO_POOL_SIZE && pmmngr_get_free_size() > ZERO_POOL_RESERVE) {
+        physical_addr_t phys = (physical_addr_t)pmmngr_alloc_block();
+        if(!phys) return;
+
+        zero_frame(phys);
+
+        // another cpu may have filled the pool in the meantime
+        uint32_t eflags = ticketlock_acquire_irqsave(&pool_lock);
+        bool full = pool_count == ZERO_POOL_SIZE;
+        if(!full) pool[pool_count++] = phys;
+        ticketlock_release_irqrestore(&pool_lock, eflags);
+
+        if(full) {
+            pmmngr_free_block((void*)phys);
+            return;
+        }
+    }
+}
+
+void zero_pool_init() {
+    lock_stats_register(&pool_lock_stats, "zero pool");
+    pool_lock.stats = &pool_lock_stats;
+}
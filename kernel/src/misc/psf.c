@@ -21,6 +21,10 @@ void psf_get_font_geometry(int* width, int* height, int* bpg) {
     *bpg = font->bytesperglyph;
 }
 
+int psf_get_glyph_count() {
+    return font->numglyph;
+}
+
 char* psf_get_glyph(char chr) {
-    return (char*)font + font->headersize + chr * font->bytesperglyph;
+    return (char*)font + font->headersize + (uint8_t)chr * font->bytesperglyph;
 }
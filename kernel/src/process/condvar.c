@@ -0,0 +1,39 @@
+#include "process.h"
+
+void condvar_init(condvar_t* cond) {
+    *cond = (condvar_t)CONDVAR_INIT;
+}
+
+// unlock the mutex and sleep until signaled, the mutex is locked again before returning
+// the mutex must be locked by the caller
+void condvar_wait(condvar_t* cond, mutex_t* mutex) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&cond->lock);
+
+    // unlock the mutex while holding the condvar's lock
+    // so a signal sent right after can not be missed
+    mutex_unlock(mutex);
+
+    scheduler_wait(&cond->waiting_queue, &cond->lock);
+    irq_restore(eflags);
+
+    mutex_lock(mutex);
+}
+
+void condvar_signal(condvar_t* cond) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&cond->lock);
+    thread_t* thread = thread_queue_pop(&cond->waiting_queue);
+    ticketlock_release_irqrestore(&cond->lock, eflags);
+
+    if(thread) scheduler_add_thread(thread);
+}
+
+void condvar_broadcast(condvar_t* cond) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&cond->lock);
+    thread_queue_t waiting = cond->waiting_queue;
+    cond->waiting_queue = (thread_queue_t)THREAD_QUEUE_INIT;
+    ticketlock_release_irqrestore(&cond->lock, eflags);
+
+    thread_t* thread;
+    while((thread = thread_queue_pop(&waiting)))
+        scheduler_add_thread(thread);
+}
@@ -0,0 +1,60 @@
+#include "process.h"
+#include "mem.h"
+
+#include "misc/elf.h"
+
+// the magic is stored as bytes so reading it as a little endian word reverses it
+#define ELF_MAGIC_WORD __builtin_bswap32(ELF_MAGIC)
+
+static bool check_header(elf_header_t* header) {
+    return header->magic == ELF_MAGIC_WORD
+        && header->bits == ELF_CLASS_32
+        && header->type == ELF_ET_EXEC
+        && header->instruction_set == ELF_INSSET_X86
+        && header->pht_entry_size == sizeof(elf_program_header_t);
+}
+
+// segments must stay out of the user heap, the screen buffer, the stacks and the kernel
+static bool check_segment(elf_program_header_t* ph) {
+    uint32_t start = ph->vaddr;
+    uint32_t end = ph->vaddr + ph->mem_segment_size;
+    if(end < start || end > USTACK_REGION_START) return false;
+    if(ph->file_segment_size > ph->mem_segment_size) return false;
+    if(end > UFRAMEBUFFER_START && start < UFRAMEBUFFER_START + UFRAMEBUFFER_MAX_SIZE) return false;
+    return end <= UHEAP_START || start >= UHEAP_START + UHEAP_MAX_SIZE;
+}
+
+// create a user process from an ELF executable, it still has to be added to the scheduler
+// only the headers are read here, the segments are read page by page when they are first touched
+// so the start up time does not depend on the size of the executable
+process_t* process_exec(fs_node_t* node, int priority) {
+    if(!node->valid || node->isdir) return NULL;
+
+    elf_header_t header;
+    if(file_read_at(node, 0, (uint8_t*)&header, sizeof(elf_header_t))) return NULL;
+    if(!check_header(&header)) return NULL;
+
+    process_t* proc = process_new(header.program_entry_offset, priority, true);
+    if(!proc) return NULL;
+    proc->image = *node;
+
+    for(unsigned i = 0; i < header.pht_entry_count; i++) {
+        elf_program_header_t ph;
+        uint32_t offset = header.pht_offset + i * sizeof(elf_program_header_t);
+        if(file_read_at(node, offset, (uint8_t*)&ph, sizeof(elf_program_header_t)))
+            goto fail;
+
+        if(ph.type != ELF_PT_LOAD || ph.mem_segment_size == 0) continue;
+        if(!check_segment(&ph)) goto fail;
+
+        if(vm_area_add(proc, ph.vaddr, ph.vaddr + ph.mem_segment_size,
+                    ph.offset, ph.file_segment_size, ph.flags & ELF_PF_W))
+            goto fail;
+    }
+
+    return proc;
+
+    fail:
+    process_delete(proc);
+    return NULL;
+}
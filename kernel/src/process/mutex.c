@@ -0,0 +1,169 @@
+#include "process.h"
+
+void mutex_init(mutex_t* mutex) {
+    *mutex = (mutex_t)MUTEX_INIT;
+}
+
+// must be called with the mutex's lock held
+static bool acquire(mutex_t* mutex) {
+    if(mutex->locked) return false;
+
+    thread_t* self = scheduler_get_current_thread();
+    mutex->locked = true;
+    mutex->owner = self;
+    mutex->owner_running = true;
+
+    // interrupts are off so the scheduler never sees the list half changed
+    if(self) {
+        mutex->next_held = self->held_mutexes;
+        self->held_mutexes = mutex;
+    }
+    return true;
+}
+
+// must be called with the mutex's lock held
+static void remove_held(thread_t* thread, mutex_t* mutex) {
+    if(!thread) return;
+
+    mutex_t** link = &thread->held_mutexes;
+    while(*link && *link != mutex) link = &(*link)->next_held;
+    if(*link) *link = mutex->next_held;
+    mutex->next_held = NULL;
+}
+
+// called by the scheduler when a thread is switched in or out
+// only the thread itself changes its list, with interrupts off, or someone else while it is blocked
+void mutex_set_owner_running(thread_t* thread, bool running) {
+    for(mutex_t* mutex = thread->held_mutexes; mutex; mutex = mutex->next_held)
+        mutex->owner_running = running;
+}
+
+// priority inheritance
+// raise the priority of a mutex owner to the one of a waiter
+// the caller makes sure the owner can not go away, it holds the owner's mutex or the owner is blocked
+static void boost(thread_t* owner, int priority) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&owner->lock);
+
+    if(priority > owner->priority) {
+        owner->priority = priority;
+        owner->priority_boosts++;
+
+        // an owner blocked on another lock moves up in its wait queue
+        if(owner->wait_queue_lock) {
+            ticketlock_acquire(owner->wait_queue_lock);
+            if(!thread_queue_remove(owner->wait_queue, owner))
+                thread_queue_sorted_push(owner->wait_queue, owner, thread_sort_by_priority);
+            ticketlock_release(owner->wait_queue_lock);
+        }
+    }
+
+    ticketlock_release_irqrestore(&owner->lock, eflags);
+}
+
+// set the priority of the current thread to the highest of its base priority
+// and what it inherits through the mutexes it still holds
+static void update_priority(thread_t* self) {
+    while(true) {
+        uint32_t eflags = ticketlock_acquire_irqsave(&self->lock);
+        unsigned boosts = self->priority_boosts;
+        ticketlock_release_irqrestore(&self->lock, eflags);
+
+        // no mutex lock is taken here, condvar_wait calls this with its own lock held
+        int priority = self->base_priority;
+        for(mutex_t* mutex = self->held_mutexes; mutex; mutex = mutex->next_held) {
+            int inherited = *(volatile int*)&mutex->waiter_priority;
+            if(inherited > priority) priority = inherited;
+        }
+
+        // a waiter sets waiter_priority before boosting us
+        // so one we missed has changed the counter, then look again
+        eflags = ticketlock_acquire_irqsave(&self->lock);
+        bool boosted = self->priority_boosts != boosts;
+        if(!boosted) self->priority = priority;
+        ticketlock_release_irqrestore(&self->lock, eflags);
+
+        if(!boosted) return;
+    }
+}
+
+// return true if the mutex is already locked
+bool mutex_try_lock(mutex_t* mutex) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&mutex->lock);
+    bool acquired = acquire(mutex);
+    ticketlock_release_irqrestore(&mutex->lock, eflags);
+
+    return !acquired;
+}
+
+void mutex_lock(mutex_t* mutex) {
+    if(!mutex_try_lock(mutex)) return;
+
+    // the owner will probably release the mutex soon if it is running on another cpu
+    // so spin for a while instead of paying for two context switches
+    for(unsigned i = 0; i < MUTEX_SPIN_COUNT; i++) {
+        if(!*(volatile bool*)&mutex->locked) {
+            if(!mutex_try_lock(mutex)) return;
+            continue;
+        }
+        if(!*(volatile bool*)&mutex->owner_running) break;
+
+        __builtin_ia32_pause();
+    }
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&mutex->lock);
+
+    // it may have been unlocked while we were spinning
+    if(acquire(mutex)) {
+        ticketlock_release_irqrestore(&mutex->lock, eflags);
+        return;
+    }
+
+    // the owner runs with the priority of its most important waiter
+    // so that it can not be held back by threads less important than the waiter
+    thread_t* self = scheduler_get_current_thread();
+    if(self->priority > mutex->waiter_priority) mutex->waiter_priority = self->priority;
+    if(mutex->owner) boost(mutex->owner, self->priority);
+
+    // sleep until the mutex is handed to us (see mutex_unlock)
+    scheduler_wait(&mutex->waiting_queue, &mutex->lock);
+    irq_restore(eflags);
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    thread_t* self = mutex->owner;
+    uint32_t eflags = ticketlock_acquire_irqsave(&mutex->lock);
+
+    remove_held(self, mutex);
+
+    // hand the mutex directly to the most important waiter so nobody can take it in between
+    // it is blocked, the scheduler marks it running once it is switched in
+    thread_t* next = thread_queue_pop(&mutex->waiting_queue);
+    mutex->owner = next;
+    mutex->locked = next != NULL;
+    mutex->owner_running = false;
+    if(next) {
+        mutex->next_held = next->held_mutexes;
+        next->held_mutexes = mutex;
+
+        // it is off the queue, a waiter boosting it while holding our lock must not requeue it
+        ticketlock_acquire(&next->lock);
+        next->wait_queue = NULL;
+        next->wait_queue_lock = NULL;
+        ticketlock_release(&next->lock);
+    }
+
+    // the new owner inherits from the remaining waiters, the queue is sorted by priority
+    thread_t* top = mutex->waiting_queue.top;
+    mutex->waiter_priority = top ? top->priority : 0;
+    int inherited = mutex->waiter_priority;
+
+    ticketlock_release_irqrestore(&mutex->lock, eflags);
+
+    // drop what was inherited through this mutex, but not through the others still held
+    if(self) update_priority(self);
+
+    if(next) {
+        boost(next, inherited);
+        scheduler_add_thread(next);
+    }
+}
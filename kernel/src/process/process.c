@@ -1,25 +1,46 @@
 #include "process.h"
 #include "system.h"
+#include "syscall.h"
 #include "mem.h"
 
-#define DEFAULT_EFLAGS 0x202
-#define DEFAULT_STACK_SIZE 16 * 1024
+#include "string.h"
 
-static unsigned process_count = 0;
+// how often the reaper looks for finished processes
+#define REAPER_INTERVAL_TICKS 100
 
-static bool is_user_proc(process_t* proc) {
-    return proc->page_directory != vmmngr_get_kernel_page_directory();
+static atomic_uint process_count = 0;
+
+// processes whose last thread has finished, freed by the reaper thread
+// so that tearing down an address space does not happen in the scheduler
+static process_t* reap_list = NULL;
+static ticketlock_t reap_lock = TICKETLOCK_INIT;
+static bool reaper_running = false;
+
+static process_t* alloc_process() {
+    process_t* proc = (process_t*)kmalloc(sizeof(process_t));
+    if(!proc) return NULL;
+
+    proc->id = atomic_fetch_add(&process_count, 1) + 1;
+    memset(proc->page_tables, 0, sizeof(proc->page_tables));
+    proc->heap = NULL;
+    proc->stack_slots = 0;
+    proc->threads = NULL;
+    proc->alive_threads = 0;
+    proc->killed = false;
+    proc->lock = (ticketlock_t)TICKETLOCK_INIT;
+    proc->image.valid = false;
+    proc->areas = NULL;
+    proc->vm_lock = (ticketlock_t)TICKETLOCK_INIT;
+    proc->next = NULL;
+
+    return proc;
 }
 
+// create a process with a single thread starting at eip
 process_t* process_new(uint32_t eip, int priority, bool is_user) {
-    process_t* proc = (process_t*)kmalloc(sizeof(process_t));
+    process_t* proc = alloc_process();
     if(!proc) return NULL;
 
-    proc->id = process_count + 1;
-    proc->priority = priority;
-    proc->state = PROCESS_STATE_READY;
-    proc->alive_ticks = 0;
-    proc->sleep_ticks = 0;
     if(!is_user) proc->page_directory = vmmngr_get_kernel_page_directory();
     else {
         // only users need to have a separate page directory
@@ -28,61 +49,127 @@ process_t* process_new(uint32_t eip, int priority, bool is_user) {
             kfree(proc);
             return NULL;
         }
-    }
-    proc->next = NULL;
 
-
-    regs_t* regs = &proc->regs;
-    regs->eip = eip;
-    regs->eflags = DEFAULT_EFLAGS;
-    regs->ebp = 0;
-    if(is_user) {
         // switch page directory to create user heap
-        vmmngr_switch_page_directory(proc->page_directory);
+        // the heap is shared by all threads of the process
+        // its pages are zero-filled when first touched, see vm_area_page_fault()
+        uint32_t eflags = irq_save();
+        vmmngr_switch_page_directory(proc->page_directory, proc->page_tables);
+        proc->heap = heap_new(UHEAP_START, UHEAP_INITIAL_SIZE, UHEAP_MAX_SIZE, HEAP_LAZY);
+        vmmngr_switch_page_directory(vmmngr_get_kernel_page_directory(), NULL);
+        irq_restore(eflags);
 
-        heap_t* heap = heap_new(UHEAP_START, UHEAP_INITIAL_SIZE, UHEAP_MAX_SIZE, 0b00);
-        if(!heap) {
-            vmmngr_switch_page_directory(vmmngr_get_kernel_page_directory());
-            vmmngr_free_page_directory(proc->page_directory);
+        if(!proc->heap) {
+            vmmngr_free_page_directory(proc->page_directory, proc->page_tables);
             kfree(proc);
             return NULL;
         }
+    }
+
+    if(!thread_new(proc, eip, priority)) {
+        process_delete(proc);
+        return NULL;
+    }
 
-        regs->cs = 0x1b; // user code selector
-        regs->ds = 0x23; // user data selector
-        regs->es = regs->ds;
-        regs->fs = regs->ds;
-        regs->gs = regs->ds;
-        regs->ss = regs->ds;
-        // this should yield no error because the heap is new
-        proc->stack_addr = (uint32_t)heap_alloc(heap, DEFAULT_STACK_SIZE, false);
+    return proc;
+}
 
-        vmmngr_switch_page_directory(vmmngr_get_kernel_page_directory());
+// duplicate the current process, only the calling thread is copied into it
+// no user page is copied here, they are shared until one side writes to them
+// return the child's id to the parent, the child gets 0
+// called in syscall context
+int process_fork(regs_t* regs) {
+    thread_t* self = scheduler_get_current_thread();
+    process_t* parent = self->process;
+    // kernel processes share one page directory
+    // and other threads could keep writing to the shared pages through their stale tlb entries
+    if(!parent->heap || parent->alive_threads > 1) return -1;
+
+    process_t* proc = alloc_process();
+    if(!proc) return -1;
+
+    // the heap and the stack are at the same addresses in the copy
+    proc->heap = parent->heap;
+    proc->stack_slots = parent->stack_slots;
+    proc->image = parent->image;
+    proc->page_directory = vmmngr_fork_page_directory(proc->page_tables);
+    if(!proc->page_directory) {
+        kfree(proc);
+        return -1;
     }
-    else {
-        regs->cs = 0x08; // kernel code selector
-        regs->ds = 0x10; // kernel data selector
-        regs->es = regs->ds;
-        regs->fs = regs->ds;
-        regs->gs = regs->ds;
-        regs->ss = regs->ds;
-        proc->stack_addr = (uint32_t)kmalloc(DEFAULT_STACK_SIZE);
-
-        if(!proc->stack_addr) {
-            kfree(proc);
-            return NULL;
-        }
+
+    if(vm_area_copy_all(proc, parent) || !thread_fork(proc, self, regs)) {
+        process_delete(proc);
+        return -1;
     }
-    regs->useresp = proc->stack_addr + DEFAULT_STACK_SIZE;
 
-    process_count++;
+    int id = proc->id;
+    scheduler_add_process(proc);
 
-    return proc;
+    return id;
 }
 
+// free the process and all threads left in it
+// none of them may be running
 void process_delete(process_t* proc) {
+    while(proc->threads) {
+        thread_t* thread = proc->threads;
+        proc->threads = thread->sibling;
+
+        // user stacks go away with the page directory
+        // finished threads have given their kernel stack back already
+        if(thread->kernel_stack) kfree((void*)thread->kernel_stack);
+        kfree(thread);
+    }
+
+    vm_area_free_all(proc);
+
     // all kernel process use the same page directory so do not touch it
-    if(is_user_proc(proc)) vmmngr_free_page_directory(proc->page_directory);
+    if(proc->heap) vmmngr_free_page_directory(proc->page_directory, proc->page_tables);
 
     kfree(proc);
 }
+
+static void reaper() {
+    int ret;
+    while(true) {
+        uint32_t eflags = ticketlock_acquire_irqsave(&reap_lock);
+        process_t* list = reap_list;
+        reap_list = NULL;
+        ticketlock_release_irqrestore(&reap_lock, eflags);
+
+        while(list) {
+            process_t* proc = list;
+            list = proc->next;
+            process_delete(proc);
+        }
+
+        SYSCALL_1P(SYSCALL_SLEEP, ret, REAPER_INTERVAL_TICKS);
+    }
+}
+
+// free a process whose last thread has finished
+// this is left to the reaper thread if there is one, else it is done right away
+void process_reap(process_t* proc) {
+    if(!reaper_running) {
+        process_delete(proc);
+        return;
+    }
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&reap_lock);
+    proc->next = reap_list;
+    reap_list = proc;
+    ticketlock_release_irqrestore(&reap_lock, eflags);
+}
+
+// start the reaper thread in the kernel process
+// return true if there is not enough memory
+bool process_init_reaper(process_t* kernel_proc) {
+    thread_t* thread = thread_new(kernel_proc, (uint32_t)reaper, 0);
+    if(!thread) return true;
+
+    scheduler_add_thread(thread);
+    reaper_running = true;
+
+    return false;
+}
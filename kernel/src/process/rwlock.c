@@ -0,0 +1,120 @@
+#include "process.h"
+
+void rwlock_init(rwlock_t* rwlock) {
+    *rwlock = (rwlock_t)RWLOCK_INIT;
+}
+
+// must be called with the rwlock's lock held
+static bool acquire_read(rwlock_t* rwlock) {
+    if(rwlock->writing) return false;
+
+    rwlock->readers++;
+    return true;
+}
+
+// must be called with the rwlock's lock held
+static bool acquire_write(rwlock_t* rwlock) {
+    if(rwlock->writing || rwlock->readers) return false;
+
+    rwlock->writing = true;
+    rwlock->writer = scheduler_get_current_thread();
+    return true;
+}
+
+// spin for a while in case the writer is about to finish
+// only the rwlock itself is looked at, the writer may exit and be freed meanwhile
+static void spin_on_writer(rwlock_t* rwlock) {
+    for(unsigned i = 0; i < MUTEX_SPIN_COUNT; i++) {
+        if(!*(volatile bool*)&rwlock->writing) return;
+
+        __builtin_ia32_pause();
+    }
+}
+
+void rwlock_read_lock(rwlock_t* rwlock) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&rwlock->lock);
+    bool acquired = acquire_read(rwlock);
+    ticketlock_release_irqrestore(&rwlock->lock, eflags);
+    if(acquired) return;
+
+    spin_on_writer(rwlock);
+
+    // it may have been released while we were spinning
+    eflags = ticketlock_acquire_irqsave(&rwlock->lock);
+    if(acquire_read(rwlock)) {
+        ticketlock_release_irqrestore(&rwlock->lock, eflags);
+        return;
+    }
+
+    // the unlocking thread hands the lock to us before waking us up
+    scheduler_wait(&rwlock->read_queue, &rwlock->lock);
+    irq_restore(eflags);
+}
+
+void rwlock_read_unlock(rwlock_t* rwlock) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&rwlock->lock);
+
+    // the last reader hands the lock to a waiting writer
+    thread_t* next = NULL;
+    rwlock->readers--;
+    if(rwlock->readers == 0) {
+        next = thread_queue_pop(&rwlock->write_queue);
+        if(next) {
+            rwlock->writing = true;
+            rwlock->writer = next;
+        }
+    }
+
+    ticketlock_release_irqrestore(&rwlock->lock, eflags);
+
+    if(next) scheduler_add_thread(next);
+}
+
+void rwlock_write_lock(rwlock_t* rwlock) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&rwlock->lock);
+    bool acquired = acquire_write(rwlock);
+    ticketlock_release_irqrestore(&rwlock->lock, eflags);
+    if(acquired) return;
+
+    // there is no point spinning on readers since we do not know who they are
+    spin_on_writer(rwlock);
+
+    // it may have been released while we were spinning
+    eflags = ticketlock_acquire_irqsave(&rwlock->lock);
+    if(acquire_write(rwlock)) {
+        ticketlock_release_irqrestore(&rwlock->lock, eflags);
+        return;
+    }
+
+    // the unlocking thread hands the lock to us before waking us up
+    scheduler_wait(&rwlock->write_queue, &rwlock->lock);
+    irq_restore(eflags);
+}
+
+void rwlock_write_unlock(rwlock_t* rwlock) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&rwlock->lock);
+
+    rwlock->writing = false;
+    rwlock->writer = NULL;
+
+    // wake every waiting reader, or else hand the lock to the next writer
+    thread_queue_t readers = rwlock->read_queue;
+    rwlock->read_queue = (thread_queue_t)THREAD_QUEUE_INIT;
+    rwlock->readers += readers.size;
+
+    thread_t* writer = NULL;
+    if(!readers.size) {
+        writer = thread_queue_pop(&rwlock->write_queue);
+        if(writer) {
+            rwlock->writing = true;
+            rwlock->writer = writer;
+        }
+    }
+
+    ticketlock_release_irqrestore(&rwlock->lock, eflags);
+
+    thread_t* thread;
+    while((thread = thread_queue_pop(&readers)))
+        scheduler_add_thread(thread);
+    if(writer) scheduler_add_thread(writer);
+}
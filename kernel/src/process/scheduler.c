@@ -1,15 +1,38 @@
 #include "process.h"
 #include "system.h"
+#include "smp.h"
 
 #include "string.h"
+#include "stdlib.h"
+#include "stddef.h"
+
+// each cpu schedules its own threads
+// other cpus only touch the ready queue, to add or steal threads
+typedef struct {
+    thread_queue_t ready_queue;
+    // exited threads are finished later by the cpu they exited on
+    thread_queue_t delete_queue;
+    thread_t* current_thread;
+    // run when the ready queue is empty
+    thread_t* idle_thread;
+    bool thread_switched;
+    // the thread switched away from, its stack is in use until the interrupt stub has left it
+    thread_t* prev_thread;
+    // where the interrupt stub continues after a switch, see context_switch
+    regs_t* resume_frame;
+    uint64_t ticks;
+    ticketlock_t lock;
+} runqueue_t;
+
+static runqueue_t runqueues[MAX_CPU];
+static lock_stats_t runqueue_lock_stats[MAX_CPU];
+static char runqueue_lock_names[MAX_CPU][16];
 
-static process_queue_t ready_queue = PROCESS_QUEUE_INIT;
 // this is a linked list sorted by sleep_ticks
 // TODO: use a priority queue instead
-static process_queue_t sleep_queue = PROCESS_QUEUE_INIT;
-static process_queue_t delete_queue = PROCESS_QUEUE_INIT;
-
-static process_t* current_process = NULL;
+static thread_queue_t sleep_queue = THREAD_QUEUE_INIT;
+static ticketlock_t sleep_lock = TICKETLOCK_INIT;
+static lock_stats_t sleep_lock_stats;
 
 // FIXME
 // currently the only way to get all processes is though process queues
@@ -19,89 +42,459 @@ static process_t* current_process = NULL;
 
 static uint64_t global_sleep_ticks = 0;
 
-static bool process_switched = false;
+// owns the idle threads
+static process_t* kernel_proc = NULL;
+
+// zero frames for later page faults while there is nothing else to do
+static void cpu_idle() {
+    while(true) {
+        vmmngr_release_flushed_frames();
+        zero_pool_refill();
+        asm volatile("hlt");
+    }
+}
+
+static runqueue_t* this_runqueue() {
+    return &runqueues[smp_get_cpu_id()];
+}
+
+static bool cpu_running(unsigned cpu) {
+    return runqueues[cpu].current_thread != NULL;
+}
+
+static void runqueue_push(runqueue_t* rq, thread_t* thread) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&rq->lock);
 
-static void context_switch(regs_t* regs) {
-    memcpy(regs, &current_process->regs, sizeof(regs_t));
-    vmmngr_switch_page_directory(current_process->page_directory);
+    thread->state = THREAD_STATE_READY;
+    thread_queue_push(&rq->ready_queue, thread);
 
-    // set err_code to tell that the registers has changed (see syscall.c)
-    regs->err_code = 1;
-    process_switched = false;
+    ticketlock_release_irqrestore(&rq->lock, eflags);
 }
 
-static void to_next_process(regs_t* regs, bool add_back) {
-    if(!ready_queue.size) return;
+static thread_t* runqueue_pop(runqueue_t* rq) {
+    // do not bother locking an empty queue
+    if(!rq->ready_queue.size) return NULL;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&rq->lock);
+    thread_t* thread = thread_queue_pop(&rq->ready_queue);
+    ticketlock_release_irqrestore(&rq->lock, eflags);
+
+    return thread;
+}
+
+// take a thread from the tail of another cpu's queue
+// the owner works from the head so we rarely fight over the same threads
+// prefer a thread that did not run on the victim last time since its cache is already cold there
+static thread_t* runqueue_steal(runqueue_t* victim, unsigned victim_cpu) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&victim->lock);
+
+    thread_t* thread = NULL;
+    for(thread_t* p = victim->ready_queue.top; p; p = p->next)
+        if(p->last_cpu != (int)victim_cpu) thread = p;
+    if(!thread && victim->ready_queue.size) thread = victim->ready_queue.bottom;
+    if(thread) thread_queue_remove(&victim->ready_queue, thread);
+
+    ticketlock_release_irqrestore(&victim->lock, eflags);
+
+    return thread;
+}
+
+// the queue sizes are read without locking, they are only hints
+static unsigned find_busiest_cpu(unsigned self) {
+    unsigned busiest = self;
+    unsigned busiest_size = 0;
+    for(unsigned i = 0; i < smp_get_cpu_count(); i++) {
+        if(i == self || !cpu_running(i)) continue;
+        if(runqueues[i].ready_queue.size > busiest_size) {
+            busiest = i;
+            busiest_size = runqueues[i].ready_queue.size;
+        }
+    }
+    return busiest;
+}
+
+static thread_t* steal_thread(unsigned cpu) {
+    unsigned victim = find_busiest_cpu(cpu);
+    if(victim == cpu) return NULL;
+    return runqueue_steal(&runqueues[victim], victim);
+}
+
+// pull threads from the busiest cpu until both have about the same amount of work
+static void rebalance(runqueue_t* rq, unsigned cpu) {
+    unsigned victim = find_busiest_cpu(cpu);
+    if(victim == cpu) return;
+
+    unsigned victim_size = runqueues[victim].ready_queue.size;
+    unsigned size = rq->ready_queue.size;
+    if(victim_size < size + 2) return;
+
+    for(unsigned i = 0; i < (victim_size - size) / 2; i++) {
+        thread_t* thread = runqueue_steal(&runqueues[victim], victim);
+        if(!thread) break;
+        runqueue_push(rq, thread);
+    }
+}
+
+static void runqueue_init_stats(unsigned cpu) {
+    char* name = runqueue_lock_names[cpu];
+    memcpy(name, "runqueue ", 9);
+    itoa(cpu, name + 9, 10);
+
+    lock_stats_register(&runqueue_lock_stats[cpu], name);
+    runqueues[cpu].lock.stats = &runqueue_lock_stats[cpu];
+}
+
+// put a thread to the least loaded cpu
+static void enqueue_ready(thread_t* thread) {
+    unsigned target = 0;
+    for(unsigned i = 1; i < smp_get_cpu_count(); i++) {
+        // not started yet
+        if(!cpu_running(i)) continue;
+        if(runqueues[i].ready_queue.size < runqueues[target].ready_queue.size) target = i;
+    }
+
+    // go back to the cpu it ran on last time if that is not much busier
+    // since some of its data may still be in that cpu's cache
+    int last = thread->last_cpu;
+    if(last >= 0 && (unsigned)last != target && cpu_running(last)
+            && runqueues[last].ready_queue.size <= runqueues[target].ready_queue.size + 1)
+        target = last;
+
+    runqueue_push(&runqueues[target], thread);
+}
+
+// return true if the thread belongs to a killed process and can be finished instead of being run
+// a thread stopped in the middle of the kernel may hold kernel locks, it has to get back to usermode first
+static bool is_dead(thread_t* thread) {
+    return thread->process->killed && (thread->regs.cs & 3);
+}
+
+// save the registers of the interrupted thread
+static void save_frame(thread_t* thread, regs_t* regs) {
+    memcpy(&thread->regs, regs, sizeof(regs_t));
+    // an interrupt in kernel mode does not push esp, it was right above the frame
+    if(!(regs->cs & 3)) thread->regs.useresp = (uint32_t)&regs->useresp;
+}
+
+// put the saved registers of a thread on its own stack, where the interrupt stub pops them from
+static regs_t* load_frame(thread_t* thread) {
+    // a thread in usermode enters the kernel at the top of its kernel stack
+    if(thread->regs.cs & 3) {
+        regs_t* frame = (regs_t*)(thread->kernel_stack + THREAD_KERNEL_STACK_SIZE - sizeof(regs_t));
+        memcpy(frame, &thread->regs, sizeof(regs_t));
+        return frame;
+    }
+
+    // a kernel mode iret does not pop esp and ss, the thread continues with esp right above eflags
+    // so only the part below must be written or the thread's own stack gets overwritten
+    regs_t* frame = (regs_t*)(thread->regs.useresp - offsetof(regs_t, useresp));
+    memcpy(frame, &thread->regs, offsetof(regs_t, useresp));
+    return frame;
+}
+
+static void context_switch(runqueue_t* rq) {
+    thread_t* thread = rq->current_thread;
+
+    // the cpu it ran on last may still be leaving its stack
+    while(atomic_load(&thread->stack_in_use)) __builtin_ia32_pause();
+
+    rq->resume_frame = load_frame(thread);
+    // interrupts from usermode land on the thread's own kernel stack
+    tss_set_stack(thread->kernel_stack + THREAD_KERNEL_STACK_SIZE);
+
+    // this does not touch cr3 if the page directory is already loaded
+    // so switching between threads of the same process costs no tlb flush
+    process_t* proc = thread->process;
+    vmmngr_switch_page_directory(proc->page_directory, proc->heap ? proc->page_tables : NULL);
+
+    rq->thread_switched = false;
+}
+
+static void to_next_thread(runqueue_t* rq, regs_t* regs, bool add_back) {
+    unsigned cpu = rq - runqueues;
+
+    // threads of a killed process are finished instead of being run
+    thread_t* next;
+    while((next = runqueue_pop(rq)) && is_dead(next))
+        thread_queue_push(&rq->delete_queue, next);
+    // nothing else to do here, help the busiest cpu
+    if(!next && (!add_back || rq->current_thread == rq->idle_thread)) {
+        next = steal_thread(cpu);
+        if(next && is_dead(next)) {
+            thread_queue_push(&rq->delete_queue, next);
+            next = NULL;
+        }
+    }
+    if(!next) {
+        // keep running the current thread if it still can
+        // else fall back to the idle thread
+        if(add_back || !rq->idle_thread || rq->current_thread == rq->idle_thread) return;
+        next = rq->idle_thread;
+    }
 
     // save registers
-    if(regs) memcpy(&current_process->regs, regs, sizeof(regs_t));
-    
-    if(add_back) {
-        current_process->state = PROCESS_STATE_READY;
-        process_queue_push(&ready_queue, current_process);
+    // nobody may resume the thread before we are off its stack, see scheduler_finish_switch
+    if(regs) save_frame(rq->current_thread, regs);
+    atomic_store(&rq->current_thread->stack_in_use, true);
+    rq->prev_thread = rq->current_thread;
+
+    // waiters stop spinning on the mutexes of a thread that is not running
+    mutex_set_owner_running(rq->current_thread, false);
+    mutex_set_owner_running(next, true);
+
+    // the current thread only changes under the lock so scheduler_get_cpu_threads can read it safely
+    uint32_t eflags = ticketlock_acquire_irqsave(&rq->lock);
+
+    // the idle thread never goes into the ready queue
+    if(add_back && rq->current_thread != rq->idle_thread) {
+        rq->current_thread->state = THREAD_STATE_READY;
+        thread_queue_push(&rq->ready_queue, rq->current_thread);
     }
 
-    current_process = process_queue_pop(&ready_queue);
-    current_process->state = PROCESS_STATE_ACTIVE;
+    rq->current_thread = next;
+    rq->current_thread->state = THREAD_STATE_ACTIVE;
+    rq->current_thread->last_cpu = cpu;
+
+    ticketlock_release_irqrestore(&rq->lock, eflags);
+
+    rq->thread_switched = true;
+}
+
+// called by isr_handler when the interrupt is done
+// return the frame the interrupt stub returns through, the one of another thread if there was a switch
+regs_t* scheduler_resume_frame(regs_t* regs) {
+    runqueue_t* rq = this_runqueue();
+    regs_t* frame = rq->resume_frame;
+    if(!frame) return regs;
+
+    rq->resume_frame = NULL;
+    return frame;
+}
 
-    process_switched = true;
+// return true if the current interrupt switched to another thread
+bool scheduler_thread_switched() {
+    return this_runqueue()->resume_frame != NULL;
 }
 
-process_t* scheduler_get_current_process() {
-    return current_process;
+// called by the interrupt stub once it runs on the stack of the thread switched to
+// the previous thread can be resumed by other cpus from now on
+void scheduler_finish_switch() {
+    runqueue_t* rq = this_runqueue();
+    if(!rq->prev_thread) return;
+
+    atomic_store(&rq->prev_thread->stack_in_use, false);
+    rq->prev_thread = NULL;
 }
 
-process_t* scheduler_get_ready_processes() {
-    return ready_queue.top;
+thread_t* scheduler_get_current_thread() {
+    return this_runqueue()->current_thread;
 }
 
-process_t* scheduler_get_sleep_processes() {
-    return sleep_queue.top;
+static void copy_thread_info(thread_info_t* info, thread_t* thread) {
+    info->id = thread->id;
+    info->process_id = thread->process->id;
+    info->priority = thread->priority;
+    info->state = thread->state;
+    info->alive_ticks = thread->alive_ticks;
+    info->sleep_ticks = thread->sleep_ticks;
 }
 
+// copy the running thread of a cpu and then its ready threads to infos
+// the threads may be freed as soon as the lock is released so only copies are handed out
+// return how many were copied, 0 if the cpu is not running
+unsigned scheduler_get_cpu_threads(unsigned cpu, thread_info_t* infos, unsigned max) {
+    if(cpu >= MAX_CPU || !max) return 0;
+
+    runqueue_t* rq = &runqueues[cpu];
+    uint32_t eflags = ticketlock_acquire_irqsave(&rq->lock);
+
+    unsigned count = 0;
+    if(rq->current_thread) {
+        copy_thread_info(&infos[count++], rq->current_thread);
+        for(thread_t* thread = rq->ready_queue.top; thread && count < max; thread = thread->next)
+            copy_thread_info(&infos[count++], thread);
+    }
+
+    ticketlock_release_irqrestore(&rq->lock, eflags);
+
+    return count;
+}
+
+// copy the sleeping threads to infos, return how many were copied
+unsigned scheduler_get_sleep_threads(thread_info_t* infos, unsigned max) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&sleep_lock);
+
+    unsigned count = 0;
+    for(thread_t* thread = sleep_queue.top; thread && count < max; thread = thread->next)
+        copy_thread_info(&infos[count++], thread);
+
+    ticketlock_release_irqrestore(&sleep_lock, eflags);
+
+    return count;
+}
+
+void scheduler_add_thread(thread_t* thread) {
+    // it has been taken off its wait queue, nobody may requeue it there any more
+    uint32_t eflags = ticketlock_acquire_irqsave(&thread->lock);
+    thread->wait_queue = NULL;
+    thread->wait_queue_lock = NULL;
+    ticketlock_release_irqrestore(&thread->lock, eflags);
+
+    enqueue_ready(thread);
+}
+
+// a new process only has its main thread
 void scheduler_add_process(process_t* proc) {
-    proc->state = PROCESS_STATE_READY;
-    process_queue_push(&ready_queue, proc);
+    enqueue_ready(proc->threads);
+}
+
+// stop the current thread for good
+static void exit_current(runqueue_t* rq) {
+    thread_t* thread = rq->current_thread;
+
+    // dont save registers, dont add thread back to ready queue
+    to_next_thread(rq, NULL, false);
+    if(!rq->thread_switched) return;
+
+    // because we are using the stack of the thread
+    // and thread_finish() will free the stack
+    // we will postpone it
+    // and do it later when we are using other thread's stack
+    thread_queue_push(&rq->delete_queue, thread);
+
+    context_switch(rq);
 }
 
-// put current process to delete queue, delete it later
-void scheduler_kill_process(regs_t* regs) {
-    if(current_process->id == 1) return; // avoid deleting kernel process
+// take the threads of proc that wait in a join or a sleep off their queue and put them in dead
+// nothing would ever wake a thread joining another one that waits forever
+// threads waiting for kernel locks are left alone, they stop once they are back in usermode
+// proc->lock must be held
+static void unlink_waiting_threads(process_t* proc, thread_queue_t* dead) {
+    for(thread_t* thread = proc->threads; thread; thread = thread->sibling) {
+        // the registers are saved before the thread is put in any queue
+        if(!(thread->regs.cs & 3)) continue;
+
+        if(thread->state == THREAD_STATE_BLOCK) {
+            // the join queues are protected by proc->lock too
+            for(thread_t* joined = proc->threads; joined; joined = joined->sibling) {
+                if(!thread_queue_remove(&joined->join_queue, thread)) {
+                    thread_queue_push(dead, thread);
+                    break;
+                }
+            }
+        }
+        else if(thread->state == THREAD_STATE_SLEEP) {
+            ticketlock_acquire(&sleep_lock);
+            bool removed = !thread_queue_remove(&sleep_queue, thread);
+            ticketlock_release(&sleep_lock);
+            if(removed) thread_queue_push(dead, thread);
+        }
+    }
+}
 
-    // because we are using the stack of the process
-    // and process_delete() will free the stack
-    // we will postpone the process deleting
-    // and do it later when we are using other process's stack
-    process_queue_push(&delete_queue, current_process);
+// kill the whole process of the current thread
+// its waiting threads are finished here, the other ones the next time they are scheduled
+void scheduler_kill_process() {
+    runqueue_t* rq = this_runqueue();
+    process_t* proc = rq->current_thread->process;
+    // avoid killing kernel process, which also owns the idle threads
+    if(proc->id == 1) return;
+
+    thread_queue_t dead = THREAD_QUEUE_INIT;
+    ticketlock_acquire(&proc->lock);
+    proc->killed = true;
+    unlink_waiting_threads(proc, &dead);
+    ticketlock_release(&proc->lock);
+
+    // finished on the next tick like the exiting thread, thread_finish takes proc->lock
+    thread_t* thread;
+    while((thread = thread_queue_pop(&dead)))
+        thread_queue_push(&rq->delete_queue, thread);
+
+    exit_current(rq);
+}
+
+void scheduler_exit_thread() {
+    runqueue_t* rq = this_runqueue();
+    if(rq->current_thread == rq->idle_thread) return;
 
-    // dont save registers, dont add process back to ready queue
-    to_next_process(NULL, false);
-    // process switching always happens because there is always a kernel process to switch to
-    context_switch(regs);
+    exit_current(rq);
 }
 
 void scheduler_set_sleep(regs_t* regs, unsigned ticks) {
+    runqueue_t* rq = this_runqueue();
+    thread_t* thread = rq->current_thread;
+
+    // save registers, dont add thread back to ready queue
+    // this must be done before it can be woken up by the BSP
+    to_next_thread(rq, regs, false);
+
+    ticketlock_acquire(&sleep_lock);
     // set sleep target
-    current_process->sleep_ticks = ticks + global_sleep_ticks;
+    thread->sleep_ticks = ticks + global_sleep_ticks;
+    thread->state = THREAD_STATE_SLEEP;
+    thread_queue_sorted_push(&sleep_queue, thread, thread_sort_by_sleep_ticks);
+    ticketlock_release(&sleep_lock);
 
-    current_process->state = PROCESS_STATE_SLEEP;
-    process_queue_sorted_push(&sleep_queue, current_process, process_sort_by_sleep_ticks);
-    // save registers, dont add process back to ready queue
-    to_next_process(regs, false);
+    if(rq->thread_switched) context_switch(rq);
+}
+
+// block the current thread on a wait queue
+// the caller must hold the lock that protects the queue, it will be released here
+// the queue is kept sorted by priority so the most important waiter is woken first
+void scheduler_block(thread_queue_t* queue, ticketlock_t* lock, regs_t* regs) {
+    runqueue_t* rq = this_runqueue();
+    thread_t* thread = rq->current_thread;
+
+    // save registers, dont add thread back to ready queue
+    // the lock stays held so the thread can not be woken up before the registers are saved
+    // this always switches since there is at least the idle thread to switch to
+    to_next_thread(rq, regs, false);
+
+    // so a priority boost can move it up in the queue, see mutex.c
+    // a boost that comes before this is already seen by the sorted push
+    ticketlock_acquire(&thread->lock);
+    thread->wait_queue = queue;
+    thread->wait_queue_lock = lock;
+    ticketlock_release(&thread->lock);
 
-    if(process_switched) context_switch(regs);
+    thread->state = THREAD_STATE_BLOCK;
+    thread_queue_sorted_push(queue, thread, thread_sort_by_priority);
+
+    ticketlock_release(lock);
+
+    if(rq->thread_switched) context_switch(rq);
 }
 
-void scheduler_switch(regs_t* regs) {
-    while(delete_queue.size)
-        process_delete(process_queue_pop(&delete_queue));
+typedef struct {
+    thread_queue_t* queue;
+    ticketlock_t* lock;
+} wait_t;
+
+static regs_t* block_on_frame(regs_t* regs, void* arg) {
+    wait_t* wait = arg;
+    scheduler_block(wait->queue, wait->lock, regs);
+    return scheduler_resume_frame(regs);
+}
+
+// block the current thread from kernel code, like scheduler_block
+// the caller must hold the lock with interrupts off, it will be released here
+// the kernel context of the caller is saved on its own stack and this returns once the thread is woken up
+void scheduler_wait(thread_queue_t* queue, ticketlock_t* lock) {
+    wait_t wait = {queue, lock};
+    isr_call_with_frame(block_on_frame, &wait);
+}
+
+// wake up threads whose sleep target is reached
+// only the BSP counts sleep ticks
+static void wake_sleeping_threads() {
+    ticketlock_acquire(&sleep_lock);
 
     if(sleep_queue.size) {
         global_sleep_ticks++;
         while(sleep_queue.top && sleep_queue.top->sleep_ticks <= global_sleep_ticks) {
-            process_t* proc = process_queue_pop(&sleep_queue);
-            proc->state = PROCESS_STATE_READY;
-            process_queue_push(&ready_queue, proc);
+            thread_t* thread = thread_queue_pop(&sleep_queue);
+            enqueue_ready(thread);
         }
 
         // avoid overflow
@@ -112,26 +505,91 @@ void scheduler_switch(regs_t* regs) {
         if(sleep_queue.size == 0) global_sleep_ticks = 0;
     }
 
+    ticketlock_release(&sleep_lock);
+}
+
+// called on every timer tick of each cpu
+void scheduler_switch(regs_t* regs) {
+    unsigned cpu = smp_get_cpu_id();
+    runqueue_t* rq = &runqueues[cpu];
+    // not initialised yet
+    if(!rq->current_thread) return;
+
+    while(rq->delete_queue.size)
+        thread_finish(thread_queue_pop(&rq->delete_queue));
+
+    if(cpu == 0) wake_sleeping_threads();
+
+    rq->ticks++;
+    if(rq->ticks % SCHEDULER_BALANCE_TICKS == 0) rebalance(rq, cpu);
+
+    // the process got killed by another of its threads
+    if(!rq->thread_switched && rq->current_thread->process->killed && (regs->cs & 3)) {
+        exit_current(rq);
+        return;
+    }
+
     // switch to other thread if exceeded max runtime
-    if(!process_switched && current_process->alive_ticks % PROCESS_ALIVE_TICKS == 0)
-        to_next_process(regs, true);
+    // or if the idle thread is running while there is something to do
+    if(!rq->thread_switched
+            && (rq->current_thread->alive_ticks % PROCESS_ALIVE_TICKS == 0
+                || rq->current_thread == rq->idle_thread))
+        to_next_thread(rq, regs, true);
+
+    rq->current_thread->alive_ticks++;
+
+    if(rq->thread_switched) context_switch(rq);
+}
 
-    current_process->alive_ticks++;
+// give the calling cpu an idle thread
+static bool init_idle_thread(runqueue_t* rq) {
+    thread_t* idle = thread_new(kernel_proc, (uint32_t)cpu_idle, 0);
+    if(!idle) return true;
 
-    if(process_switched) context_switch(regs);
+    idle->last_cpu = rq - runqueues;
+    rq->idle_thread = idle;
+
+    return false;
 }
 
-void scheduler_init(process_t* proc) {
+// return true if there is not enough memory for the idle thread
+bool scheduler_init(process_t* proc) {
     // add the first process
 
-    proc->state = PROCESS_STATE_ACTIVE;
-    current_process = proc;
-    current_process->id = 1;
+    kernel_proc = proc;
+    kernel_proc->id = 1;
+
+    runqueue_t* rq = &runqueues[0];
+    rq->current_thread = proc->threads;
+    rq->current_thread->state = THREAD_STATE_ACTIVE;
+    rq->current_thread->last_cpu = 0;
+
+    runqueue_init_stats(0);
+    lock_stats_register(&sleep_lock_stats, "sleep queue");
+    sleep_lock.stats = &sleep_lock_stats;
 
     // note that we do not switch page directory
     // because kernel page directory is preloaded
 
-    process_switched = true;
+    rq->thread_switched = true;
+
+    return init_idle_thread(rq);
+}
+
+// called by each AP, the AP starts with its idle thread
+// return true if there is not enough memory for the idle thread
+bool scheduler_init_cpu() {
+    runqueue_t* rq = this_runqueue();
+    if(init_idle_thread(rq)) return true;
+
+    rq->idle_thread->state = THREAD_STATE_ACTIVE;
+    rq->current_thread = rq->idle_thread;
+
+    runqueue_init_stats(smp_get_cpu_id());
+
+    rq->thread_switched = true;
+
+    return false;
 }
 
 // semaphores interract closely to the scheduler so i put them here
@@ -145,30 +603,32 @@ semaphore_t* semaphore_create(unsigned max_count) {
         ret->waiting_queue.top = NULL;
         ret->waiting_queue.bottom = NULL;
         ret->waiting_queue.size = 0;
+        ret->lock = (ticketlock_t)TICKETLOCK_INIT;
     }
 
     return ret;
 }
 
-void semaphore_acquire(semaphore_t* semaphore, regs_t* regs) {
+void semaphore_acquire(semaphore_t* semaphore) {
+    uint32_t eflags = ticketlock_acquire_irqsave(&semaphore->lock);
+
     if(semaphore->current_count < semaphore->max_count) {
         semaphore->current_count++;
+        ticketlock_release_irqrestore(&semaphore->lock, eflags);
+        return;
     }
-    else {
-        current_process->state = PROCESS_STATE_BLOCK;
-        process_queue_push(&semaphore->waiting_queue, current_process);
 
-        // save registers, dont add process back to ready queue
-        to_next_process(regs, false);
-        if(process_switched) context_switch(regs);
-    }
+    scheduler_wait(&semaphore->waiting_queue, &semaphore->lock);
+    irq_restore(eflags);
 }
 
 void semaphore_release(semaphore_t* semaphore) {
-    if(semaphore->waiting_queue.size) {
-        process_t* proc = process_queue_pop(&semaphore->waiting_queue);
-        proc->state = PROCESS_STATE_READY;
-        process_queue_push(&ready_queue, proc);
-    }
-    else semaphore->current_count--;
+    uint32_t eflags = ticketlock_acquire_irqsave(&semaphore->lock);
+
+    thread_t* thread = thread_queue_pop(&semaphore->waiting_queue);
+    if(!thread) semaphore->current_count--;
+
+    ticketlock_release_irqrestore(&semaphore->lock, eflags);
+
+    if(thread) enqueue_ready(thread);
 }
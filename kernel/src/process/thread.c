@@ -0,0 +1,267 @@
+#include "process.h"
+#include "system.h"
+#include "mem.h"
+
+#define DEFAULT_EFLAGS 0x202
+
+static atomic_uint thread_count = 0;
+
+// take a free user stack slot and return the lowest address of its stack, 0 if all slots are used
+// must be called with the process's lock held
+static uint32_t alloc_user_stack(process_t* proc) {
+    for(unsigned i = 0; i < USTACK_MAX_COUNT; i++) {
+        if(proc->stack_slots & (1u << i)) continue;
+
+        proc->stack_slots |= 1u << i;
+        return USTACK_REGION_START + i * USTACK_SLOT_SIZE + MMNGR_PAGE_SIZE;
+    }
+    return 0;
+}
+
+// must be called with the process's lock held
+static void unlink_thread(process_t* proc, thread_t* thread) {
+    thread_t** link = &proc->threads;
+    while(*link && *link != thread) link = &(*link)->sibling;
+    if(*link) *link = thread->sibling;
+}
+
+// the stack the thread runs on in kernel mode, a kernel thread runs on it all the time
+// return true if there is not enough memory
+static bool alloc_kernel_stack(thread_t* thread) {
+    thread->kernel_stack = (uint32_t)kmalloc(THREAD_KERNEL_STACK_SIZE);
+    atomic_store(&thread->stack_in_use, false);
+    return !thread->kernel_stack;
+}
+
+// create a new thread in proc, it still has to be added to the scheduler
+// it gets its own stacks and registers, everything else is shared with the process
+thread_t* thread_new(process_t* proc, uint32_t eip, int priority) {
+    thread_t* thread = (thread_t*)kmalloc(sizeof(thread_t));
+    if(!thread) return NULL;
+    if(alloc_kernel_stack(thread)) {
+        kfree(thread);
+        return NULL;
+    }
+
+    thread->id = atomic_fetch_add(&thread_count, 1) + 1;
+    thread->priority = priority;
+    thread->base_priority = priority;
+    thread->state = THREAD_STATE_READY;
+    thread->alive_ticks = 0;
+    thread->sleep_ticks = 0;
+    thread->last_cpu = -1;
+    thread->stack_addr = 0;
+    thread->process = proc;
+    thread->exit_code = 0;
+    thread->join_queue = (thread_queue_t)THREAD_QUEUE_INIT;
+    thread->wait_queue = NULL;
+    thread->wait_queue_lock = NULL;
+    thread->lock = (ticketlock_t)TICKETLOCK_INIT;
+    thread->priority_boosts = 0;
+    thread->held_mutexes = NULL;
+    thread->next = NULL;
+
+    regs_t* regs = &thread->regs;
+    regs->eip = eip;
+    regs->eflags = DEFAULT_EFLAGS;
+    regs->ebp = 0;
+    if(proc->heap) {
+        regs->cs = 0x1b; // user code selector
+        regs->ds = 0x23; // user data selector
+    }
+    else {
+        regs->cs = 0x08; // kernel code selector
+        regs->ds = 0x10; // kernel data selector
+    }
+    regs->es = regs->ds;
+    regs->fs = regs->ds;
+    regs->gs = regs->ds;
+    regs->ss = regs->ds;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&proc->lock);
+
+    // nothing is mapped here, the stack pages are zero-filled when first touched
+    if(proc->heap) thread->stack_addr = alloc_user_stack(proc);
+
+    bool ok = !proc->heap || thread->stack_addr;
+    if(ok) {
+        thread->sibling = proc->threads;
+        proc->threads = thread;
+        proc->alive_threads++;
+    }
+
+    ticketlock_release_irqrestore(&proc->lock, eflags);
+
+    if(!ok) {
+        kfree((void*)thread->kernel_stack);
+        kfree(thread);
+        return NULL;
+    }
+
+    // for a kernel thread this is where esp is left by the iret that starts it, see load_frame() in scheduler.c
+    if(proc->heap) regs->useresp = thread->stack_addr + USTACK_SIZE;
+    else regs->useresp = thread->kernel_stack + THREAD_KERNEL_STACK_SIZE;
+
+    return thread;
+}
+
+// copy a thread into a forked process, it continues from the same registers
+// its stack is at the same address in the copied address space
+thread_t* thread_fork(process_t* proc, thread_t* src, regs_t* regs) {
+    thread_t* thread = (thread_t*)kmalloc(sizeof(thread_t));
+    if(!thread) return NULL;
+    if(alloc_kernel_stack(thread)) {
+        kfree(thread);
+        return NULL;
+    }
+
+    thread->id = atomic_fetch_add(&thread_count, 1) + 1;
+    thread->priority = src->base_priority;
+    thread->base_priority = src->base_priority;
+    thread->state = THREAD_STATE_READY;
+    thread->alive_ticks = 0;
+    thread->sleep_ticks = 0;
+    thread->last_cpu = -1;
+    thread->stack_addr = src->stack_addr;
+    thread->process = proc;
+    thread->exit_code = 0;
+    thread->join_queue = (thread_queue_t)THREAD_QUEUE_INIT;
+    thread->wait_queue = NULL;
+    thread->wait_queue_lock = NULL;
+    thread->lock = (ticketlock_t)TICKETLOCK_INIT;
+    thread->priority_boosts = 0;
+    thread->held_mutexes = NULL;
+    thread->next = NULL;
+
+    thread->regs = *regs;
+    thread->regs.eax = 0; // fork returns 0 in the child
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&proc->lock);
+    thread->sibling = proc->threads;
+    proc->threads = thread;
+    proc->alive_threads++;
+    ticketlock_release_irqrestore(&proc->lock, eflags);
+
+    return thread;
+}
+
+// called once an exited thread will never run again, from another thread's stack
+// wake up its joiners and free it, or keep it as a zombie until it is joined
+void thread_finish(thread_t* thread) {
+    process_t* proc = thread->process;
+
+    // we are on another thread's stack but the cpu that switched away from this one may not have left it yet
+    // user stacks are freed in thread_exit or together with the page directory
+    while(atomic_load(&thread->stack_in_use)) __builtin_ia32_pause();
+    kfree((void*)thread->kernel_stack);
+    thread->kernel_stack = 0;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&proc->lock);
+
+    thread_queue_t joiners = thread->join_queue;
+    thread->join_queue = (thread_queue_t)THREAD_QUEUE_INIT;
+    int exit_code = thread->exit_code;
+
+    // nobody is going to join a thread of a killed process
+    bool reap = joiners.size || proc->killed;
+    if(reap) unlink_thread(proc, thread);
+    else thread->state = THREAD_STATE_ZOMBIE;
+
+    proc->alive_threads--;
+    bool last = proc->alive_threads == 0;
+
+    ticketlock_release_irqrestore(&proc->lock, eflags);
+
+    if(reap) kfree(thread);
+
+    thread_t* joiner;
+    while((joiner = thread_queue_pop(&joiners))) {
+        // the joiner is blocked in the join syscall, this is its return value
+        joiner->regs.eax = exit_code;
+        scheduler_add_thread(joiner);
+    }
+
+    if(last) process_reap(proc);
+}
+
+// start a new thread in the current process
+// the entry point gets arg like a normal function argument and must end with thread_exit
+// return the new thread's id, -1 if there is not enough memory
+int thread_create(uint32_t eip, uint32_t arg) {
+    thread_t* self = scheduler_get_current_thread();
+    thread_t* thread = thread_new(self->process, eip, self->base_priority);
+    if(!thread) return -1;
+
+    // we are in the page directory of the process so the new stack can be written directly
+    uint32_t* stack = (uint32_t*)thread->regs.useresp;
+    *(--stack) = arg;
+    *(--stack) = 0; // there is nothing to return to
+    thread->regs.useresp = (uint32_t)stack;
+
+    // the thread may already be gone once it is in the scheduler
+    int id = thread->id;
+    scheduler_add_thread(thread);
+
+    return id;
+}
+
+// wait until a thread of the current process exits and return its exit code
+// return -1 if there is no such thread
+// called in syscall context
+int thread_join(int id, regs_t* regs) {
+    thread_t* self = scheduler_get_current_thread();
+    process_t* proc = self->process;
+
+    ticketlock_acquire(&proc->lock);
+
+    // scheduler_kill_process would not see a thread that starts waiting after it
+    if(proc->killed) {
+        ticketlock_release(&proc->lock);
+        return -1;
+    }
+
+    thread_t* thread = proc->threads;
+    while(thread && thread->id != id) thread = thread->sibling;
+    if(!thread || thread == self) {
+        ticketlock_release(&proc->lock);
+        return -1;
+    }
+
+    if(thread->state != THREAD_STATE_ZOMBIE) {
+        // thread_finish will set the return value
+        scheduler_block(&thread->join_queue, &proc->lock, regs);
+        return 0;
+    }
+
+    int exit_code = thread->exit_code;
+    unlink_thread(proc, thread);
+
+    ticketlock_release(&proc->lock);
+
+    kfree(thread);
+    return exit_code;
+}
+
+// end the current thread, the process ends with its last thread
+// called in syscall context
+void thread_exit(int exit_code) {
+    thread_t* self = scheduler_get_current_thread();
+    process_t* proc = self->process;
+
+    self->exit_code = exit_code;
+
+    // the syscall runs on the kernel stack and in the page directory of the process
+    // so a user stack can be freed right away
+    if(proc->heap) {
+        vmmngr_unmap_range(NULL, self->stack_addr, USTACK_SIZE);
+
+        // only give the slot back once it is empty
+        unsigned slot = (self->stack_addr - USTACK_REGION_START) / USTACK_SLOT_SIZE;
+        uint32_t eflags = ticketlock_acquire_irqsave(&proc->lock);
+        proc->stack_slots &= ~(1u << slot);
+        ticketlock_release_irqrestore(&proc->lock, eflags);
+        self->stack_addr = 0;
+    }
+
+    scheduler_exit_thread();
+}
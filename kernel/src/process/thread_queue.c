@@ -0,0 +1,76 @@
+#include "process.h"
+
+bool thread_sort_by_sleep_ticks(thread_t* a, thread_t* b) {
+    return a->sleep_ticks < b->sleep_ticks;
+}
+
+// threads with the same priority keep their order
+bool thread_sort_by_priority(thread_t* a, thread_t* b) {
+    return a->priority >= b->priority;
+}
+
+void thread_queue_push(thread_queue_t* queue, thread_t* thread) {
+    thread->next = NULL;
+
+    if(queue->top == NULL) queue->top = thread;
+    else queue->bottom->next = thread;
+
+    queue->bottom = thread;
+
+    queue->size++;
+}
+
+void thread_queue_sorted_push(thread_queue_t* queue, thread_t* thread, bool (*cmp)(thread_t*, thread_t*)) {
+    if(!queue->top) {
+        thread->next = NULL;
+        queue->top = thread;
+        queue->bottom = thread;
+        goto done;
+    }
+
+    if(!cmp(queue->top, thread)) {
+        thread->next = queue->top;
+        queue->top = thread;
+        goto done;
+    }
+
+    thread_t* prev = queue->top;
+    while(prev->next && cmp(prev->next, thread)) prev = prev->next;
+    if(!prev->next) queue->bottom = thread;
+
+    thread->next = prev->next;
+    prev->next = thread;
+
+    done:
+    queue->size++;
+}
+
+thread_t* thread_queue_pop(thread_queue_t* queue) {
+    thread_t* ret = queue->top;
+    if(!ret) return ret;
+
+    if(ret == queue->bottom) queue->top = NULL;
+    else queue->top = queue->top->next;
+
+    queue->size--;
+    return ret;
+}
+
+// return true if the thread is not in the queue
+bool thread_queue_remove(thread_queue_t* queue, thread_t* thread) {
+    if(!queue->top) return true;
+    if(queue->top == thread) {
+        thread_queue_pop(queue);
+        return false;
+    }
+
+    thread_t* prev = queue->top;
+    while(prev && prev->next != thread) prev = prev->next;
+    if(!prev) return true;
+
+    prev->next = thread->next;
+    if(queue->bottom == thread) queue->bottom = prev;
+
+    queue->size--;
+    return false;
+}
@@ -0,0 +1,159 @@
+#include "process.h"
+#include "mem.h"
+#include "debug.h"
+
+#include "string.h"
+
+#define PAGE_ALIGN_DOWN(addr) ((addr) & ~(MMNGR_PAGE_SIZE - 1))
+// how many areas can share a page, segments rarely share one with more than their neighbour
+#define VM_AREA_MAX_PER_PAGE 4
+
+// return true if there is not enough memory
+bool vm_area_add(process_t* proc, uint32_t start, uint32_t end, uint32_t file_offset, uint32_t file_size, bool writable) {
+    vm_area_t* area = (vm_area_t*)kmalloc(sizeof(vm_area_t));
+    if(!area) return true;
+
+    area->start = start;
+    area->end = end;
+    area->file_offset = file_offset;
+    area->file_size = file_size;
+    area->writable = writable;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&proc->vm_lock);
+    area->next = proc->areas;
+    proc->areas = area;
+    ticketlock_release_irqrestore(&proc->vm_lock, eflags);
+
+    return false;
+}
+
+// give a forked process the areas of its parent
+// the parent has a single thread, which is in the fork syscall, so nobody changes its areas meanwhile
+// return true if there is not enough memory
+bool vm_area_copy_all(process_t* dst, process_t* src) {
+    for(vm_area_t* area = src->areas; area; area = area->next)
+        if(vm_area_add(dst, area->start, area->end, area->file_offset, area->file_size, area->writable))
+            return true;
+
+    return false;
+}
+
+// the pages themselves go away with the page directory
+void vm_area_free_all(process_t* proc) {
+    while(proc->areas) {
+        vm_area_t* area = proc->areas;
+        proc->areas = area->next;
+        kfree(area);
+    }
+}
+
+// read the part of an area that lies in the page into buffer, which holds the whole page
+// the rest of the buffer is left as it is
+static bool fill_page(process_t* proc, const vm_area_t* area, uint32_t page, uint8_t* buffer) {
+    uint32_t file_end = area->start + area->file_size;
+    uint32_t from = page > area->start ? page : area->start;
+    uint32_t to = page + MMNGR_PAGE_SIZE < file_end ? page + MMNGR_PAGE_SIZE : file_end;
+    if(from >= to) return false;
+
+    return file_read_at(&proc->image, area->file_offset + (from - area->start), buffer + (from - page), to - from) != ERR_FS_SUCCESS;
+}
+
+// the heap and the thread stacks have no content yet, they are only zero-filled
+static bool is_anonymous(thread_t* thread, uint32_t addr) {
+    process_t* proc = thread->process;
+    if(addr >= UHEAP_START && addr < UHEAP_START + UHEAP_MAX_SIZE) return true;
+    if(addr < USTACK_REGION_START) return false;
+
+    uint32_t offset = addr - USTACK_REGION_START;
+    if(offset % USTACK_SLOT_SIZE < MMNGR_PAGE_SIZE) {
+        print_debug(LT_ER, "stack overflow in thread %d\n", thread->id);
+        return false;
+    }
+
+    return proc->stack_slots & (1u << (offset / USTACK_SLOT_SIZE));
+}
+
+// map a page of the current process's lazily mapped areas on its first access
+// the content is read while no lock is held, the page is only mapped once it is complete and with its final flags
+// so other threads of the process never see it half filled or writable when it should not be
+// return true if the fault does not belong to any area, which is a real error
+bool vm_area_page_fault(uint32_t addr, bool present) {
+    // only not-present pages are mapped lazily
+    if(present || addr >= KERNEL_START) return true;
+
+    thread_t* thread = scheduler_get_current_thread();
+    if(!thread || !thread->process->heap) return true;
+    process_t* proc = thread->process;
+
+    uint32_t page = PAGE_ALIGN_DOWN(addr);
+
+    // segments do not have to be page aligned so a page may be shared by a few of them
+    // copy them out since the list may change once the lock is released
+    vm_area_t parts[VM_AREA_MAX_PER_PAGE];
+    unsigned part_count = 0;
+    bool found = is_anonymous(thread, addr);
+    bool writable = found;
+    bool too_many = false;
+
+    uint32_t eflags = ticketlock_acquire_irqsave(&proc->vm_lock);
+
+    // another thread may have mapped it already
+    if(vmmngr_to_physical_addr(NULL, page)) {
+        ticketlock_release_irqrestore(&proc->vm_lock, eflags);
+        return false;
+    }
+
+    for(vm_area_t* area = proc->areas; area; area = area->next) {
+        if(area->start >= page + MMNGR_PAGE_SIZE || area->end <= page) continue;
+        if(addr >= area->start && addr < area->end) found = true;
+        writable |= area->writable;
+
+        if(part_count == VM_AREA_MAX_PER_PAGE) too_many = true;
+        else parts[part_count++] = *area;
+    }
+    ticketlock_release_irqrestore(&proc->vm_lock, eflags);
+
+    if(!found || too_many) return true;
+
+    physical_addr_t phys = (physical_addr_t)zero_pool_alloc();
+    if(!phys) return true;
+
+    // the file is read into a buffer first, reading may sleep and move us to another cpu
+    // and the frame can only be reached through the window of the cpu we are on
+    bool err = false;
+    uint8_t* buffer = NULL;
+    for(unsigned i = 0; i < part_count && !err; i++) {
+        if(parts[i].start + parts[i].file_size <= page) continue;
+
+        if(!buffer) {
+            buffer = (uint8_t*)kmalloc(MMNGR_PAGE_SIZE);
+            if(!buffer) {
+                err = true;
+                break;
+            }
+            memset(buffer, 0, MMNGR_PAGE_SIZE);
+        }
+        err = fill_page(proc, &parts[i], page, buffer);
+    }
+    if(buffer) {
+        if(!err) zero_pool_write_frame(phys, 0, buffer, MMNGR_PAGE_SIZE);
+        kfree(buffer);
+    }
+
+    if(err) {
+        pmmngr_free_block((void*)phys);
+        return true;
+    }
+
+    eflags = ticketlock_acquire_irqsave(&proc->vm_lock);
+
+    // another thread may have mapped it while we were reading
+    bool mapped = vmmngr_to_physical_addr(NULL, page);
+    if(!mapped) err = vmmngr_map(NULL, phys, page, PTE_USER | (writable ? PTE_WRITABLE : 0));
+
+    ticketlock_release_irqrestore(&proc->vm_lock, eflags);
+
+    if(mapped || err) pmmngr_free_block((void*)phys);
+
+    return err;
+}
@@ -1,6 +1,7 @@
 #include "syscall.h"
 #include "system.h"
 #include "process.h"
+#include "video.h"
 
 #include "stdio.h"
 #include "time.h"
@@ -11,14 +12,84 @@ syscalls[id] = func
 
 static void* syscalls[MAX_SYSCALL];
 
-static regs_t regs_copy;
+// the interrupt frame of the syscall each cpu is running, on the kernel stack of the calling thread
+static regs_t* syscall_regs[MAX_CPU];
 
 static void proc_kill() {
-    scheduler_kill_process(&regs_copy);
+    scheduler_kill_process();
 }
 
 static void proc_sleep(unsigned ticks) {
-    scheduler_set_sleep(&regs_copy, ticks);
+    scheduler_set_sleep(syscall_regs[smp_get_cpu_id()], ticks);
+}
+
+static int thread_join_syscall(int id) {
+    return thread_join(id, syscall_regs[smp_get_cpu_id()]);
+}
+
+static void thread_exit_syscall(int exit_code) {
+    thread_exit(exit_code);
+}
+
+static int fork() {
+    return process_fork(syscall_regs[smp_get_cpu_id()]);
+}
+
+// make sure the kernel can write size bytes at a user address without faulting
+// lazily mapped pages are mapped and copy-on-write pages copied first
+// return true if the range is not writable user memory
+static bool prepare_user_write(void* ptr, size_t size) {
+    uint32_t start = (uint32_t)ptr;
+    if(start >= KERNEL_START || size > KERNEL_START - start) return true;
+
+    for(uint32_t page = start & ~(MMNGR_PAGE_SIZE - 1); page < start + size; page += MMNGR_PAGE_SIZE) {
+        if(!vmmngr_to_physical_addr(NULL, page) && vm_area_page_fault(page, false)) return true;
+        // a page that is not copy-on-write is left as it is, the check below decides
+        vmmngr_copy_on_write(page);
+        if(!vmmngr_is_user_writable(page)) return true;
+    }
+    return false;
+}
+
+// a user process draws into its own copy of the screen at UFRAMEBUFFER_START and presents parts of it
+// it is not the framebuffer itself, the frames of a process are freed with its page directory
+// and the framebuffer is not memory the pmmngr owns
+// the pages are all mapped here so presenting never faults
+static void* framebuffer_map_syscall(framebuffer_info_t* info) {
+    process_t* proc = scheduler_get_current_thread()->process;
+    if(!proc->heap || !video_using_framebuffer()) return NULL;
+    // checked before anything is mapped so a bad pointer leaves the process as it was
+    if(prepare_user_write(info, sizeof(framebuffer_info_t))) return NULL;
+
+    framebuffer_info_t fb;
+    video_vesa_get_framebuffer_info(&fb);
+    size_t size = (fb.pitch * fb.height + MMNGR_PAGE_SIZE - 1) & ~(MMNGR_PAGE_SIZE - 1);
+    if(size > UFRAMEBUFFER_MAX_SIZE) return NULL;
+
+    bool err = false;
+    uint32_t eflags = ticketlock_acquire_irqsave(&proc->lock);
+    // already mapped by another thread or before a fork
+    if(!vmmngr_to_physical_addr(NULL, UFRAMEBUFFER_START)) {
+        for(size_t offset = 0; offset < size && !err; offset += MMNGR_PAGE_SIZE) {
+            physical_addr_t phys = (physical_addr_t)zero_pool_alloc();
+            err = !phys || vmmngr_map(NULL, phys, UFRAMEBUFFER_START + offset, PTE_USER | PTE_WRITABLE);
+            if(err && phys) pmmngr_free_block((void*)phys);
+        }
+        if(err) vmmngr_unmap_range(NULL, UFRAMEBUFFER_START, size);
+    }
+    ticketlock_release_irqrestore(&proc->lock, eflags);
+
+    if(err) return NULL;
+    *info = fb;
+    return (void*)UFRAMEBUFFER_START;
+}
+
+static int framebuffer_present_syscall(int x0, int y0, int x1, int y1) {
+    process_t* proc = scheduler_get_current_thread()->process;
+    if(!proc->heap || !vmmngr_to_physical_addr(NULL, UFRAMEBUFFER_START)) return -1;
+
+    video_vesa_present((const uint8_t*)UFRAMEBUFFER_START, x0, y0, x1, y1);
+    return 0;
 }
 
 static void syscall_dispatcher(regs_t* regs) {
@@ -27,47 +98,18 @@ static void syscall_dispatcher(regs_t* regs) {
     void* fn = syscalls[regs->eax];
     if(!fn) return;
 
-    // NOTE:
-    // somehow modifying the registers directly will very likely to cause a page fault
-    // so we make a copy of it
-    // and only copy it back when err_code is 1 (turned on when loading saved registers)
-    memcpy(&regs_copy, regs, sizeof(regs_t));
-    regs_copy.err_code = 0;
-
-    int ret;
-    asm volatile (
-        "push %1;"
-        "push %2;"
-        "push %3;"
-        "push %4;"
-        "push %5;"
-
-        "call *%6;"
-
-        "pop %%ebx;"
-        "pop %%ebx;"
-        "pop %%ebx;"
-        "pop %%ebx;"
-        "pop %%ebx;"
-
-        : "=a" (ret)
-        : "r" (regs->edi), "r" (regs->esi), "r" (regs->edx), "r" (regs->ecx), "r" (regs->ebx), "r" (fn)
-    );
-
-    // make a volatile ptr copy so that compiler will not optimize it out
-    volatile regs_t* vol_regs_copy = &regs_copy;
-
-    // compiler will optimize out the code below if we dont use the volatile ptr defined above
-    // because it will think regs_copy will not change, which is true for it because it does not know
-    // what the inline asm would do to regs_copy and assume that regs_copy will not change
-
-    // if regs_copy.err_code changed (only when context is switched)
-    // then load regs_copy to the original regs pointer
-    // and DO NOT CHANGE eax (returned value) because of context switching
-    // make sure that there are no context switching function that also return a value
-    // since it is not support here
-    if(vol_regs_copy->err_code) memcpy(regs, &regs_copy, sizeof(regs_t));
-    else regs->eax = ret;
+    // the functions that switch threads save the registers from here
+    // it is the real frame, the thread is resumed from a copy of it on its own stack
+    syscall_regs[smp_get_cpu_id()] = regs;
+
+    // every syscall takes its arguments in ebx, ecx, edx, esi and edi
+    // extra arguments are ignored by the ones that take fewer
+    int (*call)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) = fn;
+    int ret = call(regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi);
+
+    // after a thread switch this frame is not returned through anymore
+    // a blocked thread_join gets its value written into the saved registers instead
+    if(!scheduler_thread_switched()) regs->eax = ret;
 }
 
 void syscall_init() {
@@ -75,6 +117,12 @@ void syscall_init() {
     ADD_SYSCALL(SYSCALL_TIME, time);
     ADD_SYSCALL(SYSCALL_KILL_PROCESS, proc_kill);
     ADD_SYSCALL(SYSCALL_SLEEP, proc_sleep);
+    ADD_SYSCALL(SYSCALL_THREAD_CREATE, thread_create);
+    ADD_SYSCALL(SYSCALL_THREAD_JOIN, thread_join_syscall);
+    ADD_SYSCALL(SYSCALL_THREAD_EXIT, thread_exit_syscall);
+    ADD_SYSCALL(SYSCALL_FORK, fork);
+    ADD_SYSCALL(SYSCALL_FRAMEBUFFER_MAP, framebuffer_map_syscall);
+    ADD_SYSCALL(SYSCALL_FRAMEBUFFER_PRESENT, framebuffer_present_syscall);
 
     isr_new_interrupt(0x80, syscall_dispatcher, 0xee);
 }
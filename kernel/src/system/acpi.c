@@ -0,0 +1,182 @@
+#include "acpi.h"
+#include "apic.h"
+#include "smp.h"
+#include "mem.h"
+
+#include "string.h"
+
+// number of pages reserved at ACPI_START for mapping firmware tables
+#define ACPI_WINDOW_PAGES 64
+
+// the BIOS area is inside the first 4MiB so it is already mapped
+#define LOW_MEM(phys) ((void*)(KERNEL_START + (phys)))
+
+static unsigned window_used = 0;
+
+// map a physical range into the ACPI window and return its virtual address
+// tables are never unmapped since they are only read once at boot
+static void* acpi_map(uint32_t phys, uint32_t size) {
+    uint32_t offset = phys % MMNGR_PAGE_SIZE;
+    uint32_t page_count = (offset + size + MMNGR_PAGE_SIZE - 1) / MMNGR_PAGE_SIZE;
+    if(window_used + page_count > ACPI_WINDOW_PAGES) return NULL;
+
+    virtual_addr_t virt = ACPI_START + window_used * MMNGR_PAGE_SIZE;
+    vmmngr_map_range(NULL, phys - offset, virt, page_count * MMNGR_PAGE_SIZE, 0);
+    window_used += page_count;
+
+    return (void*)(virt + offset);
+}
+
+static bool checksum_valid(void* data, unsigned length) {
+    uint8_t sum = 0;
+    for(unsigned i = 0; i < length; i++)
+        sum += ((uint8_t*)data)[i];
+    return sum == 0;
+}
+
+// search for a signature on 16 bytes boundaries
+static void* search_signature(uint32_t phys_start, uint32_t length, const char* signature, unsigned sig_len) {
+    for(uint32_t addr = phys_start; addr < phys_start + length; addr += 16) {
+        if(memcmp(LOW_MEM(addr), signature, sig_len) == 0)
+            return LOW_MEM(addr);
+    }
+    return NULL;
+}
+
+static void* find_in_bios_area(const char* signature, unsigned sig_len) {
+    // the first KiB of the EBDA
+    uint32_t ebda = (uint32_t)(*(uint16_t*)LOW_MEM(0x40e)) << 4;
+    void* found = NULL;
+    if(ebda) found = search_signature(ebda, 1024, signature, sig_len);
+    // the BIOS read-only memory
+    if(!found) found = search_signature(0xe0000, 0x20000, signature, sig_len);
+
+    return found;
+}
+
+static void parse_madt(acpi_madt_t* madt) {
+    lapic_set_base(madt->lapic_addr);
+
+    uint8_t* entry = (uint8_t*)madt + sizeof(acpi_madt_t);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while(entry < end) {
+        madt_entry_header_t* header = (madt_entry_header_t*)entry;
+        if(header->length == 0) break;
+
+        switch(header->type) {
+            case MADT_LAPIC: {
+                madt_lapic_t* l = (madt_lapic_t*)entry;
+                if(l->flags & MADT_LAPIC_ENABLED)
+                    smp_register_cpu(l->lapic_id);
+                break;
+            }
+            case MADT_IOAPIC: {
+                madt_ioapic_t* io = (madt_ioapic_t*)entry;
+                ioapic_set_base(io->ioapic_addr, io->gsi_base);
+                break;
+            }
+            case MADT_ISO: {
+                madt_iso_t* iso = (madt_iso_t*)entry;
+                // bus 0 is ISA
+                if(iso->bus == 0) ioapic_add_override(iso->irq, iso->gsi, iso->flags);
+                break;
+            }
+            case MADT_LAPIC_OVERRIDE: {
+                madt_lapic_override_t* o = (madt_lapic_override_t*)entry;
+                // we can not reach anything above 4GiB anyway
+                if(!(o->lapic_addr >> 32)) lapic_set_base((uint32_t)o->lapic_addr);
+                break;
+            }
+        }
+
+        entry += header->length;
+    }
+}
+
+static bool acpi_parse() {
+    acpi_rsdp_t* rsdp = find_in_bios_area(ACPI_RSDP_SIGNATURE, 8);
+    if(!rsdp || !checksum_valid(rsdp, sizeof(acpi_rsdp_t))) return true;
+
+    acpi_sdt_header_t* rsdt = acpi_map(rsdp->rsdt_addr, sizeof(acpi_sdt_header_t));
+    if(!rsdt) return true;
+    rsdt = acpi_map(rsdp->rsdt_addr, rsdt->length);
+    if(!rsdt || !checksum_valid(rsdt, rsdt->length)) return true;
+
+    unsigned entry_count = (rsdt->length - sizeof(acpi_sdt_header_t)) / 4;
+    uint32_t* entries = (uint32_t*)((uint8_t*)rsdt + sizeof(acpi_sdt_header_t));
+    for(unsigned i = 0; i < entry_count; i++) {
+        acpi_sdt_header_t* header = acpi_map(entries[i], sizeof(acpi_sdt_header_t));
+        if(!header) return true;
+        if(memcmp(header->signature, ACPI_MADT_SIGNATURE, 4) != 0) continue;
+
+        acpi_madt_t* madt = acpi_map(entries[i], header->length);
+        if(!madt || !checksum_valid(madt, header->length)) return true;
+
+        parse_madt(madt);
+        return false;
+    }
+
+    return true;
+}
+
+// fallback for machines without ACPI, see the Intel MultiProcessor Specification
+static bool mp_parse() {
+    mp_floating_pointer_t* fp = find_in_bios_area("_MP_", 4);
+    if(!fp) fp = search_signature(0x9fc00, 1024, "_MP_", 4);
+    if(!fp || !checksum_valid(fp, fp->length * 16)) return true;
+    // no config table means a default configuration, which we do not bother with
+    if(!fp->config_addr) return true;
+
+    mp_config_header_t* config = acpi_map(fp->config_addr, sizeof(mp_config_header_t));
+    if(!config) return true;
+    config = acpi_map(fp->config_addr, config->length);
+    if(!config || !checksum_valid(config, config->length)) return true;
+
+    lapic_set_base(config->lapic_addr);
+
+    int isa_bus = -1;
+    uint8_t* entry = (uint8_t*)config + sizeof(mp_config_header_t);
+    for(unsigned i = 0; i < config->entry_count; i++) {
+        switch(*entry) {
+            case MP_ENTRY_PROCESSOR: {
+                mp_processor_t* p = (mp_processor_t*)entry;
+                if(p->flags & MP_PROCESSOR_ENABLED) smp_register_cpu(p->lapic_id);
+                entry += sizeof(mp_processor_t);
+                break;
+            }
+            case MP_ENTRY_BUS: {
+                mp_bus_t* b = (mp_bus_t*)entry;
+                if(memcmp(b->bus_type, "ISA", 3) == 0) isa_bus = b->bus_id;
+                entry += sizeof(mp_bus_t);
+                break;
+            }
+            case MP_ENTRY_IOAPIC: {
+                mp_ioapic_t* io = (mp_ioapic_t*)entry;
+                if(io->flags & MP_IOAPIC_ENABLED) ioapic_set_base(io->ioapic_addr, 0);
+                entry += sizeof(mp_ioapic_t);
+                break;
+            }
+            case MP_ENTRY_IO_INT: {
+                mp_io_int_t* io_int = (mp_io_int_t*)entry;
+                // type 0 is a vectored interrupt, the rest are NMI/SMI/ExtINT
+                if(io_int->interrupt_type == 0 && io_int->src_bus_id == isa_bus)
+                    ioapic_add_override(io_int->src_bus_irq, io_int->dst_ioapic_pin, io_int->flags);
+                entry += sizeof(mp_io_int_t);
+                break;
+            }
+            default:
+                // local interrupt entries and anything unknown are 8 bytes
+                entry += 8;
+                break;
+        }
+    }
+
+    return false;
+}
+
+// find the cpus and interrupt controllers
+// return true if neither the ACPI MADT nor the MP tables are found
+bool acpi_init() {
+    if(!acpi_parse()) return false;
+    return mp_parse();
+}
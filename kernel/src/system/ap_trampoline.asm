@@ -0,0 +1,87 @@
+; startup code for application processors
+; this is copied to TRAMPOLINE_ADDR by smp.c and executed by each AP after the startup IPI
+; the AP starts in real mode at TRAMPOLINE_ADDR >> 4 : 0
+; so every absolute address here must be relocated to the copy
+
+TRAMPOLINE_ADDR equ 0x8000 ; must match AP_TRAMPOLINE_ADDR in smp.h
+
+%define relocate(label) (TRAMPOLINE_ADDR + (label) - ap_trampoline_start)
+
+section .text
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_cr3
+global ap_trampoline_cr4
+global ap_trampoline_stack
+global ap_trampoline_entry
+
+[bits 16]
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    lgdt [relocate(tramp_gdtr)]
+
+    ; enable protected mode
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+
+    jmp dword 0x08:relocate(protected_mode)
+
+[bits 32]
+protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; same paging features as the BSP, the page directory may have 4MiB pages
+    mov eax, [relocate(ap_trampoline_cr4)]
+    mov cr4, eax
+
+    ; use the same page directory as the BSP
+    ; the BSP temporarily identity maps the first 4MiB so we can keep running after enabling paging
+    mov eax, [relocate(ap_trampoline_cr3)]
+    mov cr3, eax
+
+    ; paging and WP, like the BSP
+    mov eax, cr0
+    or eax, 0x80010000
+    mov cr0, eax
+
+    mov esp, [relocate(ap_trampoline_stack)]
+    xor ebp, ebp
+
+    ; jump to the higher half
+    mov eax, [relocate(ap_trampoline_entry)]
+    call eax
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; flat GDT used only until the AP loads the kernel GDT
+align 8
+tramp_gdt:
+    dq 0x0000000000000000
+    dq 0x00cf9a000000ffff ; ring0 code
+    dq 0x00cf92000000ffff ; ring0 data
+tramp_gdtr:
+    dw tramp_gdtr - tramp_gdt - 1
+    dd relocate(tramp_gdt)
+
+; filled by the BSP before starting each AP
+ap_trampoline_cr3:   dd 0
+ap_trampoline_cr4:   dd 0
+ap_trampoline_stack: dd 0
+ap_trampoline_entry: dd 0
+
+ap_trampoline_end:
@@ -32,9 +32,16 @@ void gdt_init() {
     gdt_set_gate(3, 0, 0xfffff, 0xfa, 0xc);
     // ring3 data segment
     gdt_set_gate(4, 0, 0xfffff, 0xf2, 0xc);
-    // TSS
-    tss_install(5, 0x10, 0);
+    // TSS for each cpu
+    for(unsigned cpu = 0; cpu < MAX_CPU; cpu++)
+        tss_install(GDT_TSS_GATE + cpu, cpu, 0x10, 0);
 
     gdt_flush();
-    tss_flush();
+    tss_flush(0);
+}
+
+// load the GDT built by the BSP on an AP
+void gdt_load(unsigned cpu) {
+    gdt_flush();
+    tss_flush(cpu);
 }
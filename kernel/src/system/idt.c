@@ -23,3 +23,8 @@ void idt_init() {
 
     asm("lidt %0" : : "m" (idtr));
 }
+
+// every cpu shares the same IDT
+void idt_load() {
+    asm("lidt %0" : : "m" (idtr));
+}
@@ -71,6 +71,7 @@ isr_no_err_stub 47
 %endrep
 
 extern isr_handler ; from isr.c
+extern scheduler_finish_switch ; from scheduler.c
 isr_common_stub:
     pusha
     push ds
@@ -88,7 +89,15 @@ isr_common_stub:
     cli
     cld
     call eax
-    pop eax
+    add esp, 4
+; eax is the frame to return through, isr_handler returns it
+; after a thread switch it is on the stack of the next thread
+isr_return:
+    cmp eax, esp
+    je .resume
+    mov esp, eax
+    call scheduler_finish_switch
+.resume:
     pop gs
     pop fs
     pop es
@@ -97,6 +106,32 @@ isr_common_stub:
     add esp, 8 ; error code and isr number
     iret
 
+; void isr_call_with_frame(regs_t* (*fn)(regs_t*, void*), void* arg)
+; build the frame an interrupt would push right here and run fn(frame, arg) on it
+; fn returns the frame to return through like isr_handler, so it can switch to another thread
+; this returns once the calling thread is resumed
+global isr_call_with_frame
+isr_call_with_frame:
+    pushf
+    cli
+    push cs
+    push dword .done
+    push 0 ; error code
+    push 0 ; isr number
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+    mov eax, esp
+    push dword [eax + 76] ; arg
+    push eax
+    call [eax + 72] ; fn
+    add esp, 8
+    jmp isr_return
+.done:
+    ret
+
 global isr_table
 isr_table:
 %assign i 0
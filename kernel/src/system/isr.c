@@ -1,5 +1,7 @@
 #include "system.h"
+#include "process.h"
 #include "pic.h"
+#include "apic.h"
 #include "stdio.h"
 #include "string.h"
 #include "video.h"
@@ -89,6 +91,16 @@ static void* exception_handlers[] = {
 
 // default exception handler
 static void exception_handler(regs_t* r) {
+    // page faults on copy-on-write and lazily mapped memory are not errors
+    if(r->int_no == 14) {
+        uint32_t faulting_address;
+        asm volatile("mov %%cr2, %0" : "=r" (faulting_address));
+        bool present = r->err_code & 0x1;
+        bool write = r->err_code & 0x2;
+        if(present && write && !vmmngr_copy_on_write(faulting_address)) return;
+        if(!vm_area_page_fault(faulting_address, present)) return;
+    }
+
     video_vesa_set_cursor(0);
     video_set_attr(video_rgb(VIDEO_WHITE), video_rgb(VIDEO_BLACK));
     printf("Exception: ");
@@ -105,13 +117,34 @@ static void exception_handler(regs_t* r) {
 }
 
 // default ISR. every interrupt will be "handled" by this function
-void isr_handler(regs_t* reg) {
+// return the frame to return through, it belongs to another thread if the handler switched threads
+regs_t* isr_handler(regs_t* reg) {
     void (*handler)(regs_t*) = routines[reg->int_no];
     if(handler) handler(reg);
 
     // if it is an IRQ
-    if(reg->int_no >= 32 && reg->int_no <= 47)
-        pic_send_eoi(reg->int_no - 32);
+    if(reg->int_no >= 32 && reg->int_no <= 47) {
+        if(apic_enabled()) lapic_send_eoi();
+        else pic_send_eoi(reg->int_no - 32);
+    }
+    // interrupts sent by the local APIC itself (timer, IPIs)
+    // spurious interrupts must not be acknowledged
+    else if(reg->int_no >= LAPIC_TIMER_VECTOR && reg->int_no < 0x80)
+        lapic_send_eoi();
+
+    return scheduler_resume_frame(reg);
+}
+
+// disable interrupts and return the previous eflags
+uint32_t irq_save() {
+    uint32_t eflags;
+    asm volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+    return eflags;
+}
+
+// enable interrupts again if they were enabled before irq_save()
+void irq_restore(uint32_t eflags) {
+    if(eflags & 0x200) asm volatile("sti" : : : "memory");
 }
 
 void irq_install_handler(int irq, void (*handler)(regs_t*)) {
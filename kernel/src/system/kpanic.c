@@ -3,6 +3,8 @@
 #include "misc/elf.h"
 #include "stdio.h"
 #include "video.h"
+#include "debug.h"
+#include "console.h"
 
 #define MAX_FRAMES 30
 
@@ -74,11 +76,15 @@ char* kernel_find_symbol(unsigned addr, int type, unsigned* ret_addr) {
 
 void kernel_panic(stackframe_t* stk) {
     asm("cli");
+    // what was logged before the panic comes first
+    klog_panic_flush();
     video_set_attr(video_rgb(VIDEO_LIGHT_RED), video_rgb(VIDEO_BLACK));
     puts("kernel panicked!");
     video_set_attr(video_rgb(VIDEO_WHITE), video_rgb(VIDEO_BLACK));
     puts("stack trace:");
     stack_trace(stk);
     puts("system halted!");
+    // interrupts are off so the timer and the serial interrupt will not do it
+    console_flush();
     while(1) asm("hlt");
 }
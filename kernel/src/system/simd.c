@@ -0,0 +1,154 @@
+#include "system.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR4_OSFXSR     (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+// smaller sizes are not worth saving the SSE state for
+#define SIMD_MIN_SIZE 256
+
+// decided by the BSP, the APs are assumed to have the same features like with the paging features
+static bool sse2_enabled = false;
+
+// the SSE state of whatever was running before simd_begin, fxsave needs 16 byte alignment
+static uint8_t fxsave_area[MAX_CPU][512] __attribute__((aligned(16)));
+// simd_begin can be nested, e.g. a flush that draws the cursor, only the outermost one saves the state
+static unsigned simd_depth[MAX_CPU];
+
+// called by each cpu
+void simd_init() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+    // FXSR, SSE and SSE2
+    const uint32_t needed = (1 << 24) | (1 << 25) | (1 << 26);
+    if((edx & needed) != needed) return;
+
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0));
+    cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP;
+    asm volatile("mov %0, %%cr0" : : "r" (cr0));
+
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("mov %0, %%cr4" : : "r" (cr4));
+
+    if(smp_get_cpu_id() == 0) sse2_enabled = true;
+}
+
+bool simd_available() {
+    return sse2_enabled;
+}
+
+// the thread switch does not save the SSE registers
+// so the kernel keeps them for the thread it interrupted, with interrupts off until simd_end
+// the kernel itself is built without SSE so gcc never keeps anything in them, that is why the asm does not list them
+uint32_t simd_begin() {
+    uint32_t eflags = irq_save();
+    unsigned cpu = smp_get_cpu_id();
+
+    if(sse2_enabled && simd_depth[cpu]++ == 0)
+        asm volatile("fxsave (%0)" : : "r" (fxsave_area[cpu]) : "memory");
+
+    return eflags;
+}
+
+void simd_end(uint32_t eflags) {
+    unsigned cpu = smp_get_cpu_id();
+
+    if(sse2_enabled && --simd_depth[cpu] == 0) {
+        // the streaming stores are weakly ordered, make them visible before anyone else looks
+        asm volatile("sfence; fxrstor (%0)" : : "r" (fxsave_area[cpu]) : "memory");
+    }
+
+    irq_restore(eflags);
+}
+
+static void fill_rep(uint8_t* dst, uint32_t pattern, size_t size) {
+    size_t dwords = size / 4;
+    asm volatile("rep stosl" : "+D" (dst), "+c" (dwords) : "a" (pattern) : "memory");
+    for(size_t i = 0; i < size % 4; i++)
+        dst[i] = pattern >> (i * 8);
+}
+
+static void copy_rep(uint8_t* dst, const uint8_t* src, size_t size) {
+    size_t dwords = size / 4;
+    size_t bytes = size % 4;
+    asm volatile("rep movsl" : "+D" (dst), "+S" (src), "+c" (dwords) : : "memory");
+    asm volatile("rep movsb" : "+D" (dst), "+S" (src), "+c" (bytes) : : "memory");
+}
+
+// fill size bytes with a repeating 32 bit pattern, the first byte is the lowest byte of pattern
+// uses streaming stores that do not pollute the cache, call it between simd_begin and simd_end
+void simd_fill32(void* dst, uint32_t pattern, size_t size) {
+    uint8_t* d = dst;
+
+    if(sse2_enabled && size >= SIMD_MIN_SIZE) {
+        // the streaming stores need a 16 byte aligned destination
+        size_t head = (16 - ((uint32_t)d & 15)) & 15;
+        for(size_t i = 0; i < head; i++)
+            d[i] = pattern >> ((i % 4) * 8);
+        d += head;
+        size -= head;
+        // the pattern continues where the head stopped
+        if(head % 4) pattern = (pattern >> ((head % 4) * 8)) | (pattern << (32 - (head % 4) * 8));
+
+        size_t blocks = size / 64;
+        asm volatile(
+            "movd %2, %%xmm0\n"
+            "pshufd $0, %%xmm0, %%xmm0\n"
+            "1:\n"
+            "movntdq %%xmm0, (%0)\n"
+            "movntdq %%xmm0, 16(%0)\n"
+            "movntdq %%xmm0, 32(%0)\n"
+            "movntdq %%xmm0, 48(%0)\n"
+            "add $64, %0\n"
+            "dec %1\n"
+            "jnz 1b\n"
+            : "+r" (d), "+r" (blocks) : "r" (pattern) : "memory"
+        );
+        size %= 64;
+    }
+
+    fill_rep(d, pattern, size);
+}
+
+// copy size bytes forward, so dst may overlap src if it is below it
+// uses streaming stores that do not pollute the cache, call it between simd_begin and simd_end
+void simd_copy(void* dst, const void* src, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    if(sse2_enabled && size >= SIMD_MIN_SIZE) {
+        size_t head = (16 - ((uint32_t)d & 15)) & 15;
+        copy_rep(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+
+        // each block is loaded before it is stored so a lower overlapping dst is fine
+        size_t blocks = size / 64;
+        asm volatile(
+            "1:\n"
+            "movdqu (%1), %%xmm0\n"
+            "movdqu 16(%1), %%xmm1\n"
+            "movdqu 32(%1), %%xmm2\n"
+            "movdqu 48(%1), %%xmm3\n"
+            "movntdq %%xmm0, (%0)\n"
+            "movntdq %%xmm1, 16(%0)\n"
+            "movntdq %%xmm2, 32(%0)\n"
+            "movntdq %%xmm3, 48(%0)\n"
+            "add $64, %0\n"
+            "add $64, %1\n"
+            "dec %2\n"
+            "jnz 1b\n"
+            : "+r" (d), "+r" (s), "+r" (blocks) : : "memory"
+        );
+        size %= 64;
+    }
+
+    copy_rep(d, s, size);
+}
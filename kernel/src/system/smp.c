@@ -0,0 +1,174 @@
+#include "smp.h"
+#include "apic.h"
+#include "system.h"
+#include "process.h"
+#include "mem.h"
+#include "pit.h"
+
+#include "string.h"
+
+// from ap_trampoline.asm
+extern char ap_trampoline_start;
+extern char ap_trampoline_end;
+extern char ap_trampoline_cr3;
+extern char ap_trampoline_cr4;
+extern char ap_trampoline_stack;
+extern char ap_trampoline_entry;
+
+// address of a trampoline variable inside the copied trampoline
+#define TRAMPOLINE_VAR(var) \
+(uint32_t*)(KERNEL_START + AP_TRAMPOLINE_ADDR + (&(var) - &ap_trampoline_start))
+
+static cpu_t cpus[MAX_CPU];
+static unsigned cpu_count = 0;
+static atomic_uint online_count = 0;
+
+// translate a LAPIC ID to our cpu index
+static uint8_t lapic_to_cpu[256];
+
+void smp_register_cpu(uint8_t lapic_id) {
+    if(cpu_count == MAX_CPU) return;
+
+    cpus[cpu_count].lapic_id = lapic_id;
+    cpus[cpu_count].online = false;
+    lapic_to_cpu[lapic_id] = cpu_count;
+    cpu_count++;
+}
+
+unsigned smp_get_cpu_count() {
+    return cpu_count ? cpu_count : 1;
+}
+
+unsigned smp_get_online_count() {
+    return online_count ? online_count : 1;
+}
+
+cpu_t* smp_get_cpu(unsigned id) {
+    if(id >= cpu_count) return NULL;
+    return &cpus[id];
+}
+
+// index of the cpu running this code. the BSP is always 0
+unsigned smp_get_cpu_id() {
+    if(!apic_enabled()) return 0;
+    return lapic_to_cpu[lapic_get_id()];
+}
+
+static void cpu_idle() {
+    while(true) asm volatile("hlt");
+}
+
+static void spurious_handler(regs_t* r) {
+    (void)(r);
+}
+
+// only sent for tlb shootdowns for now
+static void ipi_handler(regs_t* r) {
+    (void)(r);
+    vmmngr_handle_shootdown();
+}
+
+// the first C code an AP runs, on its own stack
+static void ap_main() {
+    unsigned id = smp_get_cpu_id();
+
+    gdt_load(id);
+    idt_load();
+    vmmngr_init();
+    simd_init();
+    lapic_init();
+
+    // interrupts from usermode will land on this stack
+    tss_set_stack(cpus[id].stack_addr + AP_STACK_SIZE);
+
+    // the idle thread runs when there is nothing in this cpu's run queue
+    if(scheduler_init_cpu()) cpu_idle();
+
+    lapic_timer_start(TIMER_FREQUENCY);
+
+    cpus[id].online = true;
+    atomic_fetch_add(&online_count, 1);
+
+    // the first tick will switch to the idle thread
+    asm volatile("sti");
+    while(true);
+}
+
+static bool start_ap(unsigned id) {
+    uint8_t lapic_id = cpus[id].lapic_id;
+
+    // INIT-SIPI-SIPI sequence
+    lapic_send_ipi(lapic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    pit_sleep_polling(10000);
+
+    for(int i = 0; i < 2 && !cpus[id].online; i++) {
+        lapic_send_ipi(lapic_id, LAPIC_ICR_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+        pit_sleep_polling(200);
+    }
+
+    // give it at most 100ms to come up
+    for(int i = 0; i < 10 && !cpus[id].online; i++)
+        pit_sleep_polling(10000);
+
+    return !cpus[id].online;
+}
+
+// switch to the APIC and start all other cpus
+// the scheduler must be initialised beforehand
+// return true if the APIC can not be used
+bool smp_init() {
+    if(apic_init()) return true;
+
+    // make sure the BSP is cpu 0
+    uint8_t bsp = lapic_get_id();
+    if(cpu_count == 0) smp_register_cpu(bsp);
+    for(unsigned i = 1; i < cpu_count; i++) {
+        if(cpus[i].lapic_id != bsp) continue;
+
+        cpus[i].lapic_id = cpus[0].lapic_id;
+        lapic_to_cpu[cpus[i].lapic_id] = i;
+        cpus[0].lapic_id = bsp;
+        lapic_to_cpu[bsp] = 0;
+        break;
+    }
+    cpus[0].online = true;
+    online_count = 1;
+
+    if(cpu_count == 1) return false;
+
+    // APs are driven by their LAPIC timer, the BSP keeps using the PIT
+    isr_new_interrupt(LAPIC_TIMER_VECTOR, scheduler_switch, 0x8e);
+    isr_new_interrupt(LAPIC_SPURIOUS_VECTOR, spurious_handler, 0x8e);
+    isr_new_interrupt(LAPIC_IPI_VECTOR, ipi_handler, 0x8e);
+
+    memcpy(
+        (void*)(KERNEL_START + AP_TRAMPOLINE_ADDR),
+        &ap_trampoline_start,
+        &ap_trampoline_end - &ap_trampoline_start
+    );
+    *TRAMPOLINE_VAR(ap_trampoline_cr3) = (uint32_t)vmmngr_get_kernel_page_directory();
+    uint32_t cr4; asm volatile("mov %%cr4, %0" : "=r" (cr4));
+    *TRAMPOLINE_VAR(ap_trampoline_cr4) = cr4;
+    *TRAMPOLINE_VAR(ap_trampoline_entry) = (uint32_t)ap_main;
+
+    // identity map the first 4MiB while the APs enable paging
+    page_directory_t* pd = (page_directory_t*)VMMNGR_PD;
+    pd->entry[0] = pd->entry[PAGE_DIRECTORY_INDEX(KERNEL_START)];
+
+    // APs are started one by one since they share the trampoline
+    for(unsigned i = 1; i < cpu_count; i++) {
+        cpus[i].stack_addr = (uint32_t)kmalloc(AP_STACK_SIZE);
+        if(!cpus[i].stack_addr) break;
+        *TRAMPOLINE_VAR(ap_trampoline_stack) = cpus[i].stack_addr + AP_STACK_SIZE;
+
+        if(start_ap(i)) {
+            kfree((void*)cpus[i].stack_addr);
+            cpus[i].stack_addr = 0;
+        }
+    }
+
+    pd->entry[0] = 0;
+    vmmngr_flush_tlb_entry(AP_TRAMPOLINE_ADDR);
+
+    return false;
+}
@@ -1,5 +1,30 @@
 #include "system.h"
 
+static lock_stats_t* stats_list = NULL;
+static volatile atomic_flag stats_list_lock = ATOMIC_FLAG_INIT;
+
+static uint64_t rdtsc() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static void stats_acquired(lock_stats_t* stats, unsigned spins) {
+    if(!LOCK_STATS || !stats) return;
+
+    stats->acquisitions++;
+    if(spins) stats->contended++;
+    stats->spins += spins;
+    stats->acquire_time = rdtsc();
+}
+
+static void stats_released(lock_stats_t* stats) {
+    if(!LOCK_STATS || !stats) return;
+
+    uint64_t hold_time = rdtsc() - stats->acquire_time;
+    if(hold_time > stats->max_hold_time) stats->max_hold_time = hold_time;
+}
+
 void spinlock_acquire(volatile atomic_flag* lock) {
     while(atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
         __builtin_ia32_pause();
@@ -8,3 +33,106 @@ void spinlock_acquire(volatile atomic_flag* lock) {
 void spinlock_release(volatile atomic_flag* lock) {
     atomic_flag_clear_explicit(lock, memory_order_release);
 }
+
+void ticketlock_acquire(ticketlock_t* lock) {
+    unsigned spins = 0;
+    unsigned ticket = atomic_fetch_add_explicit(&lock->next_ticket, 1, memory_order_relaxed);
+    while(atomic_load_explicit(&lock->now_serving, memory_order_acquire) != ticket) {
+        __builtin_ia32_pause();
+        spins++;
+    }
+
+    stats_acquired(lock->stats, spins);
+}
+
+void ticketlock_release(ticketlock_t* lock) {
+    stats_released(lock->stats);
+
+    // only the holder writes now_serving so a plain increment is enough
+    unsigned next = atomic_load_explicit(&lock->now_serving, memory_order_relaxed) + 1;
+    atomic_store_explicit(&lock->now_serving, next, memory_order_release);
+}
+
+// disable interrupts so that an interrupt handler on this cpu can not deadlock on the same lock
+// return the eflags to pass to the release function
+uint32_t ticketlock_acquire_irqsave(ticketlock_t* lock) {
+    uint32_t eflags = irq_save();
+    ticketlock_acquire(lock);
+    return eflags;
+}
+
+void ticketlock_release_irqrestore(ticketlock_t* lock, uint32_t eflags) {
+    ticketlock_release(lock);
+    irq_restore(eflags);
+}
+
+void mcslock_acquire(mcslock_t* lock, mcs_node_t* node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+    unsigned spins = 0;
+    mcs_node_t* prev = atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+    if(prev) {
+        // queue behind the previous waiter and wait for it to hand the lock over
+        atomic_store_explicit(&prev->next, node, memory_order_release);
+        while(atomic_load_explicit(&node->locked, memory_order_acquire)) {
+            __builtin_ia32_pause();
+            spins++;
+        }
+    }
+
+    stats_acquired(lock->stats, spins);
+}
+
+void mcslock_release(mcslock_t* lock, mcs_node_t* node) {
+    stats_released(lock->stats);
+
+    mcs_node_t* next = atomic_load_explicit(&node->next, memory_order_acquire);
+    if(!next) {
+        // nobody is waiting
+        mcs_node_t* expected = node;
+        if(atomic_compare_exchange_strong_explicit(&lock->tail, &expected, NULL,
+                    memory_order_release, memory_order_relaxed))
+            return;
+
+        // someone is queueing right now, wait for it to link itself
+        while(!(next = atomic_load_explicit(&node->next, memory_order_acquire)))
+            __builtin_ia32_pause();
+    }
+
+    atomic_store_explicit(&next->locked, false, memory_order_release);
+}
+
+uint32_t mcslock_acquire_irqsave(mcslock_t* lock, mcs_node_t* node) {
+    uint32_t eflags = irq_save();
+    mcslock_acquire(lock, node);
+    return eflags;
+}
+
+void mcslock_release_irqrestore(mcslock_t* lock, mcs_node_t* node, uint32_t eflags) {
+    mcslock_release(lock, node);
+    irq_restore(eflags);
+}
+
+// add a lock's statistics to the list shown by lockstat
+// set the lock's stats pointer to it afterward
+void lock_stats_register(lock_stats_t* stats, const char* name) {
+    if(!LOCK_STATS) return;
+
+    stats->name = name;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->spins = 0;
+    stats->max_hold_time = 0;
+
+    uint32_t eflags = irq_save();
+    spinlock_acquire(&stats_list_lock);
+    stats->next = stats_list;
+    stats_list = stats;
+    spinlock_release(&stats_list_lock);
+    irq_restore(eflags);
+}
+
+lock_stats_t* lock_stats_get_list() {
+    return stats_list;
+}
@@ -1,28 +1,30 @@
 #include "system.h"
 #include "string.h"
 
-static tss_entry_t tss;
+// each cpu needs its own TSS since they enter the kernel on different stacks
+static tss_entry_t tss[MAX_CPU];
 
 void tss_set_stack(uint32_t esp) {
-    tss.esp0 = esp;
+    tss[smp_get_cpu_id()].esp0 = esp;
 }
 
-void tss_install(int gate, uint16_t kernel_ss, uint32_t kernel_esp) {
-    uint32_t base = (uint32_t)&tss;
+void tss_install(int gate, unsigned cpu, uint16_t kernel_ss, uint32_t kernel_esp) {
+    uint32_t base = (uint32_t)&tss[cpu];
     gdt_set_gate(gate, base, base + sizeof(tss_entry_t), 0xe9, 0x0);
 
-    memset(&tss, 0, sizeof(tss_entry_t));
+    memset(&tss[cpu], 0, sizeof(tss_entry_t));
 
-    tss.ss0 = kernel_ss;
-    tss.esp0 = kernel_esp;
-    tss.cs = 0x0b;
-    tss.ss = 0x13;
-    tss.ds = 0x13;
-    tss.es = 0x13;
-    tss.fs = 0x13;
-    tss.gs = 0x13;
+    tss[cpu].ss0 = kernel_ss;
+    tss[cpu].esp0 = kernel_esp;
+    tss[cpu].cs = 0x0b;
+    tss[cpu].ss = 0x13;
+    tss[cpu].ds = 0x13;
+    tss[cpu].es = 0x13;
+    tss[cpu].fs = 0x13;
+    tss[cpu].gs = 0x13;
 }
 
-void tss_flush() {
-    asm volatile("ltr %0" : : "r" (0x2b));
+void tss_flush(unsigned cpu) {
+    uint16_t selector = ((GDT_TSS_GATE + cpu) * sizeof(gdt_entry_t)) | 3;
+    asm volatile("ltr %0" : : "r" (selector));
 }
@@ -2,8 +2,14 @@
 
 #include <sys/cdefs.h>
 
+#include "stdarg.h"
+#include "stddef.h"
+
 #define EOF (-1)
 
 int printf(const char* restrict format, ...);
+int vprintf(const char* restrict format, va_list arg);
+int snprintf(char* restrict buffer, size_t size, const char* restrict format, ...);
+int vsnprintf(char* restrict buffer, size_t size, const char* restrict format, va_list arg);
 int putchar(int ic);
 int puts(const char* string);
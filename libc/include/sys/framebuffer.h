@@ -0,0 +1,21 @@
+#pragma once
+
+#include "stdint.h"
+
+// the buffer returned by framebuffer_map, it is height rows of pitch bytes
+// a pixel is bpp bits with each channel at its position and size, like the screen itself
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t bpp;
+    uint8_t red_position;
+    uint8_t red_size;
+    uint8_t green_position;
+    uint8_t green_size;
+    uint8_t blue_position;
+    uint8_t blue_size;
+} framebuffer_info_t;
+
+void* framebuffer_map(framebuffer_info_t* info);
+int framebuffer_present(int x0, int y0, int x1, int y1);
@@ -1,137 +1,310 @@
 #include "stdio.h"
-#include "stdlib.h"
-#include "limits.h"
+#include "stdint.h"
 #include "stdbool.h"
 #include "stdarg.h"
 #include "string.h"
 
-static bool print(const char* data, size_t length) {
-    const unsigned char* bytes = (const unsigned char*)data;
-    for(size_t i = 0; i < length; i++)
-        if(putchar(bytes[i]) == EOF)
-            return false;
-    return true;
+#if defined(__is_libk)
+#include "console.h"
+#endif
+
+// everything is formatted in one pass into a buffer
+// a fixed buffer just cuts the output, printf empties its buffer into the console each time it fills up
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t pos;
+    // everything produced, also what did not fit
+    size_t total;
+    // called with the full buffer, NULL to drop what does not fit
+    void (*flush)(const char* data, size_t len);
+} output_t;
+
+#define PRINTF_BUFFER_SIZE 256
+
+#define FLAG_LEFT  1
+#define FLAG_ZERO  2
+#define FLAG_PLUS  4
+#define FLAG_SPACE 8
+#define FLAG_ALT   16
+
+static void put(output_t* out, const char* data, size_t len) {
+    out->total += len;
+    while(len) {
+        size_t room = out->size - out->pos;
+        if(!room) {
+            if(!out->flush) return;
+            out->flush(out->buffer, out->pos);
+            out->pos = 0;
+            room = out->size;
+        }
+
+        size_t n = len < room ? len : room;
+        memcpy(out->buffer + out->pos, data, n);
+        out->pos += n;
+        data += n;
+        len -= n;
+    }
 }
-static size_t intlen(int num, int radix) {
-    if(num == 0) return 1;
-    size_t len = 0;
-    unsigned n;
-    if(radix == 10 && num < 0) {
-        len++; // minus sign
-        n = -num;
+
+static void pad(output_t* out, char c, int count) {
+    char block[16];
+    memset(block, c, sizeof(block));
+    while(count > 0) {
+        int n = count < (int)sizeof(block) ? count : (int)sizeof(block);
+        put(out, block, n);
+        count -= n;
     }
-    else n = (unsigned)num;
-    while(n > 0) {
-        n /= radix;
-        len++;
+}
+
+// write the digits backward so that they end at end, return where they start
+static char* digits_backward(uint64_t value, unsigned radix, bool upper, char* end) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char* p = end;
+
+    // 64 bit division is slow on this cpu so it is only used for what does not fit in 32 bits
+    while(value > UINT32_MAX) {
+        *--p = digits[value % radix];
+        value /= radix;
     }
-    return len;
+    uint32_t v = value;
+    while(v) {
+        *--p = digits[v % radix];
+        v /= radix;
+    }
+
+    return p;
 }
 
-int printf(const char* restrict format, ...) {
-    va_list parameters;
-    va_start(parameters, format);
+static void put_number(output_t* out, uint64_t value, bool negative, unsigned radix, bool upper,
+                       unsigned flags, int width, int precision, const char* prefix) {
+    // enough for 64 bits in binary
+    char buffer[64];
+    char* end = buffer + sizeof(buffer);
+    char* start = digits_backward(value, radix, upper, end);
+    int len = end - start;
 
-    int written = 0;
+    // a zero is printed as one digit unless the precision is 0
+    if(value == 0 && precision != 0) {
+        *--start = '0';
+        len = 1;
+    }
 
-    while(*format != '\0') {
-        size_t maxrem = INT_MAX - written;
+    char sign[2] = {0};
+    if(negative) sign[0] = '-';
+    else if(flags & FLAG_PLUS) sign[0] = '+';
+    else if(flags & FLAG_SPACE) sign[0] = ' ';
 
-        if(format[0] != '%' || format[1] == '%') {
-            if(format[0] == '%')
-                format++;
-            size_t amount = 1;
-            while(format[amount] && format[amount] != '%')
-                amount++;
-            if(maxrem < amount) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
-            }
-            if(!print(format, amount))
-                return -1;
-            format += amount;
-            written += amount;
+    int prefix_len = strlen(sign) + strlen(prefix);
+    int zeros = precision > len ? precision - len : 0;
+    // the 0 flag is ignored when there is a precision
+    if((flags & FLAG_ZERO) && !(flags & FLAG_LEFT) && precision < 0 && width > prefix_len + len)
+        zeros = width - prefix_len - len;
+
+    int padding = width - prefix_len - zeros - len;
+    if(!(flags & FLAG_LEFT)) pad(out, ' ', padding);
+    put(out, sign, strlen(sign));
+    put(out, prefix, strlen(prefix));
+    pad(out, '0', zeros);
+    put(out, start, len);
+    if(flags & FLAG_LEFT) pad(out, ' ', padding);
+}
+
+static void put_padded(output_t* out, const char* str, int len, unsigned flags, int width) {
+    if(!(flags & FLAG_LEFT)) pad(out, ' ', width - len);
+    put(out, str, len);
+    if(flags & FLAG_LEFT) pad(out, ' ', width - len);
+}
+
+static int parse_int(const char** format) {
+    int n = 0;
+    while(**format >= '0' && **format <= '9') {
+        n = n * 10 + (**format - '0');
+        (*format)++;
+    }
+    return n;
+}
+
+// %[flags][width][.precision][length]conversion
+// flags: - 0 + space #, width and precision can be *, length: hh h l ll z
+// conversions: c s d i u x X o b p %, b is binary
+static void format(output_t* out, const char* format, va_list arg) {
+    while(*format) {
+        if(*format != '%') {
+            const char* text = format;
+            while(*format && *format != '%') format++;
+            put(out, text, format - text);
             continue;
         }
 
-        const char* format_begun_at = format++;
+        const char* spec_start = format++;
 
-        if(*format == 'c') {
-            format++;
-            char c = (char) va_arg(parameters, int /* char promotes to int */);
-            if(!maxrem) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
+        unsigned flags = 0;
+        for(;; format++) {
+            if(*format == '-') flags |= FLAG_LEFT;
+            else if(*format == '0') flags |= FLAG_ZERO;
+            else if(*format == '+') flags |= FLAG_PLUS;
+            else if(*format == ' ') flags |= FLAG_SPACE;
+            else if(*format == '#') flags |= FLAG_ALT;
+            else break;
+        }
+
+        int width = 0;
+        if(*format == '*') {
+            width = va_arg(arg, int);
+            if(width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
             }
-            if(!print(&c, sizeof(c)))
-                return -1;
-            written++;
+            format++;
         }
-        else if(*format == 's') {
+        else width = parse_int(&format);
+
+        int precision = -1;
+        if(*format == '.') {
             format++;
-            const char* str = va_arg(parameters, const char*);
-            size_t len = strlen(str);
-            if(maxrem < len) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
+            if(*format == '*') {
+                precision = va_arg(arg, int);
+                format++;
             }
-            if(!print(str, len))
-                return -1;
-            written += len;
+            else precision = parse_int(&format);
         }
-        else if(*format == 'b') {
+
+        // how many longs, negative for shorts
+        int length = 0;
+        if(*format == 'h') {
+            length = -1;
             format++;
-            int integer = va_arg(parameters, int);
-            size_t len = intlen(integer, 2);
-            char str[len + 1]; itoa(integer, str, 2);
-            if(maxrem < len) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
+            if(*format == 'h') {
+                length = -2;
+                format++;
             }
-            if(!print(str, len))
-                return -1;
-            written += len;
         }
-        else if(*format == 'd') {
+        else if(*format == 'l') {
+            length = 1;
             format++;
-            int integer = va_arg(parameters, int);
-            size_t len = intlen(integer, 10);
-            char str[len + 1]; itoa(integer, str, 10);
-            if(maxrem < len) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
+            if(*format == 'l') {
+                length = 2;
+                format++;
             }
-            if(!print(str, len))
-                return -1;
-            written += len;
         }
-        else if(*format == 'x') {
+        else if(*format == 'z') {
+            length = sizeof(size_t) == sizeof(uint64_t) ? 2 : 1;
             format++;
-            int integer = va_arg(parameters, int);
-            size_t len = intlen(integer, 16);
-            char str[len + 1]; itoa(integer, str, 16);
-            if(maxrem < len) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
-            }
-            if(!print(str, len))
-                return -1;
-            written += len;
         }
-        else {
-            format = format_begun_at;
-            size_t len = strlen(format);
-            if(maxrem < len) {
-                // TODO: set errno to ERR_OVERFLOW
-                return -1;
+
+        char conversion = *format;
+        if(conversion) format++;
+
+        switch(conversion) {
+            case '%':
+                put(out, "%", 1);
+                break;
+            case 'c': {
+                char c = (char)va_arg(arg, int /* char promotes to int */);
+                put_padded(out, &c, 1, flags, width);
+                break;
+            }
+            case 's': {
+                const char* str = va_arg(arg, const char*);
+                if(!str) str = "(null)";
+                int len = 0;
+                while(str[len] && (precision < 0 || len < precision)) len++;
+                put_padded(out, str, len, flags, width);
+                break;
+            }
+            case 'd':
+            case 'i': {
+                int64_t value;
+                if(length == 2) value = va_arg(arg, long long);
+                else if(length == 1) value = va_arg(arg, long);
+                else value = va_arg(arg, int);
+                if(length == -1) value = (short)value;
+                else if(length == -2) value = (signed char)value;
+
+                uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+                put_number(out, magnitude, value < 0, 10, false, flags, width, precision, "");
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'b': {
+                uint64_t value;
+                if(length == 2) value = va_arg(arg, unsigned long long);
+                else if(length == 1) value = va_arg(arg, unsigned long);
+                else value = va_arg(arg, unsigned);
+                if(length == -1) value = (unsigned short)value;
+                else if(length == -2) value = (unsigned char)value;
+
+                unsigned radix = conversion == 'u' ? 10 : conversion == 'o' ? 8 : conversion == 'b' ? 2 : 16;
+                const char* prefix = "";
+                // like C, a zero gets no prefix
+                if((flags & FLAG_ALT) && value) {
+                    if(conversion == 'x') prefix = "0x";
+                    else if(conversion == 'X') prefix = "0X";
+                    else if(conversion == 'o') prefix = "0";
+                    else if(conversion == 'b') prefix = "0b";
+                }
+                // only the sign flags of signed conversions make sense
+                flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                put_number(out, value, false, radix, conversion == 'X', flags, width, precision, prefix);
+                break;
+            }
+            case 'p': {
+                uintptr_t value = (uintptr_t)va_arg(arg, void*);
+                flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                put_number(out, value, false, 16, false, flags | FLAG_ALT, width, precision, "0x");
+                break;
             }
-            if(!print(format, len))
-                return -1;
-            written += len;
-            format += len;
+            default:
+                // not a conversion we know, print it as it is
+                put(out, spec_start, format - spec_start);
+                break;
         }
     }
+}
+
+// format into buffer, it always ends with a null if size is not 0
+// return the length the whole output would have
+int vsnprintf(char* restrict buffer, size_t size, const char* restrict fmt, va_list arg) {
+    output_t out = {buffer, size ? size - 1 : 0, 0, 0, NULL};
+    format(&out, fmt, arg);
+    if(size) buffer[out.pos] = '\0';
+    return out.total;
+}
+
+int snprintf(char* restrict buffer, size_t size, const char* restrict fmt, ...) {
+    va_list arg;
+    va_start(arg, fmt);
+    int len = vsnprintf(buffer, size, fmt, arg);
+    va_end(arg);
+    return len;
+}
+
+static void print(const char* data, size_t length) {
+#if defined(__is_libk)
+    // the whole buffer goes to the screen and the sinks in one write
+    console_write(data, length);
+#else
+    for(size_t i = 0; i < length; i++)
+        putchar(data[i]);
+#endif
+}
 
-    va_end(parameters);
-    return written;
+int vprintf(const char* restrict fmt, va_list arg) {
+    char buffer[PRINTF_BUFFER_SIZE];
+    output_t out = {buffer, sizeof(buffer), 0, 0, print};
+    format(&out, fmt, arg);
+    if(out.pos) print(buffer, out.pos);
+    return out.total;
+}
+
+int printf(const char* restrict fmt, ...) {
+    va_list arg;
+    va_start(arg, fmt);
+    int len = vprintf(fmt, arg);
+    va_end(arg);
+    return len;
 }
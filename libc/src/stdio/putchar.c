@@ -1,14 +1,15 @@
 #include "stdio.h"
 
 #if defined(__is_libk)
-#include "video.h"
+#include "console.h"
 #else
 #include "syscall.h"
 #endif
 
 int putchar(int ic) {
 #if defined(__is_libk)
-    video_print_char((char)ic, -1, -1, -1, true);
+    char c = (char)ic;
+    console_write(&c, 1);
 #else
     int ret;
     SYSCALL_1P(SYSCALL_PUTCHAR, ret, (char)ic);
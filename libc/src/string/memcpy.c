@@ -3,7 +3,23 @@
 void* memcpy(void* restrict dstptr, const void* restrict srcptr, size_t size) {
     unsigned char* dst = (unsigned char*)dstptr;
     const unsigned char* src = (const unsigned char*)srcptr;
-    for(size_t i = 0; i < size; i++)
-        dst[i] = src[i];
+
+    // align the destination first so no word store is split
+    size_t head = (-(uintptr_t)dst & 3);
+    if(head > size) head = size;
+    size -= head;
+    size_t words = size / 4;
+    size_t tail = size % 4;
+
+    asm volatile(
+        "rep movsb\n"
+        "mov %3, %%ecx\n"
+        "rep movsl\n"
+        "mov %4, %%ecx\n"
+        "rep movsb\n"
+        : "+D" (dst), "+S" (src), "+c" (head)
+        : "r" (words), "r" (tail)
+        : "memory"
+    );
     return dstptr;
 }
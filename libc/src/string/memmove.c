@@ -3,9 +3,28 @@
 void* memmove(void* dstptr, const void* srcptr, size_t size) {
     unsigned char* dst = (unsigned char*)dstptr;
     const unsigned char* src = (const unsigned char*)srcptr;
-    if(dst < src)
-        for(size_t i = 0; i < size; i++) dst[i] = src[i];
-    else
-        for(size_t i = size; i != 0; i--) dst[i-1] = src[i-1];
+
+    // copying forward is only wrong if dst starts inside src
+    if(dst <= src || dst >= src + size)
+        return memcpy(dstptr, srcptr, size);
+
+    // copy backward, the odd bytes at the end first and then whole words down to the start
+    size_t words = size / 4;
+    size_t tail = size % 4;
+    dst += size - 1;
+    src += size - 1;
+
+    asm volatile(
+        "std\n"
+        "rep movsb\n"
+        "sub $3, %%edi\n"
+        "sub $3, %%esi\n"
+        "mov %3, %%ecx\n"
+        "rep movsl\n"
+        "cld\n"
+        : "+D" (dst), "+S" (src), "+c" (tail)
+        : "r" (words)
+        : "memory"
+    );
     return dstptr;
 }
@@ -2,7 +2,24 @@
 
 void* memset(void* bufptr, int value, size_t size) {
     unsigned char* buf = (unsigned char*)bufptr;
-    for(size_t i = 0; i < size; i++)
-        buf[i] = (unsigned char)value;
+    // the byte in all four bytes of a word
+    uint32_t pattern = (unsigned char)value * 0x01010101;
+
+    size_t head = (-(uintptr_t)buf & 3);
+    if(head > size) head = size;
+    size -= head;
+    size_t words = size / 4;
+    size_t tail = size % 4;
+
+    asm volatile(
+        "rep stosb\n"
+        "mov %2, %%ecx\n"
+        "rep stosl\n"
+        "mov %3, %%ecx\n"
+        "rep stosb\n"
+        : "+D" (buf), "+c" (head)
+        : "r" (words), "r" (tail), "a" (pattern)
+        : "memory"
+    );
     return bufptr;
 }
@@ -0,0 +1,20 @@
+#include "sys/framebuffer.h"
+#include "stddef.h"
+
+#include "syscall.h"
+
+// map this process's screen buffer and describe it, NULL if there is none
+// draw into it and then call framebuffer_present to show a part of it
+void* framebuffer_map(framebuffer_info_t* info) {
+    void* buffer;
+    SYSCALL_1P(SYSCALL_FRAMEBUFFER_MAP, buffer, info);
+    return buffer;
+}
+
+// copy the rectangle from (x0, y0) to (x1, y1) of the buffer to the screen
+// return -1 if the buffer is not mapped
+int framebuffer_present(int x0, int y0, int x1, int y1) {
+    int ret;
+    SYSCALL_4P(SYSCALL_FRAMEBUFFER_PRESENT, ret, x0, y0, x1, y1);
+    return ret;
+}
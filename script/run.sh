@@ -1,12 +1,13 @@
 #!/bin/sh
 
 QEMUFLAGS="-m 128M \
+          -smp 4 \
           -serial stdio \
           -no-shutdown \
           -no-reboot \
           -audiodev pa,id=speaker \
           -machine pcspk-audiodev=speaker \
-          -accel tcg,thread=single \
+          -accel tcg,thread=multi \
           -usb"
 
 if [ "$1" == "debug" ]; then